@@ -28,19 +28,31 @@
 #include <fcntl.h>
 #include <math.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
 static const char usage[] = R"(
 Performs analogy testing of embedding vectors.
 
@@ -51,13 +63,23 @@ Usage:
 Options:
 
   --embeddings <filename>
-    The file containing the binary embedding vectors to evaluate.
+    The file containing the binary embedding vectors to evaluate: either raw
+    floats, as written by text2bin.py, or quantized vectors, as written by
+    quantize.  The file is memory-mapped rather than read.
 
   --vocab <filename>
     The vocabulary file corresponding to the embedding vectors.
 
   --nthreads <integer>
     The number of evaluation threads to run (default: 8)
+
+  --rescore <filename>
+    Raw float embedding vectors with which to rescore the best candidates
+    found with the --embeddings vectors; e.g., the vectors that were
+    quantized.
+
+  --shortlist <integer>
+    The number of candidates to rescore for each analogy (default: 10)
 )";
 
 // Reads the vocabulary file into a map from token to vector index.
@@ -125,19 +147,390 @@ std::vector<AnalogyQuery> ReadQueries(
 }
 
 
+// The header of an embeddings file in the quantized format written by
+// "quantize".  The vectors were normalized before they were quantized.  For
+// int8 vectors, the header is followed by a float scale for each vector and
+// then by the vectors, so that vec[j] ~= scale * q[j].  For fp16 vectors, the
+// header is followed by the vectors as IEEE half-precision floats.
+struct quantized_header_t {
+  char magic[8];
+  int type;
+  int dim;
+  long long num_vectors;
+};
+
+static_assert(sizeof(quantized_header_t) == 24, "unexpected header layout");
+
+static const char kQuantizedMagic[] = "SWVLQNT1";
+
+// The types of the elements of the vectors in an embeddings file.
+enum EmbeddingsType { kFloat = 0, kInt8 = 1, kFp16 = 2 };
+
+// Converts an IEEE half-precision float to a float.
+static inline float HalfToFloat(uint16_t h) {
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+
+  if (exponent == 0) {
+    // Zero or subnormal.
+    const float f = mantissa * (1.0f / (1 << 24));
+    return sign ? -f : f;
+  }
+
+  const uint32_t bits =
+      exponent == 0x1f ? sign | 0x7f800000 | (mantissa << 13)
+                       : sign | ((exponent + 112) << 23) | (mantissa << 13);
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// Converts an element of a stored vector to a float.
+static inline float ToFloat(float x) { return x; }
+static inline float ToFloat(int8_t x) { return x; }
+static inline float ToFloat(uint16_t x) { return HalfToFloat(x); }
+
+// The number of queries that are scored together, so that one pass over the
+// embedding matrix serves all of them rather than just one.
+static const int kQueryBatch = 32;
+
+// The number of embedding vectors that are scored together: a block stays in
+// cache while each query of the batch is scored against it.
+static const int kRowBlock = 256;
+
+#ifdef __AVX__
+// Returns the sum of the eight floats of the vector.
+static inline float HorizontalSum(__m256 v) {
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v, 1));
+  sum = _mm_hadd_ps(sum, sum);
+  sum = _mm_hadd_ps(sum, sum);
+  return _mm_cvtss_f32(sum);
+}
+
+// Loads eight elements of a stored vector as floats.
+static inline __m256 Load8(const float *p) { return _mm256_loadu_ps(p); }
+
+static inline __m256 Load8(const int8_t *p) {
+  const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+  const __m128i lo = _mm_cvtepi8_epi32(bytes);
+  const __m128i hi = _mm_cvtepi8_epi32(_mm_srli_si128(bytes, 4));
+  return _mm256_cvtepi32_ps(
+      _mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+}
+
+static inline __m256 Load8(const uint16_t *p) {
+#ifdef __F16C__
+  return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+#else
+  float f[8];
+  for (int k = 0; k < 8; ++k) f[k] = HalfToFloat(p[k]);
+  return _mm256_loadu_ps(f);
+#endif
+}
+#endif
+
+// Computes the dot products of NR rows with four queries into
+// dots[r * 4 + q].  Each row is loaded once for all four queries, and each
+// query once for all of the rows.
+template <int NR, typename T>
+static inline void DotKernel(const T *const *rows,
+                             const float *const *queries, const int dim,
+                             float *dots) {
+  int j = 0;
+
+#ifdef __AVX__
+  __m256 acc[NR][4];
+  for (int r = 0; r < NR; ++r)
+    for (int q = 0; q < 4; ++q) acc[r][q] = _mm256_setzero_ps();
+
+  for (; j + 8 <= dim; j += 8) {
+    __m256 query[4];
+    for (int q = 0; q < 4; ++q) query[q] = _mm256_loadu_ps(queries[q] + j);
+
+    for (int r = 0; r < NR; ++r) {
+      const __m256 row = Load8(rows[r] + j);
+      for (int q = 0; q < 4; ++q)
+        acc[r][q] = _mm256_add_ps(acc[r][q], _mm256_mul_ps(row, query[q]));
+    }
+  }
+
+  for (int r = 0; r < NR; ++r)
+    for (int q = 0; q < 4; ++q) dots[r * 4 + q] = HorizontalSum(acc[r][q]);
+#else
+  for (int k = 0; k < NR * 4; ++k) dots[k] = 0;
+#endif
+
+  for (; j < dim; ++j) {
+    for (int r = 0; r < NR; ++r) {
+      const float x = ToFloat(rows[r][j]);
+      for (int q = 0; q < 4; ++q) dots[r * 4 + q] += x * queries[q][j];
+    }
+  }
+}
+
+// Computes the dot products of a block of num_rows stored vectors with a
+// batch of query vectors into scores[q * num_rows + r].  The number of
+// queries must be a multiple of four.
+template <typename T>
+static void ScoreRows(const T *rows, const int num_rows, const float *queries,
+                      const int num_queries, const int dim, float *scores) {
+  for (int q = 0; q < num_queries; q += 4) {
+    const float *const query_vecs[4] = {
+        queries + dim * q, queries + dim * (q + 1), queries + dim * (q + 2),
+        queries + dim * (q + 3)};
+
+    float *const query_scores = scores + num_rows * q;
+    float dots[8];
+
+    // Two rows at a time, so each query vector loaded serves both.
+    int r = 0;
+    for (; r + 2 <= num_rows; r += 2) {
+      const T *const row_vecs[2] = {rows + dim * r, rows + dim * (r + 1)};
+      DotKernel<2>(row_vecs, query_vecs, dim, dots);
+      for (int k = 0; k < 4; ++k) {
+        query_scores[num_rows * k + r] = dots[k];
+        query_scores[num_rows * k + r + 1] = dots[4 + k];
+      }
+    }
+
+    for (; r < num_rows; ++r) {
+      const T *const row_vecs[1] = {rows + dim * r};
+      DotKernel<1>(row_vecs, query_vecs, dim, dots);
+      for (int k = 0; k < 4; ++k) query_scores[num_rows * k + r] = dots[k];
+    }
+  }
+}
+
+// The embedding vectors, memory-mapped from either the raw float format that
+// text2bin.py writes or the quantized format that "quantize" writes.  Raw
+// vectors are scaled by the inverse of their norms, which are computed when
+// they're loaded, rather than normalized in place; quantized vectors were
+// normalized before they were quantized.
+class Embeddings {
+ public:
+  Embeddings()
+      : mapping_(nullptr),
+        mapping_size_(0),
+        type_(kFloat),
+        num_vectors_(0),
+        dim_(0),
+        data_(nullptr),
+        scales_(nullptr) {}
+
+  ~Embeddings() {
+    if (mapping_) munmap(mapping_, mapping_size_);
+  }
+
+  // Maps the vectors for a vocabulary of num_vectors words, computing the
+  // norms of raw vectors on nthreads threads.  Returns false, after
+  // explaining why, if the file can't be read or doesn't match the
+  // vocabulary.
+  bool Open(const std::string &filename, int num_vectors, int nthreads);
+
+  int dim() const { return dim_; }
+
+  // Copies the normalized vector with the index into vec.
+  void GetVector(int ix, float *vec) const;
+
+  // Computes the cosine similarities of vectors [start, start + num_rows)
+  // with a batch of queries into scores[q * num_rows + r].  The number of
+  // queries must be a multiple of four.
+  void ScoreBlock(int start, int num_rows, const float *queries,
+                  int num_queries, float *scores) const;
+
+ protected:
+  // The mapping of the file.
+  void *mapping_;
+  size_t mapping_size_;
+
+  EmbeddingsType type_;
+  int num_vectors_;
+  int dim_;
+
+  // The vectors, whose elements are of the type.
+  const void *data_;
+
+  // A factor for each vector by which its dot products are scaled: the
+  // inverse norms of raw vectors, or the scales of int8 vectors.
+  const float *scales_;
+
+  // The inverse norms of raw vectors.
+  std::vector<float> inv_norms_;
+};
+
+bool Embeddings::Open(const std::string &filename, const int num_vectors,
+                      const int nthreads) {
+  int fd;
+  if ((fd = open(filename.c_str(), O_RDONLY)) < 0) {
+    std::cerr << "unable to open embeddings file '" << filename << "'"
+              << std::endl;
+    return false;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) != 0) {
+    std::cerr << "unable to determine file size for '" << filename << "'"
+              << std::endl;
+    close(fd);
+    return false;
+  }
+
+  mapping_size_ = sb.st_size;
+  if (mapping_size_ > 0) {
+    mapping_ = mmap(nullptr, mapping_size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping_ == MAP_FAILED) mapping_ = nullptr;
+  }
+
+  close(fd);
+
+  if (!mapping_) {
+    std::cerr << "unable to read embeddings from " << filename << std::endl;
+    return false;
+  }
+
+  num_vectors_ = num_vectors;
+  const char *bytes = static_cast<const char *>(mapping_);
+
+  quantized_header_t header;
+  if (mapping_size_ >= sizeof(header) &&
+      memcmp(bytes, kQuantizedMagic, sizeof(header.magic)) == 0) {
+    memcpy(&header, bytes, sizeof(header));
+    type_ = static_cast<EmbeddingsType>(header.type);
+    dim_ = header.dim;
+
+    const size_t num_scales = type_ == kInt8 ? num_vectors : 0;
+    const size_t elt_size = type_ == kInt8 ? sizeof(int8_t) : sizeof(uint16_t);
+    if ((type_ != kInt8 && type_ != kFp16) || dim_ <= 0 ||
+        header.num_vectors != num_vectors ||
+        mapping_size_ != sizeof(header) + sizeof(float) * num_scales +
+                             elt_size * num_vectors * dim_) {
+      std::cerr << "'" << filename << "' is not a valid quantized embeddings "
+                << "file for the vocabulary" << std::endl;
+      return false;
+    }
+
+    scales_ = num_scales ? reinterpret_cast<const float *>(bytes +
+                                                            sizeof(header))
+                         : nullptr;
+
+    data_ = bytes + sizeof(header) + sizeof(float) * num_scales;
+    return true;
+  }
+
+  if (mapping_size_ % (sizeof(float) * num_vectors) != 0) {
+    std::cerr << "'" << filename
+              << "' has a strange file size; expected it to be "
+                 "a multiple of the vocabulary size"
+              << std::endl;
+
+    return false;
+  }
+
+  type_ = kFloat;
+  dim_ = mapping_size_ / (sizeof(float) * num_vectors);
+  data_ = mapping_;
+
+  // Compute the inverse norms, each thread taking a range of the vectors.
+  inv_norms_.resize(num_vectors);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nthreads; ++t) {
+    const int begin = static_cast<long long>(num_vectors) * t / nthreads;
+    const int end = static_cast<long long>(num_vectors) * (t + 1) / nthreads;
+    threads.emplace_back([this, begin, end]() {
+      const float *const vecs = static_cast<const float *>(data_);
+      for (int i = begin; i < end; ++i) {
+        const float *vec = vecs + static_cast<size_t>(dim_) * i;
+        float norm = 0;
+        for (int j = 0; j < dim_; ++j) norm += vec[j] * vec[j];
+
+        inv_norms_[i] = 1.0f / sqrt(norm);
+      }
+    });
+  }
+
+  for (std::thread &thread : threads) thread.join();
+
+  scales_ = inv_norms_.data();
+  return true;
+}
+
+void Embeddings::GetVector(const int ix, float *vec) const {
+  const size_t offset = static_cast<size_t>(dim_) * ix;
+  const float scale = scales_ ? scales_[ix] : 1.0f;
+  switch (type_) {
+    case kFloat: {
+      const float *src = static_cast<const float *>(data_) + offset;
+      for (int j = 0; j < dim_; ++j) vec[j] = src[j] * scale;
+      break;
+    }
+
+    case kInt8: {
+      const int8_t *src = static_cast<const int8_t *>(data_) + offset;
+      for (int j = 0; j < dim_; ++j) vec[j] = src[j] * scale;
+      break;
+    }
+
+    case kFp16: {
+      const uint16_t *src = static_cast<const uint16_t *>(data_) + offset;
+      for (int j = 0; j < dim_; ++j) vec[j] = HalfToFloat(src[j]);
+      break;
+    }
+  }
+}
+
+void Embeddings::ScoreBlock(const int start, const int num_rows,
+                            const float *queries, const int num_queries,
+                            float *scores) const {
+  const size_t offset = static_cast<size_t>(dim_) * start;
+  switch (type_) {
+    case kFloat:
+      ScoreRows(static_cast<const float *>(data_) + offset, num_rows, queries,
+                num_queries, dim_, scores);
+      break;
+
+    case kInt8:
+      ScoreRows(static_cast<const int8_t *>(data_) + offset, num_rows,
+                queries, num_queries, dim_, scores);
+      break;
+
+    case kFp16:
+      ScoreRows(static_cast<const uint16_t *>(data_) + offset, num_rows,
+                queries, num_queries, dim_, scores);
+      break;
+  }
+
+  if (scales_) {
+    for (int q = 0; q < num_queries; ++q) {
+      float *query_scores = scores + num_rows * q;
+      for (int r = 0; r < num_rows; ++r) query_scores[r] *= scales_[start + r];
+    }
+  }
+}
+
+// A candidate answer to a query and its score.
+typedef std::pair<float, int> Candidate;
+
 // A thread that evaluates some fraction of the analogies.
 class AnalogyEvaluator {
  public:
-  // Creates a new Analogy evaluator for a range of analogy queries.
+  // Creates a new Analogy evaluator for a range of analogy queries.  The
+  // shortlist_size best candidates of each query are kept, and if there are
+  // rescoring embeddings, the answer is the candidate that scores best with
+  // them.
   AnalogyEvaluator(std::vector<AnalogyQuery>::const_iterator begin,
                    std::vector<AnalogyQuery>::const_iterator end,
-                   const float *embeddings, const int num_embeddings,
-                   const int dim)
+                   const Embeddings &embeddings, const int num_embeddings,
+                   const Embeddings *rescore_embeddings,
+                   const int shortlist_size)
       : begin_(begin),
         end_(end),
         embeddings_(embeddings),
         num_embeddings_(num_embeddings),
-        dim_(dim) {}
+        dim_(embeddings.dim()),
+        rescore_embeddings_(rescore_embeddings),
+        shortlist_size_(shortlist_size) {}
 
   // A thunk for pthreads.
   static void* Run(void *param) {
@@ -153,14 +546,22 @@ class AnalogyEvaluator {
   int GetNumCorrect() const { return correct_; }
 
  protected:
+  // Computes C - A + B for the query into sum.
+  static void QueryVector(const Embeddings &embeddings,
+                          const AnalogyQuery &query, float *sum);
+
+  // Returns the answer to the query from its shortlist of candidates.
+  int Answer(const AnalogyQuery &query, const std::vector<Candidate> &shortlist,
+             std::vector<float> *scratch) const;
+
   // The beginning of the range of queries to consider.
   std::vector<AnalogyQuery>::const_iterator begin_;
 
   // The end of the range of queries to consider.
   std::vector<AnalogyQuery>::const_iterator end_;
 
-  // The raw embedding vectors.
-  const float *embeddings_;
+  // The embedding vectors.
+  const Embeddings &embeddings_;
 
   // The number of embedding vectors.
   const int num_embeddings_;
@@ -168,52 +569,144 @@ class AnalogyEvaluator {
   // The embedding vector dimensionality.
   const int dim_;
 
+  // The embedding vectors with which to rescore the shortlists, if any.
+  const Embeddings *rescore_embeddings_;
+
+  // The number of candidates kept for each query.
+  const int shortlist_size_;
+
   // The number of correct analogies.
   int correct_;
 };
 
+void AnalogyEvaluator::QueryVector(const Embeddings &embeddings,
+                                   const AnalogyQuery &query, float *sum) {
+  const int dim = embeddings.dim();
+  std::vector<float> vec(dim);
+  int a, b, c, d;
+  std::tie(a, b, c, d) = query;
 
-void AnalogyEvaluator::Evaluate() {
-  float* sum = new float[dim_];
+  // Compute C - A + B.
+  embeddings.GetVector(c, sum);
 
-  correct_ = 0;
-  for (auto query = begin_; query < end_; ++query) {
-    const float* vec;
-    int a, b, c, d;
-    std::tie(a, b, c, d) = *query;
+  embeddings.GetVector(a, vec.data());
+  for (int i = 0; i < dim; ++i) sum[i] -= vec[i];
+
+  embeddings.GetVector(b, vec.data());
+  for (int i = 0; i < dim; ++i) sum[i] += vec[i];
+}
+
+int AnalogyEvaluator::Answer(const AnalogyQuery &query,
+                             const std::vector<Candidate> &shortlist,
+                             std::vector<float> *scratch) const {
+  // Without rescoring, the best candidate wins, with ties going to the
+  // first word in the vocabulary.
+  int best_ix = -1;
+  float best_dot = -1.0;
+  if (!rescore_embeddings_) {
+    for (const Candidate &candidate : shortlist) {
+      if (candidate.first > best_dot ||
+          (candidate.first == best_dot && candidate.second < best_ix)) {
+        best_dot = candidate.first;
+        best_ix = candidate.second;
+      }
+    }
+
+    return best_ix;
+  }
 
-    // Compute C - A + B.
-    vec = embeddings_ + dim_ * c;
-    for (int i = 0; i < dim_; ++i) sum[i] = vec[i];
+  // Rescore the candidates with the other vectors.
+  const int dim = rescore_embeddings_->dim();
+  scratch->resize(2 * dim);
+  float *sum = scratch->data();
+  float *vec = sum + dim;
+  QueryVector(*rescore_embeddings_, query, sum);
 
-    vec = embeddings_ + dim_ * a;
-    for (int i = 0; i < dim_; ++i) sum[i] -= vec[i];
+  for (const Candidate &candidate : shortlist) {
+    rescore_embeddings_->GetVector(candidate.second, vec);
 
-    vec = embeddings_ + dim_ * b;
-    for (int i = 0; i < dim_; ++i) sum[i] += vec[i];
+    float dot = 0;
+    for (int j = 0; j < dim; ++j) dot += vec[j] * sum[j];
+
+    if (dot > best_dot || (dot == best_dot && candidate.second < best_ix)) {
+      best_dot = dot;
+      best_ix = candidate.second;
+    }
+  }
 
-    // Find the nearest neighbor that isn't one of the query words.
-    int best_ix = -1;
-    float best_dot = -1.0;
-    for (int i = 0; i < num_embeddings_; ++i) {
-      if (i == a || i == b || i == c) continue;
+  return best_ix;
+}
 
-      vec = embeddings_ + dim_ * i;
+void AnalogyEvaluator::Evaluate() {
+  // The query vectors of a batch, padded with zero vectors to a multiple of
+  // four, and their scores against a block of embedding vectors.
+  std::vector<float> sums(kQueryBatch * dim_);
+  std::vector<float> scores(kQueryBatch * kRowBlock);
+  std::vector<float> scratch;
 
-      float dot = 0;
-      for (int j = 0; j < dim_; ++j) dot += vec[j] * sum[j];
+  // The best candidates for each query of the batch found so far, as a
+  // min-heap, and the score a candidate must beat to be added.
+  std::vector<Candidate> shortlists[kQueryBatch];
+  float thresholds[kQueryBatch];
 
-      if (dot > best_dot) {
-        best_ix = i;
-        best_dot = dot;
+  correct_ = 0;
+  const int num_queries = end_ - begin_;
+  for (int first = 0; first < num_queries; first += kQueryBatch) {
+    const int batch_size = std::min(kQueryBatch, num_queries - first);
+    const int padded_size = (batch_size + 3) & ~3;
+
+    for (int q = 0; q < batch_size; ++q) {
+      QueryVector(embeddings_, begin_[first + q], sums.data() + dim_ * q);
+      shortlists[q].clear();
+      thresholds[q] = -1.0;
+    }
+
+    std::fill(sums.begin() + dim_ * batch_size,
+              sums.begin() + dim_ * padded_size, 0.0f);
+
+    for (int start = 0; start < num_embeddings_; start += kRowBlock) {
+      const int num_rows = std::min(kRowBlock, num_embeddings_ - start);
+      embeddings_.ScoreBlock(start, num_rows, sums.data(), padded_size,
+                             scores.data());
+
+      // Find the nearest neighbors in the block that aren't one of the query
+      // words.  The blocks are visited in order, and a candidate must beat
+      // the worst of a full shortlist, so ties go to the first neighbor.
+      for (int q = 0; q < batch_size; ++q) {
+        int a, b, c, d;
+        std::tie(a, b, c, d) = begin_[first + q];
+
+        std::vector<Candidate> &shortlist = shortlists[q];
+        const float *query_scores = scores.data() + num_rows * q;
+        for (int r = 0; r < num_rows; ++r) {
+          if (!(query_scores[r] > thresholds[q])) continue;
+
+          const int i = start + r;
+          if (i == a || i == b || i == c) continue;
+
+          shortlist.emplace_back(query_scores[r], i);
+          std::push_heap(shortlist.begin(), shortlist.end(),
+                         std::greater<Candidate>());
+
+          if (static_cast<int>(shortlist.size()) > shortlist_size_) {
+            std::pop_heap(shortlist.begin(), shortlist.end(),
+                          std::greater<Candidate>());
+            shortlist.pop_back();
+          }
+
+          if (static_cast<int>(shortlist.size()) == shortlist_size_)
+            thresholds[q] = shortlist.front().first;
+        }
       }
     }
 
     // The fourth word is the answer; did we get it right?
-    if (best_ix == d) ++correct_;
+    for (int q = 0; q < batch_size; ++q) {
+      const AnalogyQuery &query = begin_[first + q];
+      if (Answer(query, shortlists[q], &scratch) == std::get<3>(query))
+        ++correct_;
+    }
   }
-
-  delete[] sum;
 }
 
 
@@ -223,8 +716,9 @@ int main(int argc, char *argv[]) {
     return 2;
   }
 
-  std::string embeddings_filename, vocab_filename;
+  std::string embeddings_filename, vocab_filename, rescore_filename;
   int nthreads = 8;
+  int shortlist_size = 0;
 
   std::vector<std::string> input_filenames;
   std::vector<std::tuple<int, int, int, int>> queries;
@@ -240,6 +734,12 @@ int main(int argc, char *argv[]) {
     } else if (arg == "--nthreads") {
       if (++i >= argc) goto argmissing;
       if ((nthreads = atoi(argv[i])) <= 0) goto badarg;
+    } else if (arg == "--rescore") {
+      if (++i >= argc) goto argmissing;
+      rescore_filename = argv[i];
+    } else if (arg == "--shortlist") {
+      if (++i >= argc) goto argmissing;
+      if ((shortlist_size = atoi(argv[i])) <= 0) goto badarg;
     } else if (arg == "--help") {
       std::cout << usage << std::endl;
       return 0;
@@ -274,49 +774,16 @@ int main(int argc, char *argv[]) {
 
   const int n = vocab.size();
 
-  // Read the vectors.
-  int fd;
-  if ((fd = open(embeddings_filename.c_str(), O_RDONLY)) < 0) {
-    std::cerr << "unable to open embeddings file '" << embeddings_filename
-              << "'" << std::endl;
-    return 1;
-  }
+  // Map the vectors.
+  Embeddings embeddings;
+  if (!embeddings.Open(embeddings_filename, n, nthreads)) return 1;
 
-  off_t nbytes = lseek(fd, 0, SEEK_END);
-  if (nbytes == -1) {
-    std::cerr << "unable to determine file size for '" << embeddings_filename
-              << "'" << std::endl;
-    return 1;
-  }
-
-  if (nbytes % (sizeof(float) * n) != 0) {
-    std::cerr << "'" << embeddings_filename
-              << "' has a strange file size; expected it to be "
-                 "a multiple of the vocabulary size"
-              << std::endl;
-
-    return 1;
-  }
-
-  const int dim = nbytes / (sizeof(float) * n);
-  float *embeddings = static_cast<float *>(malloc(nbytes));
-  lseek(fd, 0, SEEK_SET);
-  if (read(fd, embeddings, nbytes) < nbytes) {
-    std::cerr << "unable to read embeddings from " << embeddings_filename
-              << std::endl;
-    return 1;
-  }
-
-  close(fd);
-
-  /* Normalize the vectors. */
-  for (int i = 0; i < n; ++i) {
-    float *vec = embeddings + dim * i;
-    float norm = 0;
-    for (int j = 0; j < dim; ++j) norm += vec[j] * vec[j];
-
-    norm = sqrt(norm);
-    for (int j = 0; j < dim; ++j) vec[j] /= norm;
+  Embeddings rescore_embeddings;
+  if (!rescore_filename.empty()) {
+    if (!rescore_embeddings.Open(rescore_filename, n, nthreads)) return 1;
+    if (shortlist_size == 0) shortlist_size = 10;
+  } else if (shortlist_size == 0) {
+    shortlist_size = 1;
   }
 
   pthread_attr_t attr;
@@ -331,6 +798,8 @@ int main(int argc, char *argv[]) {
     std::vector<AnalogyQuery> queries =
         ReadQueries(filename.c_str(), vocab, &total);
 
+    const auto start = std::chrono::steady_clock::now();
+
     const int queries_per_thread = queries.size() / nthreads;
     std::vector<AnalogyEvaluator*> evaluators;
     std::vector<pthread_t> threads;
@@ -341,8 +810,10 @@ int main(int argc, char *argv[]) {
                      ? queries.begin() + (i + 1) * queries_per_thread
                      : queries.end();
 
-      AnalogyEvaluator *evaluator =
-          new AnalogyEvaluator(begin, end, embeddings, n, dim);
+      AnalogyEvaluator *evaluator = new AnalogyEvaluator(
+          begin, end, embeddings, n,
+          rescore_filename.empty() ? nullptr : &rescore_embeddings,
+          shortlist_size);
 
       pthread_t thread;
       pthread_create(&thread, &attr, AnalogyEvaluator::Run, evaluator);
@@ -352,6 +823,13 @@ int main(int argc, char *argv[]) {
 
     for (auto &thread : threads) pthread_join(thread, 0);
 
+    // Report the throughput on stderr, to keep stdout for the results.
+    const std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+    fprintf(stderr, "%s: %zu queries in %0.2fs (%0.1f queries/sec)\n",
+            filename.c_str(), queries.size(), secs.count(),
+            queries.size() / secs.count());
+
     int correct = 0;
     for (const AnalogyEvaluator* evaluator : evaluators) {
       correct += evaluator->GetNumCorrect();
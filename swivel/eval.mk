@@ -18,9 +18,10 @@
 # Word similarity evaluations are formatted to contain exactly three columns:
 # the two words being compared and the human judgement.
 #
-# Use wordsim.py and analogy to run the actual evaluations.
+# Use wordsim.py and analogy to run the actual evaluations.  Use quantize to
+# convert embeddings to the smaller int8 or fp16 formats that analogy reads.
 
-CXXFLAGS=-std=c++11 -m64 -mavx -g -Ofast -Wall
+CXXFLAGS=-std=c++11 -m64 -march=native -g -Ofast -Wall
 LDLIBS=-lpthread -lm
 
 WORDSIM_EVALS=	ws353sim.ws.tab \
@@ -35,7 +36,7 @@ ANALOGY_EVALS=	mikolov.an.tab \
 		msr.an.tab \
 		$(NULL)
 
-all: $(WORDSIM_EVALS) $(ANALOGY_EVALS) analogy
+all: $(WORDSIM_EVALS) $(ANALOGY_EVALS) analogy quantize
 
 ws353sim.ws.tab: ws353simrel.tar.gz
 	tar Oxfz $^ wordsim353_sim_rel/wordsim_similarity_goldstandard.txt > $@
@@ -91,8 +92,10 @@ myz_naacl13_test_set.tgz:
 
 analogy: analogy.cc
 
+quantize: quantize.cc
+
 clean:
-	rm -f *.ws.tab *.an.tab analogy *.pyc
+	rm -f *.ws.tab *.an.tab analogy quantize *.pyc
 
 distclean: clean
 	rm -f *.tgz *.tar.gz *.zip Mtruk.csv questions-words.txt
@@ -24,24 +24,39 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <glob.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <tuple>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include <zlib.h>
+#ifdef FASTPREP_ZSTD
+#include <zstd.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "tensorflow/core/example/example.pb.h"
 #include "tensorflow/core/example/feature.pb.h"
@@ -51,12 +66,17 @@ Prepares a corpus for processing by Swivel.
 
 Usage:
 
-  prep --output_dir <output-dir> --input <text-file>
+  prep --output_dir <output-dir> --input <text-file> [--input ...]
 
 Options:
 
   --input <filename>
-      The input text.
+      The input text.  May be given more than once, and may be a glob
+      pattern such as 'corpus/*.txt.gz'; the results are the same as for
+      the concatenation of the files in order, with each file ending a
+      sentence.  Files compressed with gzip are decompressed as they are
+      read, as are files compressed with zstd if fastprep was built with
+      ZSTD=1.
 
   --output_dir <directory>
       Specifies the output directory where the various Swivel data
@@ -82,8 +102,30 @@ Options:
       default 10.
 
   --num_threads <int>
-      The number of workers to calculate the co-occurrence matrix;
-      default 4.
+      The number of workers to calculate the vocabulary and the
+      co-occurrence matrix; default 4.
+
+  --output_format <example|packed>
+      The format of the shard files.  "example" writes each shard as a
+      serialized tf.Example in shard-NNN-NNN.pb; "packed" writes a small
+      header followed by contiguous arrays in shard-NNN-NNN.packed, which
+      swivel.py can read without a proto size limit.  Default "example".
+
+  --base_dir <directory>
+      Adds the input to the co-occurrence data of an earlier run in the
+      directory, without reading that run's input again.  The vocabulary,
+      marginals and shards of the directory are read, so --vocab must not be
+      used, and --shard_size must be the same as before.  The output directory
+      may be the base directory, to update it in place: every base shard is
+      checked before anything is written, and the new files are renamed into
+      place at the end, the marginals last.  Until they all are, the
+      directory holds an update_in_progress file, and can't be used as a base
+      directory.  Packed shards are the cheapest to merge.
+
+  --in_memory
+      Aggregates the co-occurrence matrix in memory rather than in temporary
+      files in the output directory.  This is faster, but the aggregated
+      matrix must fit in RAM.
 )";
 
 struct cooc_t {
@@ -92,100 +134,700 @@ struct cooc_t {
   float cnt;
 };
 
-typedef std::map<long long, float> cooc_counts_t;
+// Header of a shard in the packed format.  The header is followed by five
+// contiguous little-endian arrays, so that a shard can be memory-mapped and
+// used in place:
+//
+//   int64 global_row[num_rows]
+//   int64 global_col[num_cols]
+//   int32 sparse_local_row[num_coocs]
+//   int32 sparse_local_col[num_coocs]
+//   float sparse_value[num_coocs]
+//
+// These hold the same data as the features of the tf.Example shards.
+struct packed_shard_header_t {
+  char magic[8];
+  long long num_rows;
+  long long num_cols;
+  long long num_coocs;
+};
 
-// Retrieves the next word from the input stream, treating words as simply being
-// delimited by whitespace.  Returns true if this is the end of a "sentence";
-// i.e., a newline.
-bool NextWord(std::ifstream &fin, std::string* word) {
-  std::string buf;
-  char c;
+static_assert(sizeof(packed_shard_header_t) == 32, "unexpected padding");
 
-  if (fin.eof()) {
-    word->erase();
-    return true;
+static const char kPackedShardMagic[] = "SWVLPCK1";
+
+// Accumulates co-occurrence counts keyed by the packed (row, col) pair.  This
+// is an open-addressing hash table with linear probing: the counts are kept in
+// one flat array so that counting a pair is usually a single cache miss, rather
+// than the walk through a tree of nodes of a std::map.
+class CoocCounts {
+ public:
+  // Creates an empty table with the initial number of slots, which must be a
+  // power of two.
+  explicit CoocCounts(size_t num_slots = 1 << 16)
+      : slots_(num_slots, slot_t{kEmptyKey, 0}), size_(0) {}
+
+  // Adds the count to the entry for the key, which must be non-negative.
+  void Add(long long key, double cnt) {
+    const size_t mask = slots_.size() - 1;
+    size_t pos = Hash(key) & mask;
+    while (slots_[pos].key != key) {
+      if (slots_[pos].key == kEmptyKey) {
+        slots_[pos].key = key;
+        if (4 * ++size_ > 3 * slots_.size()) {
+          Grow();
+          Add(key, cnt);
+          return;
+        }
+
+        break;
+      }
+
+      pos = (pos + 1) & mask;
+    }
+
+    slots_[pos].cnt += cnt;
   }
 
-  // Skip leading whitespace.
-  do {
-    c = fin.get();
-  } while (!fin.eof() && std::isspace(c));
+  // Calls f(key, cnt) for every entry, in no particular order.
+  template <typename F>
+  void ForEach(F f) const {
+    for (const auto &slot : slots_) {
+      if (slot.key != kEmptyKey) f(slot.key, slot.cnt);
+    }
+  }
 
-  if (fin.eof()) {
-    word->erase();
-    return true;
+  // Returns the number of distinct keys.
+  size_t size() const { return size_; }
+
+  // Removes all the entries, but keeps the memory for reuse.
+  void clear() {
+    std::fill(slots_.begin(), slots_.end(), slot_t{kEmptyKey, 0});
+    size_ = 0;
+  }
+
+ protected:
+  struct slot_t {
+    long long key;
+    float cnt;
+  };
+
+  static const long long kEmptyKey = -1;
+
+  // Mixes the bits of the key (Fibonacci hashing followed by a fold), so that
+  // neighboring ids don't cluster in the table.
+  static size_t Hash(long long key) {
+    const unsigned long long h =
+        static_cast<unsigned long long>(key) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+  }
+
+  // Doubles the number of slots and re-inserts the entries.
+  void Grow() {
+    std::vector<slot_t> old_slots(2 * slots_.size(), slot_t{kEmptyKey, 0});
+    old_slots.swap(slots_);
+
+    const size_t mask = slots_.size() - 1;
+    for (const auto &slot : old_slots) {
+      if (slot.key == kEmptyKey) continue;
+      size_t pos = Hash(slot.key) & mask;
+      while (slots_[pos].key != kEmptyKey) pos = (pos + 1) & mask;
+      slots_[pos] = slot;
+    }
   }
 
+  std::vector<slot_t> slots_;
+  size_t size_;
+};
+
+// A read-only memory mapping of the input text.  Words are scanned directly
+// from the mapping, so reading the input doesn't copy it.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string &filename);
+  ~MappedFile();
+
+  // Returns true if the file was mapped successfully.
+  bool ok() const { return ok_; }
+
+  const char *data() const { return data_; }
+  off_t size() const { return size_; }
+
+ protected:
+  const char *data_;
+  off_t size_;
+  bool ok_;
+};
+
+MappedFile::MappedFile(const std::string &filename)
+    : data_(nullptr), size_(0), ok_(false) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat sb;
+  if (fstat(fd, &sb) == 0) {
+    size_ = sb.st_size;
+    if (size_ == 0) {
+      ok_ = true;
+    } else {
+      void *addr = mmap(0, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        madvise(addr, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char *>(addr);
+        ok_ = true;
+      }
+    }
+  }
+
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_) munmap(const_cast<char *>(data_), size_);
+}
+
+// Returns true if the character is whitespace in the "C" locale.
+inline bool IsSpace(char c) {
+  return c == ' ' || static_cast<unsigned char>(c) - 9u < 5u;
+}
+
+// Returns the first whitespace character in [p, end), or end if there is none.
+inline const char *FindSpace(const char *p, const char *end) {
+#ifdef __SSE2__
+  // Checks 16 characters at a time: a character is whitespace if it is a
+  // space, or if it is one of the five control characters from '\t' to '\r'.
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i four = _mm_set1_epi8(4);
+  for (; end - p >= 16; p += 16) {
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i ctl = _mm_sub_epi8(c, tab);
+    const __m128i is_ctl = _mm_cmpeq_epi8(_mm_min_epu8(ctl, four), ctl);
+    const __m128i is_space = _mm_or_si128(is_ctl, _mm_cmpeq_epi8(c, space));
+    const int mask = _mm_movemask_epi8(is_space);
+    if (mask) return p + __builtin_ctz(mask);
+  }
+#endif
+
+  while (p < end && !IsSpace(*p)) ++p;
+  return p;
+}
+
+// Retrieves the next word from the text at *pos, treating words as simply being
+// delimited by whitespace, and advances *pos past it.  The word points into the
+// text.  Returns true if this is the end of a "sentence"; i.e., a newline.
+bool NextWord(const char **pos, const char *end, std::string_view *word) {
+  const char *p = *pos;
+
+  // Skip leading whitespace.
+  while (p < end && IsSpace(*p)) ++p;
+
   // Read the next word.
-  do {
-    buf += c;
-    c = fin.get();
-  } while (!fin.eof() && !std::isspace(c));
+  const char *start = p;
+  p = FindSpace(p, end);
+  *word = std::string_view(start, p - start);
 
-  *word = buf;
-  if (c == '\n' || fin.eof()) return true;
+  if (p == end || *p++ == '\n') {
+    *pos = p;
+    return true;
+  }
 
   // Skip trailing whitespace.
-  do {
-    c = fin.get();
-  } while (!fin.eof() && std::isspace(c));
+  while (p < end && IsSpace(*p)) ++p;
 
-  if (fin.eof()) return true;
+  *pos = p;
+  return p == end;
+}
 
-  fin.unget();
-  return false;
+// Returns the offset of the first sentence start at or after the offset, or
+// the size of the text if there is none.  A sentence starts just past a
+// newline that directly follows a word: NextWord() always ends a sentence
+// there, so splitting the text there leaves its sentences the same.
+off_t NextSentenceStart(const char *text, off_t size, off_t offset) {
+  if (offset <= 0) return 0;
+
+  for (off_t pos = std::max<off_t>(offset - 1, 1); pos < size; ++pos) {
+    const void *newline = memchr(text + pos, '\n', size - pos);
+    if (!newline) break;
+
+    pos = static_cast<const char *>(newline) - text;
+    if (!IsSpace(text[pos - 1])) return pos + 1;
+  }
+
+  return size;
 }
 
-// Creates a vocabulary from the most frequent terms in the input file.
-std::vector<std::string> CreateVocabulary(const std::string input_filename,
-                                          const int shard_size,
-                                          const int min_vocab_count,
-                                          const int max_vocab_size) {
-  std::vector<std::string> vocab;
+// Returns the last sentence start in (begin, end), or begin if there is none;
+// i.e., the end of the whole sentences of the text.
+const char *LastSentenceStart(const char *begin, const char *end) {
+  for (const char *p = end - 1; p > begin; --p) {
+    if (*p == '\n' && !IsSpace(p[-1])) return p + 1;
+  }
+
+  return begin;
+}
 
-  // Count all the distinct tokens in the file.  (XXX this will eventually
-  // consume all memory and should be re-written to periodically trim the data.)
-  std::unordered_map<std::string, long long> counts;
+// The compression of an input file, detected from its first bytes.
+enum Compression { kUncompressed, kGzip, kZstd };
 
-  std::ifstream fin(input_filename, std::ifstream::ate);
+Compression DetectCompression(const MappedFile &file) {
+  const unsigned char *magic =
+      reinterpret_cast<const unsigned char *>(file.data());
 
-  if (!fin) {
-    std::cerr << "couldn't read input file '" << input_filename << "'"
-              << std::endl;
+  if (file.size() >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return kGzip;
+
+  if (file.size() >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 &&
+      magic[2] == 0x2f && magic[3] == 0xfd)
+    return kZstd;
+
+  return kUncompressed;
+}
+
+// Decompresses a memory-mapped file a block at a time, so that the text of a
+// compressed file is never held in memory all at once.
+class Decompressor {
+ public:
+  virtual ~Decompressor() {}
+
+  // Decompresses up to n bytes into the buffer.  Returns the number of bytes
+  // decompressed, 0 at the end of the data, or -1 if the data is corrupt or
+  // truncated.
+  virtual ssize_t Read(char *buf, size_t n) = 0;
+
+  // The number of compressed bytes read so far.
+  virtual size_t Consumed() const = 0;
+};
+
+// Decompresses gzip data, which may be several gzip members in a row, as
+// written by e.g. pigz or by concatenating .gz files.
+class GzipDecompressor : public Decompressor {
+ public:
+  explicit GzipDecompressor(const MappedFile &file);
+  ~GzipDecompressor() override;
+
+  ssize_t Read(char *buf, size_t n) override;
+  size_t Consumed() const override { return nfed_ - zs_.avail_in; }
+
+ protected:
+  // zlib counts bytes in 32 bits, so larger buffers are passed in parts.
+  static constexpr size_t kMaxAvail = 1 << 30;
+
+  z_stream zs_;
+
+  // The compressed data, and how much of it has been passed to zlib.
+  const char *const data_;
+  const size_t size_;
+  size_t nfed_;
+
+  bool ok_;
+  bool done_;
+};
+
+GzipDecompressor::GzipDecompressor(const MappedFile &file)
+    : data_(file.data()), size_(file.size()), nfed_(0), done_(false) {
+  memset(&zs_, 0, sizeof(zs_));
+
+  // A window of 15 bits, plus 32 to expect a gzip (or zlib) header.
+  ok_ = inflateInit2(&zs_, 15 + 32) == Z_OK;
+}
+
+GzipDecompressor::~GzipDecompressor() {
+  if (ok_) inflateEnd(&zs_);
+}
+
+ssize_t GzipDecompressor::Read(char *buf, size_t n) {
+  if (!ok_) return -1;
+
+  zs_.next_out = reinterpret_cast<Bytef *>(buf);
+  zs_.avail_out = std::min(n, kMaxAvail);
+  const uInt avail_out = zs_.avail_out;
+
+  while (!done_ && zs_.avail_out == avail_out) {
+    if (zs_.avail_in == 0 && nfed_ < size_) {
+      zs_.next_in =
+          reinterpret_cast<Bytef *>(const_cast<char *>(data_) + nfed_);
+      zs_.avail_in = std::min(size_ - nfed_, kMaxAvail);
+      nfed_ += zs_.avail_in;
+    }
+
+    const int ret = inflate(&zs_, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      // The end of a member, which may be followed by another.
+      if (zs_.avail_in == 0 && nfed_ == size_) {
+        done_ = true;
+      } else if (inflateReset(&zs_) != Z_OK) {
+        return -1;
+      }
+    } else if (ret != Z_OK) {
+      // Includes running out of input in the middle of a member.
+      return -1;
+    }
+  }
+
+  return avail_out - zs_.avail_out;
+}
 
-    return vocab;
+#ifdef FASTPREP_ZSTD
+// Decompresses zstd data, which may be several frames in a row.
+class ZstdDecompressor : public Decompressor {
+ public:
+  explicit ZstdDecompressor(const MappedFile &file)
+      : stream_(ZSTD_createDStream()),
+        input_{file.data(), static_cast<size_t>(file.size()), 0},
+        pending_(0) {
+    ZSTD_initDStream(stream_);
   }
 
-  const auto input_size = fin.tellg();
-  fin.seekg(0);
+  ~ZstdDecompressor() override { ZSTD_freeDStream(stream_); }
 
-  long long ntokens = 0;
-  while (!fin.eof()) {
-    std::string word;
-    NextWord(fin, &word);
-    counts[word] += 1;
-
-    if (++ntokens % 1000000 == 0) {
-      const float pct = 100.0 * static_cast<float>(fin.tellg()) / input_size;
-      fprintf(stdout, "\rComputing vocabulary: %0.1f%% complete...", pct);
-      std::flush(std::cout);
+  ssize_t Read(char *buf, size_t n) override;
+  size_t Consumed() const override { return input_.pos; }
+
+ protected:
+  ZSTD_DStream *const stream_;
+  ZSTD_inBuffer input_;
+
+  // Non-zero while a frame is only partly decompressed.
+  size_t pending_;
+};
+
+ssize_t ZstdDecompressor::Read(char *buf, size_t n) {
+  ZSTD_outBuffer output = {buf, n, 0};
+  while (output.pos == 0 && (input_.pos < input_.size || pending_ != 0)) {
+    pending_ = ZSTD_decompressStream(stream_, &output, &input_);
+    if (ZSTD_isError(pending_)) return -1;
+
+    // The input ran out in the middle of a frame.
+    if (output.pos == 0 && input_.pos == input_.size && pending_ != 0)
+      return -1;
+  }
+
+  return output.pos;
+}
+#endif
+
+// Returns a decompressor for a compressed file.
+std::unique_ptr<Decompressor> NewDecompressor(const MappedFile &file,
+                                              const Compression compression) {
+#ifdef FASTPREP_ZSTD
+  if (compression == kZstd)
+    return std::unique_ptr<Decompressor>(new ZstdDecompressor(file));
+#endif
+
+  assert(compression == kGzip);
+  return std::unique_ptr<Decompressor>(new GzipDecompressor(file));
+}
+
+// The input text: any number of files, each either plain text or compressed.
+// The text is processed as a list of work items that the threads take in
+// turn, so that a thread that gets through its items quickly takes on more
+// of the work rather than sitting idle.  Uncompressed files are split into
+// byte ranges at sentence starts.  Compressed files can only be read from the
+// start, so each is one work item, which is decompressed a block at a time.
+//
+// Each file ends a sentence, and words don't span files, so the text is the
+// same as the concatenation of the files as long as each file ends with a
+// newline directly after its last word.
+class Corpus {
+ public:
+  // Called by the thread with the index for a run of whole sentences of the
+  // text.  If the text is mapped, it lives as long as the corpus; otherwise it
+  // is decompressed text that is only valid during the call.
+  typedef std::function<void(int thread, const char *begin, const char *end,
+                             bool mapped)>
+      TextFn;
+
+  // Maps the files matching the glob patterns, in order.  Returns false, after
+  // explaining why, if there are none or they can't be read.
+  bool Open(const std::vector<std::string> &patterns);
+
+  // Calls fn on the number of threads for all of the text, with each sentence
+  // passed whole to exactly one call, and then calls done, if given, on each
+  // thread once there are no more work items.  Reports progress with the
+  // label.  Returns false, after explaining why, if a file is corrupt.
+  bool ForEach(int num_threads, const std::string &label, const TextFn &fn,
+               const std::function<void(int thread)> &done = nullptr) const;
+
+  int NumFiles() const { return files_.size(); }
+
+  // The total size of the files, compressed or not.
+  off_t Size() const { return size_; }
+
+ protected:
+  struct input_t {
+    std::string filename;
+    std::unique_ptr<MappedFile> file;
+    Compression compression;
+  };
+
+  // A byte range of an uncompressed file, or all of a compressed one.
+  struct work_item_t {
+    int file;
+    off_t start;
+    off_t end;
+  };
+
+  // Splits the files into work items for the number of threads.
+  std::vector<work_item_t> Split(int num_threads) const;
+
+  // Calls fn on the text of the work item, and advance as the bytes of the
+  // file are read.  Returns false if the file is corrupt.
+  bool Process(const work_item_t &item, int thread, const TextFn &fn,
+               const std::function<void(off_t)> &advance) const;
+
+  std::vector<input_t> files_;
+  off_t size_ = 0;
+};
+
+bool Corpus::Open(const std::vector<std::string> &patterns) {
+  for (const std::string &pattern : patterns) {
+    glob_t matches;
+    if (glob(pattern.c_str(), 0, nullptr, &matches) != 0) {
+      std::cerr << "no input files match '" << pattern << "'" << std::endl;
+      globfree(&matches);
+      return false;
+    }
+
+    std::vector<std::string> filenames(matches.gl_pathv,
+                                       matches.gl_pathv + matches.gl_pathc);
+    globfree(&matches);
+
+    for (const std::string &filename : filenames) {
+      struct stat sb;
+      if (stat(filename.c_str(), &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        std::cerr << "input file '" << filename
+                  << "' does not exist or is not a file." << std::endl;
+        return false;
+      }
+
+      input_t input;
+      input.filename = filename;
+      input.file.reset(new MappedFile(filename));
+      if (!input.file->ok()) {
+        std::cerr << "couldn't read input file '" << filename << "'"
+                  << std::endl;
+        return false;
+      }
+
+      input.compression = DetectCompression(*input.file);
+#ifndef FASTPREP_ZSTD
+      if (input.compression == kZstd) {
+        std::cerr << "input file '" << filename << "' is compressed with zstd, "
+                  << "but fastprep was built without ZSTD=1" << std::endl;
+        return false;
+      }
+#endif
+
+      size_ += input.file->size();
+      files_.push_back(std::move(input));
     }
   }
 
+  return true;
+}
+
+std::vector<Corpus::work_item_t> Corpus::Split(const int num_threads) const {
+  // Aim for a few items per thread, so that the threads finish together, but
+  // keep them big enough that taking the next one is cheap.
+  const off_t item_size = std::min<off_t>(
+      std::max<off_t>(size_ / (4 * num_threads), 1 << 20), 64 << 20);
+
+  // The compressed files come first: they can't be split, so starting them
+  // early keeps them from holding up the end of the run.
+  std::vector<work_item_t> items;
+  for (int i = 0; i < NumFiles(); ++i) {
+    const input_t &input = files_[i];
+    if (input.compression != kUncompressed && input.file->size() > 0)
+      items.push_back(work_item_t{i, 0, input.file->size()});
+  }
+
+  for (int i = 0; i < NumFiles(); ++i) {
+    const input_t &input = files_[i];
+    if (input.compression != kUncompressed) continue;
+
+    const char *const text = input.file->data();
+    const off_t size = input.file->size();
+    for (off_t start = 0; start < size;) {
+      const off_t end = NextSentenceStart(text, size, start + item_size);
+      items.push_back(work_item_t{i, start, end});
+      start = end;
+    }
+  }
+
+  return items;
+}
+
+bool Corpus::Process(const work_item_t &item, const int thread,
+                     const TextFn &fn,
+                     const std::function<void(off_t)> &advance) const {
+  const input_t &input = files_[item.file];
+  if (input.compression == kUncompressed) {
+    const char *const text = input.file->data();
+    fn(thread, text + item.start, text + item.end, true);
+    advance(item.end - item.start);
+    return true;
+  }
+
+  // Pass on the whole sentences decompressed so far, and keep the rest for
+  // the next block.  A sentence longer than a block makes the buffer grow.
+  const size_t kBlockSize = 4 << 20;
+  std::unique_ptr<Decompressor> decompressor =
+      NewDecompressor(*input.file, input.compression);
+
+  std::vector<char> buf(2 * kBlockSize);
+  size_t len = 0;
+  size_t consumed = 0;
+  for (;;) {
+    if (buf.size() - len < kBlockSize) buf.resize(len + kBlockSize);
+
+    const ssize_t n = decompressor->Read(buf.data() + len, buf.size() - len);
+    if (n < 0) {
+      std::cerr << std::endl << "input file '" << input.filename
+                << "' is corrupt or truncated" << std::endl;
+      return false;
+    }
+
+    if (n == 0) break;
+    len += n;
+
+    const char *const text = buf.data();
+    const char *const end = LastSentenceStart(text, text + len);
+    fn(thread, text, end, false);
+
+    len -= end - text;
+    memmove(buf.data(), end, len);
+
+    advance(decompressor->Consumed() - consumed);
+    consumed = decompressor->Consumed();
+  }
+
+  fn(thread, buf.data(), buf.data() + len, false);
+  advance(input.file->size() - consumed);
+  return true;
+}
+
+bool Corpus::ForEach(const int num_threads, const std::string &label,
+                     const TextFn &fn,
+                     const std::function<void(int thread)> &done) const {
+  const std::vector<work_item_t> items = Split(num_threads);
+  std::atomic<size_t> next_item(0);
+  std::atomic<off_t> nread(0);
+  std::atomic<bool> ok(true);
+
+  auto work = [&](const int thread) {
+    // Only the first thread reports progress, to keep the output readable.
+    const auto advance = [&](const off_t nbytes) {
+      const off_t total = nread += nbytes;
+      if (thread == 0 && size_ > 0) {
+        const double pct = 100.0 * total / size_;
+        fprintf(stdout, "\r%s: %0.1f%% complete...", label.c_str(), pct);
+        std::flush(std::cout);
+      }
+    };
+
+    for (size_t i; ok && (i = next_item++) < items.size();) {
+      if (!Process(items[i], thread, fn, advance)) ok = false;
+    }
+
+    if (done) done(thread);
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) threads.emplace_back(work, i);
+  for (std::thread &thread : threads) thread.join();
+
+  if (ok) std::cout << "done." << std::endl;
+  return ok;
+}
+
+// Copies strings into large blocks of memory that live as long as the arena.
+class StringArena {
+ public:
+  StringArena() : used_(0) {}
+
+  std::string_view Copy(const std::string_view s) {
+    if (blocks_.empty() || used_ + s.size() > kBlockSize) {
+      blocks_.emplace_back(new char[std::max(kBlockSize, s.size())]);
+      used_ = 0;
+    }
+
+    char *const copy = blocks_.back().get() + used_;
+    memcpy(copy, s.data(), s.size());
+    used_ += s.size();
+    return std::string_view(copy, s.size());
+  }
+
+ protected:
+  static constexpr size_t kBlockSize = 1 << 20;
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  size_t used_;
+};
+
+// Counts the tokens in [begin, end).  The tokens of mapped text point into the
+// input, so only distinct tokens take up memory; those of decompressed text
+// are copied into the arena when they are first seen.
+void CountTokens(const char *begin, const char *end, const bool mapped,
+                 StringArena *arena,
+                 std::unordered_map<std::string_view, long long> *counts) {
+  for (const char *pos = begin; pos < end;) {
+    std::string_view word;
+    NextWord(&pos, end, &word);
+    if (word.empty()) continue;
+
+    auto it = counts->find(word);
+    if (it == counts->end())
+      it = counts->emplace(mapped ? word : arena->Copy(word), 0).first;
+
+    ++it->second;
+  }
+}
+
+// Creates a vocabulary from the most frequent terms in the input text.  Ties in
+// frequency are broken by the token, as in prep.py, so the vocabulary doesn't
+// depend on the number of threads.  Returns false if the input is corrupt.
+bool CreateVocabulary(const Corpus &corpus, const int shard_size,
+                      const int min_vocab_count, const int max_vocab_size,
+                      const int num_threads, std::vector<std::string> *vocab) {
+  // Count all the distinct tokens in the corpus, each thread counting whole
+  // sentences.  (XXX this will eventually consume all memory and should be
+  // re-written to periodically trim the data.)
+  std::vector<std::unordered_map<std::string_view, long long>> thread_counts(
+      num_threads);
+  std::vector<StringArena> arenas(num_threads);
+
+  const bool ok = corpus.ForEach(
+      num_threads, "Computing vocabulary",
+      [&](int thread, const char *begin, const char *end, bool mapped) {
+        CountTokens(begin, end, mapped, &arenas[thread],
+                    &thread_counts[thread]);
+      });
+
+  if (!ok) return false;
+
+  // Merge the counts into those of the first thread.
+  std::unordered_map<std::string_view, long long> &counts = thread_counts[0];
+  for (int i = 1; i < num_threads; ++i) {
+    for (const auto &count : thread_counts[i])
+      counts[count.first] += count.second;
+    thread_counts[i].clear();
+  }
+
   std::cout << counts.size() << " distinct tokens" << std::endl;
 
   // Sort the vocabulary from most frequent to least frequent.
-  std::vector<std::pair<std::string, long long>> buf;
+  std::vector<std::pair<std::string_view, long long>> buf;
   std::copy(counts.begin(), counts.end(), std::back_inserter(buf));
   std::sort(buf.begin(), buf.end(),
-            [](const std::pair<std::string, long long> &a,
-               const std::pair<std::string, long long> &b) {
-              return b.second < a.second;
+            [](const std::pair<std::string_view, long long> &a,
+               const std::pair<std::string_view, long long> &b) {
+              return b.second < a.second ||
+                     (b.second == a.second && a.first < b.first);
             });
 
   // Truncate to the maximum vocabulary size
   if (static_cast<int>(buf.size()) > max_vocab_size) buf.resize(max_vocab_size);
-  if (buf.empty()) return vocab;
+  if (buf.empty()) return true;
 
   // Eliminate rare tokens and truncate to a size modulo the shard size.
   int vocab_size = buf.size();
@@ -196,9 +838,9 @@ std::vector<std::string> CreateVocabulary(const std::string input_filename,
   if (static_cast<int>(buf.size()) > vocab_size) buf.resize(vocab_size);
 
   // Copy out the tokens.
-  for (const auto& pair : buf) vocab.push_back(pair.first);
+  for (const auto& pair : buf) vocab->emplace_back(pair.first);
 
-  return vocab;
+  return true;
 }
 
 std::vector<std::string> ReadVocabulary(const std::string vocab_filename) {
@@ -216,25 +858,193 @@ std::vector<std::string> ReadVocabulary(const std::string vocab_filename) {
   return vocab;
 }
 
-void WriteVocabulary(const std::vector<std::string> &vocab,
+// Returns the temporary name under which a file is written before it is
+// renamed into place.
+std::string TemporaryPath(const std::string &path) { return path + ".tmp"; }
+
+// Renames the file written under its temporary name into place.
+bool RenameTemporary(const std::string &path) {
+  if (rename(TemporaryPath(path).c_str(), path.c_str()) != 0) {
+    std::cerr << "unable to rename '" << TemporaryPath(path) << "' to '"
+              << path << "': " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Writes the vocabulary files, replacing any earlier ones only once they are
+// complete.
+bool WriteVocabulary(const std::vector<std::string> &vocab,
                      const std::string &output_dirname) {
   for (const std::string filename : {"row_vocab.txt", "col_vocab.txt"}) {
-    std::ofstream fout(output_dirname + "/" + filename);
+    const std::string path = output_dirname + "/" + filename;
+    std::ofstream fout(TemporaryPath(path));
     for (const auto &token : vocab) fout << token << std::endl;
+    fout.close();
+    if (!fout || !RenameTemporary(path)) {
+      unlink(TemporaryPath(path).c_str());
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Returns the path of the shard file with the extension in the directory.
+std::string ShardPath(const std::string &dirname, const int row_shard,
+                      const int col_shard, const char *extension) {
+  char filename[256];
+  snprintf(filename, sizeof(filename), "shard-%03d-%03d.%s", row_shard,
+           col_shard, extension);
+
+  return dirname + "/" + filename;
+}
+
+// Reads the header of a packed shard file, and returns false unless it is
+// valid for the shard size and the file has the size it implies.
+bool ReadPackedHeader(const MappedFile &shard, const int shard_size,
+                      packed_shard_header_t *header) {
+  if (!shard.ok() || shard.size() < off_t(sizeof(packed_shard_header_t)))
+    return false;
+
+  memcpy(header, shard.data(), sizeof(*header));
+  const off_t nbytes = sizeof(*header) +
+                       8 * (header->num_rows + header->num_cols) +
+                       12 * header->num_coocs;
+
+  return memcmp(header->magic, kPackedShardMagic, sizeof(header->magic)) ==
+             0 &&
+         header->num_rows == shard_size && header->num_cols == shard_size &&
+         shard.size() == nbytes;
+}
+
+// Returns whether every shard of an earlier run in the directory can be
+// opened, and, if packed, has a valid header.  This is checked before an
+// update starts, so that a missing shard doesn't fail it part-way.
+bool CheckShards(const std::string &dirname, const int num_shards,
+                 const int shard_size) {
+  for (int row_shard = 0; row_shard < num_shards; ++row_shard) {
+    for (int col_shard = 0; col_shard < num_shards; ++col_shard) {
+      const std::string packed_path =
+          ShardPath(dirname, row_shard, col_shard, "packed");
+      const std::string example_path =
+          ShardPath(dirname, row_shard, col_shard, "pb");
+
+      struct stat sb;
+      bool ok;
+      if (stat(packed_path.c_str(), &sb) == 0) {
+        packed_shard_header_t header;
+        ok = ReadPackedHeader(MappedFile(packed_path), shard_size, &header);
+      } else {
+        ok = access(example_path.c_str(), R_OK) == 0;
+      }
+
+      if (!ok) {
+        std::cerr << "couldn't read shard " << row_shard << "-" << col_shard
+                  << " of size " << shard_size << " from '" << dirname << "'"
+                  << std::endl;
+        return false;
+      }
+    }
   }
+
+  return true;
 }
 
-// Manages accumulation of co-occurrence data into temporary disk buffer files.
+// Reads the co-occurrences of a shard of the given size written to the
+// directory by an earlier run, in either format.  Returns false if the shard
+// is missing or malformed.
+bool ReadShard(const std::string &dirname, const int row_shard,
+               const int col_shard, const int shard_size,
+               std::vector<cooc_t> *coocs) {
+  coocs->clear();
+
+  const std::string packed_path =
+      ShardPath(dirname, row_shard, col_shard, "packed");
+
+  struct stat sb;
+  if (stat(packed_path.c_str(), &sb) == 0) {
+    const MappedFile shard(packed_path);
+    packed_shard_header_t header;
+    if (!ReadPackedHeader(shard, shard_size, &header)) return false;
+
+    const char *rows =
+        shard.data() + sizeof(header) + 8 * (header.num_rows + header.num_cols);
+    const char *cols = rows + 4 * header.num_coocs;
+    const char *cnts = cols + 4 * header.num_coocs;
+
+    coocs->resize(header.num_coocs);
+    for (long long i = 0; i < header.num_coocs; ++i) {
+      cooc_t &cooc = (*coocs)[i];
+      memcpy(&cooc.row, rows + 4 * i, sizeof(cooc.row));
+      memcpy(&cooc.col, cols + 4 * i, sizeof(cooc.col));
+      memcpy(&cooc.cnt, cnts + 4 * i, sizeof(cooc.cnt));
+    }
+
+    return true;
+  }
+
+  const std::string example_path =
+      ShardPath(dirname, row_shard, col_shard, "pb");
+
+  const int fd = open(example_path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  tensorflow::Example example;
+  bool ok;
+  {
+    google::protobuf::io::FileInputStream fin(fd);
+    ok = example.ParseFromZeroCopyStream(&fin);
+  }
+
+  close(fd);
+  if (!ok) return false;
+
+  const auto &feature = example.features().feature();
+  const auto global_row = feature.find("global_row");
+  const auto sparse_local_row = feature.find("sparse_local_row");
+  const auto sparse_local_col = feature.find("sparse_local_col");
+  const auto sparse_value = feature.find("sparse_value");
+  if (global_row == feature.end() || sparse_local_row == feature.end() ||
+      sparse_local_col == feature.end() || sparse_value == feature.end()) {
+    return false;
+  }
+
+  const auto &rows = sparse_local_row->second.int64_list().value();
+  const auto &cols = sparse_local_col->second.int64_list().value();
+  const auto &cnts = sparse_value->second.float_list().value();
+  if (global_row->second.int64_list().value_size() != shard_size ||
+      rows.size() != cols.size() || rows.size() != cnts.size()) {
+    return false;
+  }
+
+  for (int i = 0; i < rows.size(); ++i)
+    coocs->push_back(cooc_t{static_cast<int>(rows[i]),
+                            static_cast<int>(cols[i]), cnts[i]});
+
+  return true;
+}
+
+// Manages accumulation of co-occurrence data into temporary disk buffer files,
+// or, if the aggregated matrix fits in memory, into a hash table per shard.
 class CoocBuffer {
  public:
   CoocBuffer(const std::string &output_dirname, const int num_shards,
-             const int shard_size);
+             const int shard_size, const bool in_memory, const bool packed,
+             const std::string &base_dirname);
 
   // Accumulate the co-occurrence counts to the buffer.
-  void AccumulateCoocs(const cooc_counts_t &coocs);
+  void AccumulateCoocs(const CoocCounts &coocs);
+
+  // Read the buffer to produce shard files, using the number of threads.  The
+  // shards are written under temporary names, and only renamed into place by
+  // CommitShards(), so that a failure leaves any earlier shards intact.
+  bool WriteShards(const int num_threads);
 
-  // Read the buffer to produce shard files.
-  void WriteShards();
+  // Renames the shards written by WriteShards() into place, removing any
+  // shard files of the other format.
+  bool CommitShards();
 
  protected:
   // The output directory. Also used for temporary buffer files.
@@ -246,19 +1056,70 @@ class CoocBuffer {
   // The number of elements per shard.
   const int shard_size_;
 
+  // Whether the counts are aggregated in memory rather than in buffer files.
+  const bool in_memory_;
+
+  // Whether shards are written in the packed format rather than as
+  // tf.Example protos.
+  const bool packed_;
+
+  // If not empty, a directory with the shards of an earlier run over the same
+  // vocabulary, whose counts are added to the new ones.
+  const std::string base_dirname_;
+
   // Parallel arrays of temporary file paths and file descriptors.
   std::vector<std::string> paths_;
   std::vector<int> fds_;
 
   // Ensures that only one buffer file is getting written at a time.
   std::mutex writer_mutex_;
+
+  // In memory, the counts of each shard keyed by the packed local (row, col)
+  // pair, and a lock per shard so that threads only contend when they add to
+  // the same shard.
+  std::vector<CoocCounts> shard_counts_;
+  std::vector<std::mutex> shard_mutexes_;
+
+  // Serializes progress output from the threads writing shards.
+  std::mutex output_mutex_;
+
+  // Produces the shard file for one shard.  The scratch buffer is reused
+  // between calls for sorting.
+  bool WriteShard(const int shard, std::vector<cooc_t> *scratch);
+
+  // Returns the path of a shard file in the output format.
+  std::string OutputShardPath(const int shard) const;
+
+  // Write the sorted, distinct co-occurrences of a shard to its shard file in
+  // either format.  Return false if the file couldn't be written.
+  bool WriteExampleShard(const int row_shard, const int col_shard,
+                         const cooc_t *begin, const cooc_t *end);
+  bool WritePackedShard(const int row_shard, const int col_shard,
+                        const cooc_t *begin, const cooc_t *end);
+
+  // Adds the counts of the shard from the base directory to the buffer.
+  bool AddBaseShard(const int shard);
 };
 
 CoocBuffer::CoocBuffer(const std::string &output_dirname, const int num_shards,
-                       const int shard_size)
+                       const int shard_size, const bool in_memory,
+                       const bool packed, const std::string &base_dirname)
     : output_dirname_(output_dirname),
       num_shards_(num_shards),
-      shard_size_(shard_size) {
+      shard_size_(shard_size),
+      in_memory_(in_memory),
+      packed_(packed),
+      base_dirname_(base_dirname) {
+  if (in_memory_) {
+    // Most shards of a large vocabulary are sparse, so their tables start
+    // small and grow as needed.
+    const int kInitialShardSlots = 1 << 8;
+    shard_counts_.assign(num_shards_ * num_shards_,
+                         CoocCounts(kInitialShardSlots));
+    shard_mutexes_ = std::vector<std::mutex>(num_shards_ * num_shards_);
+    return;
+  }
+
   for (int row = 0; row < num_shards_; ++row) {
     for (int col = 0; col < num_shards_; ++col) {
       char filename[256];
@@ -274,13 +1135,12 @@ CoocBuffer::CoocBuffer(const std::string &output_dirname, const int num_shards,
   }
 }
 
-void CoocBuffer::AccumulateCoocs(const cooc_counts_t &coocs) {
-  std::vector<std::vector<cooc_t>> bufs(fds_.size());
+void CoocBuffer::AccumulateCoocs(const CoocCounts &coocs) {
+  std::vector<std::vector<cooc_t>> bufs(num_shards_ * num_shards_);
 
-  for (const auto &cooc : coocs) {
-    const int row_id = cooc.first >> 32;
-    const int col_id = cooc.first & 0xffffffff;
-    const float cnt = cooc.second;
+  coocs.ForEach([this, &bufs](long long key, float cnt) {
+    const int row_id = key >> 32;
+    const int col_id = key & 0xffffffff;
 
     const int row_shard = row_id % num_shards_;
     const int row_off = row_id / num_shards_;
@@ -292,6 +1152,37 @@ void CoocBuffer::AccumulateCoocs(const cooc_counts_t &coocs) {
 
     const int bot_shard_idx = col_shard * num_shards_ + row_shard;
     bufs[bot_shard_idx].push_back(cooc_t{col_off, row_off, cnt});
+  });
+
+  if (in_memory_) {
+    // Add to the shards that aren't locked by other threads first, and then
+    // wait for the rest.
+    auto add_to_shard = [this, &bufs](int i) {
+      for (const auto &cooc : bufs[i]) {
+        const long long key = (static_cast<long long>(cooc.row) << 32) |
+                              static_cast<long long>(cooc.col);
+
+        shard_counts_[i].Add(key, cooc.cnt);
+      }
+    };
+
+    std::vector<int> busy_shards;
+    for (int i = 0; i < static_cast<int>(bufs.size()); ++i) {
+      if (bufs[i].empty()) continue;
+      std::unique_lock<std::mutex> lock(shard_mutexes_[i], std::try_to_lock);
+      if (lock.owns_lock()) {
+        add_to_shard(i);
+      } else {
+        busy_shards.push_back(i);
+      }
+    }
+
+    for (int i : busy_shards) {
+      std::lock_guard<std::mutex> lock(shard_mutexes_[i]);
+      add_to_shard(i);
+    }
+
+    return;
   }
 
   for (int i = 0; i < static_cast<int>(fds_.size()); ++i) {
@@ -302,191 +1193,371 @@ void CoocBuffer::AccumulateCoocs(const cooc_counts_t &coocs) {
   }
 }
 
-void CoocBuffer::WriteShards() {
-  for (int shard = 0; shard < static_cast<int>(fds_.size()); ++shard) {
-    const int row_shard = shard / num_shards_;
-    const int col_shard = shard % num_shards_;
+// Sorts the co-occurrences by row and then by column, keeping duplicates in
+// their original order.  This is a radix sort by column and then by row, which
+// is linear in the number of co-occurrences and the shard size.
+void SortCoocs(cooc_t *begin, cooc_t *end, std::vector<cooc_t> *scratch) {
+  if (begin == end) return;
+
+  int max_index = 0;
+  for (const cooc_t *cur = begin; cur != end; ++cur)
+    max_index = std::max(max_index, std::max(cur->row, cur->col));
+
+  scratch->resize(end - begin);
+  std::vector<int> offsets(max_index + 2);
+
+  // Distribute by column into the scratch buffer.
+  for (const cooc_t *cur = begin; cur != end; ++cur) ++offsets[cur->col + 1];
+  for (int i = 1; i <= max_index; ++i) offsets[i] += offsets[i - 1];
+  for (const cooc_t *cur = begin; cur != end; ++cur)
+    (*scratch)[offsets[cur->col]++] = *cur;
+
+  // Distribute by row back into place.
+  std::fill(offsets.begin(), offsets.end(), 0);
+  for (const cooc_t &cooc : *scratch) ++offsets[cooc.row + 1];
+  for (int i = 1; i <= max_index; ++i) offsets[i] += offsets[i - 1];
+  for (const cooc_t &cooc : *scratch) begin[offsets[cooc.row]++] = cooc;
+}
 
-    std::cout << "\rwriting shard " << (shard + 1) << "/"
-              << (num_shards_ * num_shards_);
-    std::flush(std::cout);
+bool CoocBuffer::WriteShards(const int num_threads) {
+  // Each thread takes the next shard that hasn't been written yet.
+  std::atomic<int> next_shard(0);
+  std::atomic<int> nwritten(0);
+  std::atomic<bool> failed(false);
+  const int nshards = num_shards_ * num_shards_;
+
+  auto write_shards = [this, &next_shard, &nwritten, &failed, nshards]() {
+    std::vector<cooc_t> scratch;
+    for (int shard = next_shard++; shard < nshards && !failed;
+         shard = next_shard++) {
+      if (!WriteShard(shard, &scratch)) {
+        failed = true;
+        return;
+      }
 
-    // Construct the tf::Example proto.  First, we add the global rows and
-    // column that are present in the shard.
-    tensorflow::Example example;
+      const int n = ++nwritten;
+      std::lock_guard<std::mutex> lock(output_mutex_);
+      std::cout << "\rwrote shard " << n << "/" << nshards;
+      std::flush(std::cout);
+    }
+  };
 
-    auto &feature = *example.mutable_features()->mutable_feature();
-    auto global_row = feature["global_row"].mutable_int64_list();
-    auto global_col = feature["global_col"].mutable_int64_list();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) threads.emplace_back(write_shards);
+  for (auto &thread : threads) thread.join();
 
-    for (int i = 0; i < shard_size_; ++i) {
-      global_row->add_value(row_shard + i * num_shards_);
-      global_col->add_value(col_shard + i * num_shards_);
-    }
+  std::cout << std::endl;
+  if (!failed) return true;
 
-    // Next we add co-occurrences as a sparse representation.  Map the
-    // co-occurrence counts that we've spooled off to disk: these are in
-    // arbitrary order and may contain duplicates.
-    const off_t nbytes = lseek(fds_[shard], 0, SEEK_END);
-    cooc_t *coocs = static_cast<cooc_t*>(
-        mmap(0, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, fds_[shard], 0));
+  // Remove the shards written so far and the remaining buffer files.
+  for (int shard = 0; shard < nshards; ++shard) {
+    unlink(TemporaryPath(OutputShardPath(shard)).c_str());
+    if (!in_memory_) unlink(paths_[shard].c_str());
+  }
 
-    const int ncoocs = nbytes / sizeof(cooc_t);
-    cooc_t* cur = coocs;
-    cooc_t* end = coocs + ncoocs;
+  return false;
+}
 
-    auto sparse_value = feature["sparse_value"].mutable_float_list();
-    auto sparse_local_row = feature["sparse_local_row"].mutable_int64_list();
-    auto sparse_local_col = feature["sparse_local_col"].mutable_int64_list();
+bool CoocBuffer::CommitShards() {
+  // Remove any shard file of the other format, e.g. from updating a base
+  // directory in place, so that readers don't pick up stale counts.
+  const char *other_extension = packed_ ? "pb" : "packed";
+  for (int shard = 0; shard < num_shards_ * num_shards_; ++shard) {
+    const int row_shard = shard / num_shards_;
+    const int col_shard = shard % num_shards_;
+    if (!RenameTemporary(OutputShardPath(shard))) return false;
+    unlink(ShardPath(output_dirname_, row_shard, col_shard, other_extension)
+               .c_str());
+  }
 
-    std::sort(cur, end, [](const cooc_t &a, const cooc_t &b) {
-      return a.row < b.row || (a.row == b.row && a.col < b.col);
+  return true;
+}
+
+std::string CoocBuffer::OutputShardPath(const int shard) const {
+  return ShardPath(output_dirname_, shard / num_shards_, shard % num_shards_,
+                   packed_ ? "packed" : "pb");
+}
+
+bool CoocBuffer::WriteShard(const int shard, std::vector<cooc_t> *scratch) {
+  const int row_shard = shard / num_shards_;
+  const int col_shard = shard % num_shards_;
+
+  if (!base_dirname_.empty() && !AddBaseShard(shard)) return false;
+
+  // Map the co-occurrence counts that we've spooled off to disk, or copy them
+  // out of memory: these are in arbitrary order and may contain duplicates.
+  std::vector<cooc_t> shard_coocs;
+  off_t nbytes = 0;
+  cooc_t *coocs;
+  if (in_memory_) {
+    shard_coocs.reserve(shard_counts_[shard].size());
+    shard_counts_[shard].ForEach([&shard_coocs](long long key, float cnt) {
+      const int row = key >> 32;
+      const int col = key & 0xffffffff;
+      shard_coocs.push_back(cooc_t{row, col, cnt});
     });
 
-    // Accumulate the counts into the protocol buffer.
-    int last_row = -1, last_col = -1;
-    float count = 0;
-    for (; cur != end; ++cur) {
-      if (cur->row != last_row || cur->col != last_col) {
-        if (last_row >= 0 && last_col >= 0) {
-          sparse_local_row->add_value(last_row);
-          sparse_local_col->add_value(last_col);
-          sparse_value->add_value(count);
-        }
+    // Release the memory of the shard.
+    shard_counts_[shard] = CoocCounts(1);
+    coocs = shard_coocs.data();
+    nbytes = shard_coocs.size() * sizeof(cooc_t);
+  } else {
+    nbytes = lseek(fds_[shard], 0, SEEK_END);
+    coocs = static_cast<cooc_t*>(
+        mmap(0, nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, fds_[shard], 0));
+  }
 
-        last_row = cur->row;
-        last_col = cur->col;
-        count = 0;
-      }
+  const int ncoocs = nbytes / sizeof(cooc_t);
+  cooc_t* cur = coocs;
+  cooc_t* end = coocs + ncoocs;
 
-      count += cur->cnt;
-    }
+  SortCoocs(cur, end, scratch);
 
-    if (last_row >= 0 && last_col >= 0) {
-      sparse_local_row->add_value(last_row);
-      sparse_local_col->add_value(last_col);
-      sparse_value->add_value(count);
+  // Accumulate the counts of duplicates in place.
+  cooc_t *last = coocs;
+  for (; cur != end; ++cur) {
+    if (last != coocs && cur->row == last[-1].row &&
+        cur->col == last[-1].col) {
+      last[-1].cnt += cur->cnt;
+    } else {
+      *last++ = *cur;
     }
+  }
+
+  const bool ok =
+      packed_ ? WritePackedShard(row_shard, col_shard, coocs, last)
+              : WriteExampleShard(row_shard, col_shard, coocs, last);
 
+  if (!in_memory_) {
     munmap(coocs, nbytes);
     close(fds_[shard]);
 
-    if (sparse_local_row->value_size() * 8 >= (64 << 20)) {
-      std::cout << "Warning: you are likely to catch protobuf parsing errors "
-          "in TF 1.0 and older because the shard is too fat (>= 64MiB); see "
-          << std::endl <<
-          "kDefaultTotalBytesLimit in src/google/protobuf/io/coded_stream.h "
-          " changed in protobuf/commit/5a76e633ea9b5adb215e93fdc11e1c0c08b3fc74"
-          << std::endl <<
-          "https://github.com/tensorflow/tensorflow/issues/7311"
-          << std::endl <<
-          "Consider increasing the number of shards.";
-    }
+    // Remove the temporary file.
+    unlink(paths_[shard].c_str());
+  }
 
-    // Write the protocol buffer as a binary blob to disk.
-    const int filename_max_size = 4096;
-    std::unique_ptr<char[]> filename(new char[filename_max_size]);
-    snprintf(filename.get(), filename_max_size, "shard-%03d-%03d.pb", row_shard,
-             col_shard);
+  return ok;
+}
 
-    const std::string path = output_dirname_ + "/" + filename.get();
-    int fd = open(path.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0666);
-    assert(fd != -1);
+bool CoocBuffer::WriteExampleShard(const int row_shard, const int col_shard,
+                                   const cooc_t *begin, const cooc_t *end) {
+  // Construct the tf::Example proto.  First, we add the global rows and
+  // column that are present in the shard.
+  tensorflow::Example example;
 
-    google::protobuf::io::FileOutputStream fout(fd);
-    example.SerializeToZeroCopyStream(&fout);
-    fout.Close();
+  auto &feature = *example.mutable_features()->mutable_feature();
+  auto global_row = feature["global_row"].mutable_int64_list();
+  auto global_col = feature["global_col"].mutable_int64_list();
 
-    // Remove the temporary file.
-    unlink(paths_[shard].c_str());
+  for (int i = 0; i < shard_size_; ++i) {
+    global_row->add_value(row_shard + i * num_shards_);
+    global_col->add_value(col_shard + i * num_shards_);
   }
 
-  std::cout << std::endl;
+  // Next we add co-occurrences as a sparse representation.
+  auto sparse_value = feature["sparse_value"].mutable_float_list();
+  auto sparse_local_row = feature["sparse_local_row"].mutable_int64_list();
+  auto sparse_local_col = feature["sparse_local_col"].mutable_int64_list();
+
+  for (const cooc_t *cur = begin; cur != end; ++cur) {
+    sparse_local_row->add_value(cur->row);
+    sparse_local_col->add_value(cur->col);
+    sparse_value->add_value(cur->cnt);
+  }
+
+  if (sparse_local_row->value_size() * 8 >= (64 << 20)) {
+    std::lock_guard<std::mutex> lock(output_mutex_);
+    std::cout << "Warning: you are likely to catch protobuf parsing errors "
+        "in TF 1.0 and older because the shard is too fat (>= 64MiB); see "
+        << std::endl <<
+        "kDefaultTotalBytesLimit in src/google/protobuf/io/coded_stream.h "
+        " changed in protobuf/commit/5a76e633ea9b5adb215e93fdc11e1c0c08b3fc74"
+        << std::endl <<
+        "https://github.com/tensorflow/tensorflow/issues/7311"
+        << std::endl <<
+        "Consider increasing the number of shards or using --output_format "
+        "packed.";
+  }
+
+  // Write the protocol buffer as a binary blob to disk.
+  const std::string path =
+      TemporaryPath(ShardPath(output_dirname_, row_shard, col_shard, "pb"));
+  int fd = open(path.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0666);
+  if (fd < 0) {
+    std::cerr << "unable to create '" << path << "': " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  google::protobuf::io::FileOutputStream fout(fd);
+  const bool serialized = example.SerializeToZeroCopyStream(&fout);
+  if (!fout.Close() || !serialized) {
+    std::cerr << "unable to write '" << path << "': "
+              << strerror(fout.GetErrno()) << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool CoocBuffer::WritePackedShard(const int row_shard, const int col_shard,
+                                  const cooc_t *begin, const cooc_t *end) {
+  const std::string path = TemporaryPath(
+      ShardPath(output_dirname_, row_shard, col_shard, "packed"));
+  FILE *fout = fopen(path.c_str(), "wb");
+  if (fout == nullptr) {
+    std::cerr << "unable to create '" << path << "': " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  // The arrays are streamed from the co-occurrences through the file buffer.
+  setvbuf(fout, nullptr, _IOFBF, 1 << 20);
+
+  packed_shard_header_t header;
+  memcpy(header.magic, kPackedShardMagic, sizeof(header.magic));
+  header.num_rows = shard_size_;
+  header.num_cols = shard_size_;
+  header.num_coocs = end - begin;
+  fwrite(&header, sizeof(header), 1, fout);
+
+  for (int i = 0; i < shard_size_; ++i) {
+    const long long global_row = row_shard + i * num_shards_;
+    fwrite(&global_row, sizeof(global_row), 1, fout);
+  }
+
+  for (int i = 0; i < shard_size_; ++i) {
+    const long long global_col = col_shard + i * num_shards_;
+    fwrite(&global_col, sizeof(global_col), 1, fout);
+  }
+
+  for (const cooc_t *cur = begin; cur != end; ++cur)
+    fwrite(&cur->row, sizeof(cur->row), 1, fout);
+
+  for (const cooc_t *cur = begin; cur != end; ++cur)
+    fwrite(&cur->col, sizeof(cur->col), 1, fout);
+
+  for (const cooc_t *cur = begin; cur != end; ++cur)
+    fwrite(&cur->cnt, sizeof(cur->cnt), 1, fout);
+
+  const bool failed = ferror(fout) != 0;
+  if (fclose(fout) != 0 || failed) {
+    std::cerr << "unable to write '" << path << "': " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  return true;
 }
 
-// Counts the co-occurrences in part of the file.
+bool CoocBuffer::AddBaseShard(const int shard) {
+  const int row_shard = shard / num_shards_;
+  const int col_shard = shard % num_shards_;
+
+  std::vector<cooc_t> coocs;
+  if (!ReadShard(base_dirname_, row_shard, col_shard, shard_size_, &coocs)) {
+    std::cerr << "couldn't read shard " << row_shard << "-" << col_shard
+              << " of size " << shard_size_ << " from '" << base_dirname_
+              << "'" << std::endl;
+
+    return false;
+  }
+
+  if (in_memory_) {
+    for (const auto &cooc : coocs) {
+      const long long key = (static_cast<long long>(cooc.row) << 32) |
+                            static_cast<long long>(cooc.col);
+
+      shard_counts_[shard].Add(key, cooc.cnt);
+    }
+  } else {
+    const off_t nbytes = coocs.size() * sizeof(cooc_t);
+    const off_t nwritten = pwrite(fds_[shard], coocs.data(), nbytes,
+                                  lseek(fds_[shard], 0, SEEK_END));
+    assert(nwritten == nbytes);
+    (void)nwritten;
+  }
+
+  return true;
+}
+
+// Counts the co-occurrences in the text given to one thread.
 class CoocCounter {
  public:
-  CoocCounter(const std::string &input_filename, const off_t start,
-              const off_t end, const int window_size,
-              const std::unordered_map<std::string, int> &token_to_id_map,
+  CoocCounter(const int window_size,
+              const std::unordered_map<std::string_view, int> &token_to_id_map,
               CoocBuffer *coocbuf)
-      : fin_(input_filename, std::ifstream::ate),
-        start_(start),
-        end_(end),
-        window_size_(window_size),
+      : window_size_(window_size),
         token_to_id_map_(token_to_id_map),
         coocbuf_(coocbuf),
-        marginals_(token_to_id_map.size()) {}
+        marginals_(token_to_id_map.size()),
+        ntokens_(0) {}
 
-  // PTthreads-friendly thunk to Count.
-  static void* Run(void* param) {
-    CoocCounter* self = static_cast<CoocCounter*>(param);
-    self->Count();
-    return nullptr;
-  }
+  // Counts the co-occurrences in whole sentences of text.
+  void Count(const char *begin, const char *end);
 
-  // Counts the co-occurrences.
-  void Count();
+  // Accumulates the co-occurrences counted so far into the buffer.
+  void Flush();
 
   const std::vector<double>& Marginals() const { return marginals_; }
 
- protected:
-  // The input stream.
-  std::ifstream fin_;
-
-  // The range of the file to which this counter should attend.
-  const off_t start_;
-  const off_t end_;
+  // The number of tokens read by this counter.
+  long long NumTokens() const { return ntokens_; }
 
+ protected:
   // The window size for computing co-occurrences.
   const int window_size_;
 
   // A reference to the mapping from tokens to IDs.
-  const std::unordered_map<std::string, int> &token_to_id_map_;
+  const std::unordered_map<std::string_view, int> &token_to_id_map_;
 
   // The buffer into which counts are to be accumulated.
   CoocBuffer* coocbuf_;
 
+  // A buffer of co-occurrence counts that we'll periodically sort into
+  // shards.
+  CoocCounts coocs_;
+
+  // The IDs of the in-vocabulary tokens of the current sentence.
+  std::vector<int> sentence_;
+
   // The marginal counts accumulated by this counter.
   std::vector<double> marginals_;
-};
-
-void CoocCounter::Count() {
-  const int max_coocs_size = 16 * 1024 * 1024;
 
-  // A buffer of co-occurrence counts that we'll periodically sort into
-  // shards.
-  cooc_counts_t coocs;
+  // The number of tokens read, including out-of-vocabulary tokens.
+  long long ntokens_;
+};
 
-  fin_.seekg(start_);
+void CoocCounter::Count(const char *begin, const char *end) {
+  const size_t max_coocs_size = 16 * 1024 * 1024;
 
-  int nlines = 0;
-  for (off_t filepos = start_; filepos < end_ && !fin_.eof(); filepos = fin_.tellg()) {
+  for (const char *cur = begin; cur < end;) {
     // Buffer a single sentence.
-    std::vector<int> sentence;
+    sentence_.clear();
     bool eos;
     do {
-      std::string word;
-      eos = NextWord(fin_, &word);
+      std::string_view word;
+      eos = NextWord(&cur, end, &word);
+      if (word.empty()) continue;
+      ++ntokens_;
       auto it = token_to_id_map_.find(word);
-      if (it != token_to_id_map_.end()) sentence.push_back(it->second);
+      if (it != token_to_id_map_.end()) sentence_.push_back(it->second);
     } while (!eos);
 
     // Generate the co-occurrences for the sentence.
-    for (int pos = 0; pos < static_cast<int>(sentence.size()); ++pos) {
-      const int left_id = sentence[pos];
+    for (int pos = 0; pos < static_cast<int>(sentence_.size()); ++pos) {
+      const int left_id = sentence_[pos];
 
       const int window_extent =
-          std::min(static_cast<int>(sentence.size()) - pos, 1 + window_size_);
+          std::min(static_cast<int>(sentence_.size()) - pos, 1 + window_size_);
 
       for (int off = 1; off < window_extent; ++off) {
-        const int right_id = sentence[pos + off];
+        const int right_id = sentence_[pos + off];
         const double count = 1.0 / static_cast<double>(off);
         const long long lo = std::min(left_id, right_id);
         const long long hi = std::max(left_id, right_id);
         const long long key = (hi << 32) | lo;
-        coocs[key] += count;
+        coocs_.Add(key, count);
 
         marginals_[left_id] += count;
         marginals_[right_id] += count;
@@ -496,39 +1567,70 @@ void CoocCounter::Count() {
       const long long key = (static_cast<long long>(left_id) << 32) |
                             static_cast<long long>(left_id);
 
-      coocs[key] += 0.5;
+      coocs_.Add(key, 0.5);
     }
 
     // Periodically flush the co-occurrences to disk.
-    if (coocs.size() > max_coocs_size) {
-      coocbuf_->AccumulateCoocs(coocs);
-      coocs.clear();
-    }
+    if (coocs_.size() > max_coocs_size) Flush();
+  }
+}
 
-    if (start_ == 0 && ++nlines % 1000 == 0) {
-      const double pct = 100.0 * filepos / end_;
-      fprintf(stdout, "\rComputing co-occurrences: %0.1f%% complete...", pct);
-      std::flush(std::cout);
-    }
+void CoocCounter::Flush() {
+  coocbuf_->AccumulateCoocs(coocs_);
+  coocs_.clear();
+}
+
+// The file that marks a directory whose shards have been replaced but whose
+// marginals may not have been yet.  It is created before the shards are
+// renamed into place and removed once the marginals have been written.
+const char kUpdateMarker[] = "update_in_progress";
+
+// Creates or removes the update marker in the directory.
+bool MarkUpdate(const std::string &dirname, const bool in_progress) {
+  const std::string path = dirname + "/" + kUpdateMarker;
+  if (in_progress) {
+    std::ofstream fout(path);
+    fout.close();
+    if (fout) return true;
+  } else if (unlink(path.c_str()) == 0 || errno == ENOENT) {
+    return true;
   }
 
-  // Accumulate anything we haven't flushed yet.
-  coocbuf_->AccumulateCoocs(coocs);
+  std::cerr << "unable to " << (in_progress ? "create" : "remove") << " '"
+            << path << "': " << strerror(errno) << std::endl;
+  return false;
+}
+
+std::vector<double> ReadMarginals(const std::string &filename) {
+  std::vector<double> marginals;
 
-  if (start_ == 0) std::cout << "done." << std::endl;
+  std::ifstream fin(filename);
+  for (double sum; fin >> sum;) marginals.push_back(sum);
+
+  return marginals;
 }
 
-void WriteMarginals(const std::vector<double> &marginals,
+// Writes the marginals files, replacing any earlier ones only once they are
+// complete.
+bool WriteMarginals(const std::vector<double> &marginals,
                     const std::string &output_dirname) {
   for (const std::string filename : {"row_sums.txt", "col_sums.txt"}) {
-    std::ofstream fout(output_dirname + "/" + filename);
+    const std::string path = output_dirname + "/" + filename;
+    std::ofstream fout(TemporaryPath(path));
     fout.setf(std::ios::fixed);
     for (double sum : marginals) fout << sum << std::endl;
+    fout.close();
+    if (!fout || !RenameTemporary(path)) {
+      unlink(TemporaryPath(path).c_str());
+      return false;
+    }
   }
+
+  return true;
 }
 
 int main(int argc, char *argv[]) {
-  std::string input_filename;
+  std::vector<std::string> input_patterns;
   std::string vocab_filename;
   std::string output_dirname;
   bool generate_vocab = true;
@@ -537,6 +1639,9 @@ int main(int argc, char *argv[]) {
   int window_size = 10;
   int shard_size = 4096;
   int num_threads = 4;
+  bool in_memory = false;
+  std::string output_format = "example";
+  std::string base_dirname;
 
   for (int i = 1; i < argc; ++i) {
     std::string arg(argv[i]);
@@ -555,7 +1660,7 @@ int main(int argc, char *argv[]) {
       if ((window_size = atoi(argv[i])) <= 0) goto badarg;
     } else if (arg == "--input") {
       if (++i >= argc) goto argmissing;
-      input_filename = argv[i];
+      input_patterns.push_back(argv[i]);
     } else if (arg == "--output_dir") {
       if (++i >= argc) goto argmissing;
       output_dirname = argv[i];
@@ -564,7 +1669,16 @@ int main(int argc, char *argv[]) {
       shard_size = atoi(argv[i]);
     } else if (arg == "--num_threads") {
       if (++i >= argc) goto argmissing;
-      num_threads = atoi(argv[i]);
+      if ((num_threads = atoi(argv[i])) <= 0) goto badarg;
+    } else if (arg == "--output_format") {
+      if (++i >= argc) goto argmissing;
+      output_format = argv[i];
+      if (output_format != "example" && output_format != "packed") goto badarg;
+    } else if (arg == "--base_dir") {
+      if (++i >= argc) goto argmissing;
+      base_dirname = argv[i];
+    } else if (arg == "--in_memory") {
+      in_memory = true;
     } else if (arg == "--help") {
       std::cout << usage << std::endl;
       return 0;
@@ -585,7 +1699,7 @@ int main(int argc, char *argv[]) {
     std::cerr << arg << " requires an argument; try --help?" << std::endl;
   }
 
-  if (input_filename.empty()) {
+  if (input_patterns.empty()) {
     std::cerr << "please specify the input text with '--input'; try --help?"
               << std::endl;
     return 2;
@@ -607,20 +1721,28 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (lstat(input_filename.c_str(), &sb) != 0 || !S_ISREG(sb.st_mode)) {
-    std::cerr << "input file '" << input_filename
-              << "' does not exist or is not a file." << std::endl;
+  if (!base_dirname.empty()) {
+    if (!generate_vocab) {
+      std::cerr << "--vocab can't be used with --base_dir; try --help?"
+                << std::endl;
+      return 2;
+    }
 
-    return 1;
+    // The counts can only be added up if the words keep their ids.
+    generate_vocab = false;
+    vocab_filename = base_dirname + "/row_vocab.txt";
   }
 
-  // The total size of the input.
-  const off_t input_size = sb.st_size;
+  Corpus corpus;
+  if (!corpus.Open(input_patterns)) return 1;
 
-  const std::vector<std::string> vocab =
-      generate_vocab ? CreateVocabulary(input_filename, shard_size,
-                                        min_vocab_count, max_vocab_size)
-                     : ReadVocabulary(vocab_filename);
+  std::vector<std::string> vocab;
+  if (!generate_vocab) {
+    vocab = ReadVocabulary(vocab_filename);
+  } else if (!CreateVocabulary(corpus, shard_size, min_vocab_count,
+                               max_vocab_size, num_threads, &vocab)) {
+    return 1;
+  }
 
   if (!vocab.size()) {
     std::cerr << "Empty vocabulary." << std::endl;
@@ -633,60 +1755,105 @@ int main(int argc, char *argv[]) {
   std::cout << "Shard size: " << shard_size << "x" << shard_size << std::endl;
   std::cout << "Vocab size: " << vocab.size() << std::endl;
 
+  const int num_shards = vocab.size() / shard_size;
+
+  // Check the earlier run before writing anything, so that an update either
+  // fails up front or adds to all of its counts.
+  std::vector<double> base_marginals;
+  if (!base_dirname.empty()) {
+    struct stat sb;
+    if (stat((base_dirname + "/" + kUpdateMarker).c_str(), &sb) == 0) {
+      std::cerr << "an earlier run on '" << base_dirname << "' didn't finish, "
+                << "so its shards and marginals may not match; regenerate it"
+                << std::endl;
+      return 1;
+    }
+
+    base_marginals = ReadMarginals(base_dirname + "/row_sums.txt");
+    if (base_marginals.size() != vocab.size()) {
+      std::cerr << "the marginals in '" << base_dirname
+                << "' don't match its vocabulary" << std::endl;
+      return 1;
+    }
+
+    if (!CheckShards(base_dirname, num_shards, shard_size)) return 1;
+  }
+
   // Write the vocabulary files into  the output directory.
-  WriteVocabulary(vocab, output_dirname);
+  if (!WriteVocabulary(vocab, output_dirname)) {
+    std::cerr << "unable to write the vocabulary to '" << output_dirname
+              << "'" << std::endl;
+    return 1;
+  }
 
-  const int num_shards = vocab.size() / shard_size;
-  CoocBuffer coocbuf(output_dirname, num_shards, shard_size);
+  CoocBuffer coocbuf(output_dirname, num_shards, shard_size, in_memory,
+                     output_format == "packed", base_dirname);
 
   // Build a mapping from the token to its position in the vocabulary file.
-  std::unordered_map<std::string, int> token_to_id_map;
+  // The keys point into the vocabulary, so tokens of the input can be looked
+  // up without copying them.
+  std::unordered_map<std::string_view, int> token_to_id_map;
   for (int i = 0; i < static_cast<int>(vocab.size()); ++i)
     token_to_id_map[vocab[i]] = i;
 
   // Compute the co-occurrences
-  std::vector<std::thread> threads;
-  threads.reserve(num_threads);
-  std::vector<CoocCounter*> counters;
-  const off_t nbytes_per_thread = input_size / num_threads;
-  std::cout << "Running " << num_threads << " threads, each on "
-            << nbytes_per_thread << " bytes" << std::endl;
-
+  const auto count_start = std::chrono::steady_clock::now();
+  std::vector<std::unique_ptr<CoocCounter>> counters;
   for (int i = 0; i < num_threads; ++i) {
-    // We could make this smarter and look around for newlines.  But
-    // realistically that's not going to change things much.
-    const off_t start = i * nbytes_per_thread;
-    const off_t end =
-        i < num_threads - 1 ? (i + 1) * nbytes_per_thread : input_size;
+    counters.emplace_back(
+        new CoocCounter(window_size, token_to_id_map, &coocbuf));
+  }
 
-    CoocCounter *counter = new CoocCounter(
-        input_filename, start, end, window_size, token_to_id_map, &coocbuf);
+  std::cout << "Running " << num_threads << " threads on "
+            << corpus.NumFiles() << " files of " << corpus.Size()
+            << " bytes" << std::endl;
 
-    counters.push_back(counter);
+  const bool ok = corpus.ForEach(
+      num_threads, "Computing co-occurrences",
+      [&](int thread, const char *begin, const char *end, bool mapped) {
+        counters[thread]->Count(begin, end);
+      },
+      [&](int thread) { counters[thread]->Flush(); });
 
-    threads.emplace_back(CoocCounter::Run, counter);
-  }
+  if (!ok) return 1;
 
-  // Wait for threads to finish and collect marginals.
+  // Collect the marginals.
   std::vector<double> marginals(vocab.size());
-  for (int i = 0; i < num_threads; ++i) {
-    if (i > 0) {
-      std::cout << "joining thread #" << (i + 1) << std::endl;
-    }
-    threads[i].join();
-
-    const std::vector<double>& counter_marginals = counters[i]->Marginals();
+  long long ntokens = 0;
+  for (const std::unique_ptr<CoocCounter> &counter : counters) {
+    const std::vector<double>& counter_marginals = counter->Marginals();
     for (int j = 0; j < static_cast<int>(vocab.size()); ++j)
       marginals[j] += counter_marginals[j];
 
-    delete counters[i];
+    ntokens += counter->NumTokens();
   }
 
-  std::cout << "writing marginals..." << std::endl;
-  WriteMarginals(marginals, output_dirname);
+  // Report the counting throughput, e.g. to compare window sizes.
+  const std::chrono::duration<double> count_secs =
+      std::chrono::steady_clock::now() - count_start;
+  fprintf(stdout, "Counted %lld tokens in %0.1fs (%0.0f tokens/sec)\n",
+          ntokens, count_secs.count(), ntokens / count_secs.count());
+
+  for (int j = 0; j < static_cast<int>(base_marginals.size()); ++j)
+    marginals[j] += base_marginals[j];
 
+  // The shards are written under temporary names, so a failure to write them
+  // leaves the earlier run's files as they were.  Renaming them into place
+  // and writing the marginals can't be done atomically, so the directory is
+  // marked as being updated until both are done, and a later --base_dir run
+  // refuses to add to it if that failed part-way.
   std::cout << "writing shards..." << std::endl;
-  coocbuf.WriteShards();
+  if (!coocbuf.WriteShards(num_threads) || !MarkUpdate(output_dirname, true) ||
+      !coocbuf.CommitShards()) {
+    return 1;
+  }
+
+  std::cout << "writing marginals..." << std::endl;
+  if (!WriteMarginals(marginals, output_dirname)) {
+    std::cerr << "unable to write the marginals to '" << output_dirname
+              << "'" << std::endl;
+    return 1;
+  }
 
-  return 0;
+  return MarkUpdate(output_dirname, false) ? 0 : 1;
 }
@@ -29,13 +29,23 @@
 #
 #   make -f fastprep.mk
 #
+# gzip-compressed input is read with zlib.  To read zstd-compressed input too,
+# install libzstd (e.g. "sudo apt install libzstd-dev") and build with
+#
+#   make -f fastprep.mk ZSTD=1
+#
 # If all goes well, you should have a program that is "flag compatible" with
 # "prep.py" and runs significantly faster.  Use it to generate the co-occurrence
 # matrices and other files necessary to train a Swivel matrix.
 
 
-CXXFLAGS=-std=c++11 -march=native -g -O2 -flto -Wall -I.
-LDLIBS=-lprotobuf -pthread -lm
+CXXFLAGS=-std=c++17 -march=native -g -O2 -flto -Wall -I.
+LDLIBS=-lprotobuf -lz -pthread -lm
+
+ifdef ZSTD
+CXXFLAGS+=-DFASTPREP_ZSTD
+LDLIBS+=-lzstd
+endif
 
 FETCHER=curl -L -o
 TF_URL=https://github.com/tensorflow/tensorflow/raw/master
@@ -0,0 +1,69 @@
+# Copyright 2016 Google Inc. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Reads co-occurrence shards in the packed format.
+
+`fastprep --output_format packed` writes each shard as a 32-byte header
+
+  char magic[8] = "SWVLPCK1"
+  int64 num_rows, num_cols, num_coocs
+
+followed by five contiguous little-endian arrays
+
+  int64 global_row[num_rows]
+  int64 global_col[num_cols]
+  int32 sparse_local_row[num_coocs]
+  int32 sparse_local_col[num_coocs]
+  float32 sparse_value[num_coocs]
+
+which hold the same data as the features of the tf.Example shards.  Unlike the
+protos, there is no limit on the size of a shard, and the arrays can be used in
+place from a memory mapping.
+"""
+
+import mmap
+import numpy as np
+import struct
+
+MAGIC = b'SWVLPCK1'
+HEADER = struct.Struct('<8sqqq')
+
+
+def read_packed_shard(filename):
+  """Memory-maps a packed shard.
+
+  Returns a dict from the feature names of the tf.Example shards to read-only
+  numpy arrays backed by the file.
+  """
+  with open(filename, 'rb') as fh:
+    mm = mmap.mmap(fh.fileno(), 0, access=mmap.ACCESS_READ)
+
+  magic, num_rows, num_cols, num_coocs = HEADER.unpack_from(mm, 0)
+  if magic != MAGIC:
+    raise IOError('%s is not a packed shard' % filename)
+
+  if len(mm) != HEADER.size + 8 * (num_rows + num_cols) + 12 * num_coocs:
+    raise IOError('unexpected file size for packed shard %s' % filename)
+
+  shard = {}
+  offset = HEADER.size
+  for name, dtype, count in (('global_row', '<i8', num_rows),
+                             ('global_col', '<i8', num_cols),
+                             ('sparse_local_row', '<i4', num_coocs),
+                             ('sparse_local_col', '<i4', num_coocs),
+                             ('sparse_value', '<f4', num_coocs)):
+    shard[name] = np.frombuffer(mm, dtype=dtype, count=count, offset=offset)
+    offset += shard[name].nbytes
+
+  return shard
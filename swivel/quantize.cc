@@ -0,0 +1,262 @@
+/* -*- Mode: C++ -*- */
+
+/*
+ * Copyright 2016 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Converts the binary embedding vectors written by text2bin.py into the
+ * quantized format that "analogy" reads.  The vectors are normalized and then
+ * stored as int8, with a float scale per vector, or as IEEE half-precision
+ * floats, which takes a quarter or a half of the space of the raw vectors.
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static const char usage[] = R"(
+Quantizes embedding vectors for analogy.
+
+Usage:
+
+  quantize --embeddings <embeddings> --vocab <vocab> --output <output>
+
+Options:
+
+  --embeddings <filename>
+    The file containing the binary embedding vectors to quantize.
+
+  --vocab <filename>
+    The vocabulary file corresponding to the embedding vectors.
+
+  --output <filename>
+    The file into which the quantized vectors are written.
+
+  --type <int8|fp16>
+    The type of the quantized vector elements (default: int8)
+)";
+
+// The header of a quantized embeddings file; see analogy.cc, which reads it.
+struct quantized_header_t {
+  char magic[8];
+  int type;
+  int dim;
+  long long num_vectors;
+};
+
+static_assert(sizeof(quantized_header_t) == 24, "unexpected header layout");
+
+static const char kQuantizedMagic[] = "SWVLQNT1";
+
+// The types of the elements of quantized vectors.
+enum QuantizedType { kInt8 = 1, kFp16 = 2 };
+
+// Converts a float to an IEEE half-precision float, rounding to the nearest.
+static uint16_t FloatToHalf(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+
+  const uint16_t sign = (x >> 16) & 0x8000;
+  x &= 0x7fffffff;
+
+  // Infinity or NaN.
+  if (x >= 0x7f800000) return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+
+  // Too large: 65520 and above round to infinity.
+  if (x >= 0x477ff000) return sign | 0x7c00;
+
+  // Below 2^-14, the result is subnormal: a multiple of 2^-24.
+  if (x < 0x38800000) {
+    float abs_f;
+    memcpy(&abs_f, &x, sizeof(abs_f));
+    return sign | static_cast<uint16_t>(lrintf(abs_f * (1 << 24)));
+  }
+
+  // Rebias the exponent and round the mantissa to 10 bits, ties to even.
+  uint32_t h = (x - 0x38000000) >> 13;
+  const uint32_t rest = x & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) ++h;
+
+  return sign | h;
+}
+
+// Returns the number of lines in the vocabulary file.
+static int CountVocab(const std::string &vocab_filename) {
+  std::ifstream fin(vocab_filename);
+
+  int n = 0;
+  for (std::string token; std::getline(fin, token);) ++n;
+
+  return n;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc <= 1) {
+    printf(usage);
+    return 2;
+  }
+
+  std::string embeddings_filename, vocab_filename, output_filename;
+  std::string type_name = "int8";
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--embeddings") {
+      if (++i >= argc) goto argmissing;
+      embeddings_filename = argv[i];
+    } else if (arg == "--vocab") {
+      if (++i >= argc) goto argmissing;
+      vocab_filename = argv[i];
+    } else if (arg == "--output") {
+      if (++i >= argc) goto argmissing;
+      output_filename = argv[i];
+    } else if (arg == "--type") {
+      if (++i >= argc) goto argmissing;
+      type_name = argv[i];
+      if (type_name != "int8" && type_name != "fp16") goto badarg;
+    } else if (arg == "--help") {
+      std::cout << usage << std::endl;
+      return 0;
+    } else {
+      std::cerr << "unknown option: '" << arg << "'" << std::endl;
+      return 2;
+    }
+
+    continue;
+
+  argmissing:
+    std::cerr << "missing value for '" << argv[i - 1] << "' (--help for help)"
+              << std::endl;
+    return 2;
+
+  badarg:
+    std::cerr << "invalid value '" << argv[i] << "' for '" << argv[i - 1]
+              << "' (--help for help)" << std::endl;
+
+    return 2;
+  }
+
+  if (output_filename.empty()) {
+    std::cerr << "please specify the output file with '--output'" << std::endl;
+    return 2;
+  }
+
+  const int n = CountVocab(vocab_filename);
+  if (!n) {
+    std::cerr << "unable to read vocabulary file '" << vocab_filename << "'"
+              << std::endl;
+    return 1;
+  }
+
+  // Map the vectors.
+  int fd;
+  if ((fd = open(embeddings_filename.c_str(), O_RDONLY)) < 0) {
+    std::cerr << "unable to open embeddings file '" << embeddings_filename
+              << "'" << std::endl;
+    return 1;
+  }
+
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || sb.st_size == 0 ||
+      sb.st_size % (sizeof(float) * n) != 0) {
+    std::cerr << "'" << embeddings_filename
+              << "' has a strange file size; expected it to be "
+                 "a multiple of the vocabulary size"
+              << std::endl;
+
+    return 1;
+  }
+
+  const int dim = sb.st_size / (sizeof(float) * n);
+  void *addr = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    std::cerr << "unable to read embeddings from " << embeddings_filename
+              << std::endl;
+    return 1;
+  }
+
+  madvise(addr, sb.st_size, MADV_SEQUENTIAL);
+  const float *embeddings = static_cast<const float *>(addr);
+
+  FILE *fout = fopen(output_filename.c_str(), "wb");
+  if (!fout) {
+    std::cerr << "unable to open output file '" << output_filename << "'"
+              << std::endl;
+    return 1;
+  }
+
+  quantized_header_t header;
+  memcpy(header.magic, kQuantizedMagic, sizeof(header.magic));
+  header.type = type_name == "int8" ? kInt8 : kFp16;
+  header.dim = dim;
+  header.num_vectors = n;
+  fwrite(&header, sizeof(header), 1, fout);
+
+  // The int8 scales come before the vectors, so they are written in a first
+  // pass over the vectors.
+  std::vector<float> vec(dim);
+  std::vector<float> scales;
+  std::vector<uint16_t> halves(dim);
+  std::vector<int8_t> bytes(dim);
+  for (int pass = header.type == kInt8 ? 0 : 1; pass < 2; ++pass) {
+    for (int i = 0; i < n; ++i) {
+      // Normalize the vector.
+      const float *src = embeddings + static_cast<size_t>(dim) * i;
+      float norm = 0;
+      for (int j = 0; j < dim; ++j) norm += src[j] * src[j];
+
+      norm = sqrt(norm);
+      float max_abs = 0;
+      for (int j = 0; j < dim; ++j) {
+        vec[j] = src[j] / norm;
+        max_abs = std::max(max_abs, fabsf(vec[j]));
+      }
+
+      if (header.type == kFp16) {
+        for (int j = 0; j < dim; ++j) halves[j] = FloatToHalf(vec[j]);
+        fwrite(halves.data(), sizeof(uint16_t), dim, fout);
+      } else if (pass == 0) {
+        scales.push_back(max_abs / 127);
+      } else {
+        const float inv_scale = scales[i] > 0 ? 1 / scales[i] : 0;
+        for (int j = 0; j < dim; ++j) bytes[j] = lrintf(vec[j] * inv_scale);
+        fwrite(bytes.data(), sizeof(int8_t), dim, fout);
+      }
+    }
+
+    if (pass == 0) fwrite(scales.data(), sizeof(float), n, fout);
+  }
+
+  munmap(addr, sb.st_size);
+  if (fclose(fout) != 0) {
+    std::cerr << "unable to write output file '" << output_filename << "'"
+              << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -44,6 +44,9 @@ This program expects an input directory that contains the following files.
       sparse_local_row, sparse_local_col, sparse_value: three parallel arrays
       that are a sparse representation of the submatrix counts.
 
+    Shards may instead be in the packed format written by `fastprep
+    --output_format packed`, which has the same arrays; see packed_shards.py.
+
 It will generate embeddings, training from the input directory for the specified
 number of epochs.  When complete, it will output the trained vectors to a
 tab-separated file that contains one line per embedding.  Row and column
@@ -113,27 +116,59 @@ def embeddings_with_init(vocab_size, embedding_dim, name):
                              stddev=math.sqrt(1.0 / embedding_dim)))
 
 
-def count_matrix_input(filenames, submatrix_rows, submatrix_cols):
+def decode_packed_shard(contents, submatrix_rows, submatrix_cols):
+  """Decodes a shard in the packed format; see packed_shards.py."""
+  header = tf.decode_raw(tf.substr(contents, 0, 32), tf.int64)
+  num_coocs = tf.to_int32(header[3])
+
+  offset = 32
+  global_row = tf.decode_raw(
+      tf.substr(contents, offset, 8 * submatrix_rows), tf.int64)
+  offset += 8 * submatrix_rows
+  global_col = tf.decode_raw(
+      tf.substr(contents, offset, 8 * submatrix_cols), tf.int64)
+  offset += 8 * submatrix_cols
+
+  sparse_local_row = tf.decode_raw(
+      tf.substr(contents, offset, 4 * num_coocs), tf.int32)
+  sparse_local_col = tf.decode_raw(
+      tf.substr(contents, offset + 4 * num_coocs, 4 * num_coocs), tf.int32)
+  sparse_value = tf.decode_raw(
+      tf.substr(contents, offset + 8 * num_coocs, 4 * num_coocs), tf.float32)
+
+  return (tf.reshape(global_row, [submatrix_rows]),
+          tf.reshape(global_col, [submatrix_cols]),
+          tf.to_int64(sparse_local_row),
+          tf.to_int64(sparse_local_col), sparse_value)
+
+
+def count_matrix_input(filenames, submatrix_rows, submatrix_cols,
+                       packed=False):
   """Reads submatrix shards from disk."""
   filename_queue = tf.train.string_input_producer(filenames)
   reader = tf.WholeFileReader()
   _, serialized_example = reader.read(filename_queue)
-  features = tf.parse_single_example(
-      serialized_example,
-      features={
-          'global_row': tf.FixedLenFeature([submatrix_rows], dtype=tf.int64),
-          'global_col': tf.FixedLenFeature([submatrix_cols], dtype=tf.int64),
-          'sparse_local_row': tf.VarLenFeature(dtype=tf.int64),
-          'sparse_local_col': tf.VarLenFeature(dtype=tf.int64),
-          'sparse_value': tf.VarLenFeature(dtype=tf.float32)
-      })
-
-  global_row = features['global_row']
-  global_col = features['global_col']
-
-  sparse_local_row = features['sparse_local_row'].values
-  sparse_local_col = features['sparse_local_col'].values
-  sparse_count = features['sparse_value'].values
+  if packed:
+    (global_row, global_col, sparse_local_row, sparse_local_col,
+     sparse_count) = decode_packed_shard(
+         serialized_example, submatrix_rows, submatrix_cols)
+  else:
+    features = tf.parse_single_example(
+        serialized_example,
+        features={
+            'global_row': tf.FixedLenFeature([submatrix_rows], dtype=tf.int64),
+            'global_col': tf.FixedLenFeature([submatrix_cols], dtype=tf.int64),
+            'sparse_local_row': tf.VarLenFeature(dtype=tf.int64),
+            'sparse_local_col': tf.VarLenFeature(dtype=tf.int64),
+            'sparse_value': tf.VarLenFeature(dtype=tf.float32)
+        })
+
+    global_row = features['global_row']
+    global_col = features['global_col']
+
+    sparse_local_row = features['sparse_local_row'].values
+    sparse_local_col = features['sparse_local_col'].values
+    sparse_count = features['sparse_value'].values
 
   sparse_indices = tf.concat([tf.expand_dims(sparse_local_row, 1),
                               tf.expand_dims(sparse_local_col, 1)], 1)
@@ -199,6 +234,9 @@ class SwivelModel(object):
     # Create paths to input data files
     log('Reading model from: %s', config.input_base_path)
     count_matrix_files = glob.glob(config.input_base_path + '/shard-*.pb')
+    packed = not count_matrix_files
+    if packed:
+      count_matrix_files = glob.glob(config.input_base_path + '/shard-*.packed')
     row_sums_path = config.input_base_path + '/row_sums.txt'
     col_sums_path = config.input_base_path + '/col_sums.txt'
 
@@ -218,7 +256,8 @@ class SwivelModel(object):
       # ===== CREATE VARIABLES ======
       # Get input
       global_row, global_col, count = count_matrix_input(
-        count_matrix_files, config.submatrix_rows, config.submatrix_cols)
+        count_matrix_files, config.submatrix_rows, config.submatrix_cols,
+        packed)
 
       # Embeddings
       self.row_embedding = embeddings_with_init(
@@ -15,6 +15,7 @@ limitations under the License.
 
 #include <memory>
 #include <string>
+#include <vector>
 #include "syntaxnet/parser_state.h"
 #include "syntaxnet/parser_transitions.h"
 #include "syntaxnet/populate_test_inputs.h"
@@ -94,6 +95,33 @@ class ArcStandardTransitionTest : public ::testing::Test {
     delete state;
   }
 
+  // Performs gold transitions while cloning the state after every step, and
+  // checks that arcs added to a clone never show up in the state it was cloned
+  // from, even though the two share their dependency tree storage.
+  void CloneParse(Sentence *sentence) {
+    std::unique_ptr<ParserState> state(NewClonedState(sentence));
+    while (!transition_system_->IsFinalState(*state)) {
+      std::vector<int> heads;
+      std::vector<int> labels;
+      for (int i = 0; i < state->NumTokens(); ++i) {
+        heads.push_back(state->Head(i));
+        labels.push_back(state->Label(i));
+      }
+      std::unique_ptr<ParserState> clone(state->Clone());
+      ParserAction action = transition_system_->GetNextGoldAction(*clone);
+      transition_system_->PerformActionWithoutHistory(action, clone.get());
+      for (int i = 0; i < state->NumTokens(); ++i) {
+        EXPECT_EQ(heads[i], state->Head(i));
+        EXPECT_EQ(labels[i], state->Label(i));
+      }
+      state = std::move(clone);
+    }
+    for (int i = 0; i < sentence->token_size(); ++i) {
+      EXPECT_EQ(state->GoldLabel(i), state->Label(i));
+      EXPECT_EQ(state->GoldHead(i), state->Head(i));
+    }
+  }
+
   TaskContext context_;
   TaskInput *input_label_map_ = nullptr;
   TermFrequencyMap label_map_;
@@ -112,6 +140,64 @@ TEST_F(ArcStandardTransitionTest, SingleSentenceDocumentTest) {
   SetUpForDocument(document);
   GoldParse(&document);
   DefaultParse(&document);
+  CloneParse(&document);
+}
+
+TEST_F(ArcStandardTransitionTest, CloneAcrossArcChunksTest) {
+  // A chain of 70 tokens, each attached to the one before it, so that the
+  // dependency tree spans three chunks of arcs.
+  const int kNumTokens = 70;
+  Sentence document;
+  string text;
+  for (int i = 0; i < kNumTokens; ++i) {
+    if (i > 0) text += " ";
+    const int start = text.size();
+    text += "w";
+    Token *token = document.add_token();
+    token->set_word("w");
+    token->set_start(start);
+    token->set_end(start);
+    token->set_tag("NN");
+    token->set_category("NOUN");
+    if (i == 0) {
+      token->set_label("ROOT");
+    } else {
+      token->set_head(i - 1);
+      token->set_label("dep");
+    }
+  }
+  document.set_text(text);
+  SetUpForDocument(document);
+  GoldParse(&document);
+  CloneParse(&document);
+
+  // Clone in the middle of a parse, then add arcs to both copies on either
+  // side of the boundary between the first two chunks.
+  const int label = label_map_.LookupIndex("dep", -1);
+  ASSERT_GE(label, 0);
+  std::unique_ptr<ParserState> state(NewClonedState(&document));
+  state->AddArc(30, 29, label);
+  std::unique_ptr<ParserState> clone(state->Clone());
+  state->AddArc(31, 30, label);
+  clone->AddArc(32, 31, label);
+  state->AddArc(33, 32, label);
+  clone->AddArc(30, 31, label);
+
+  EXPECT_EQ(29, state->Head(30));
+  EXPECT_EQ(30, state->Head(31));
+  EXPECT_EQ(-1, state->Head(32));
+  EXPECT_EQ(32, state->Head(33));
+
+  EXPECT_EQ(31, clone->Head(30));
+  EXPECT_EQ(-1, clone->Head(31));
+  EXPECT_EQ(31, clone->Head(32));
+  EXPECT_EQ(-1, clone->Head(33));
+
+  for (int i = 0; i < kNumTokens; ++i) {
+    if (i >= 30 && i <= 33) continue;
+    EXPECT_EQ(-1, state->Head(i));
+    EXPECT_EQ(-1, clone->Head(i));
+  }
 }
 
 }  // namespace syntaxnet
@@ -0,0 +1,157 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Fixed-capacity agenda for selecting the top scoring candidates of a beam.
+
+#ifndef SYNTAXNET_BEAM_AGENDA_H_
+#define SYNTAXNET_BEAM_AGENDA_H_
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "syntaxnet/base.h"
+
+namespace syntaxnet {
+
+// A BeamAgenda keeps the highest scoring candidates pushed to it, up to a
+// maximum beam size, in a flat preallocated min-heap. Candidates are ordered by
+// score, with the gold candidate below all other candidates of the same score,
+// and by insertion order among candidates with identical keys. Pushing a
+// candidate never allocates once the agenda has reached its capacity, so
+// candidates can be scored and discarded cheaply, and only the survivors need
+// to be turned into full parser states.
+//
+// The selection is identical to repeatedly inserting into an ordered multimap
+// and erasing its first element whenever it grows past the maximum size:
+//   - a candidate is only added if it is gold, if the agenda is not full, or
+//     if its score is greater than the lowest score in the agenda, and
+//   - when the agenda overflows, the lowest candidate is evicted, unless it is
+//     the gold candidate and gold protection is on, in which case the next
+//     lowest candidate is evicted instead.
+template <typename Payload>
+class BeamAgenda {
+ public:
+  struct Item {
+    double score;
+    bool is_gold;
+    int64 sequence;
+    Payload payload;
+  };
+
+  // Creates an agenda holding at most max_size candidates. If protect_gold is
+  // true, the gold candidate is never evicted.
+  BeamAgenda(int max_size, bool protect_gold)
+      : max_size_(max_size), protect_gold_(protect_gold) {
+    heap_.reserve(max_size + 1);
+  }
+
+  // Removes all candidates, keeping the allocated storage.
+  void Clear() {
+    heap_.clear();
+    sequence_ = 0;
+  }
+
+  // Returns true if a candidate with the given score would be added.
+  bool Accepts(double score, bool is_gold) const {
+    return is_gold || size() < max_size_ || score > heap_.front().score;
+  }
+
+  // Adds a candidate if Accepts() is true, evicting the lowest candidate if
+  // the agenda overflows. Returns true if the gold candidate was at the bottom
+  // of the agenda and had to be skipped over during eviction.
+  bool MaybePush(double score, bool is_gold, const Payload &payload) {
+    if (!Accepts(score, is_gold)) return false;
+    heap_.push_back(Item{score, is_gold, sequence_++, payload});
+    SiftUp(heap_.size() - 1);
+    if (size() <= max_size_) return false;
+    if (protect_gold_ && heap_.front().is_gold) {
+      // The next lowest candidate is one of the children of the root.
+      size_t next = 1;
+      if (heap_.size() > 2 && Less(heap_[2], heap_[1])) next = 2;
+      RemoveAt(next);
+      return true;
+    }
+    RemoveAt(0);
+    return false;
+  }
+
+  // Sorts the candidates from lowest to highest and returns them. The agenda
+  // must be cleared before pushing more candidates.
+  const std::vector<Item> &SortedItems() {
+    std::sort(heap_.begin(), heap_.end(), Less);
+    return heap_;
+  }
+
+  int size() const { return heap_.size(); }
+
+ private:
+  static bool Less(const Item &a, const Item &b) {
+    if (a.score != b.score) return a.score < b.score;
+    if (a.is_gold != b.is_gold) return a.is_gold;
+    return a.sequence < b.sequence;
+  }
+
+  void SiftUp(size_t i) {
+    while (i > 0) {
+      const size_t parent = (i - 1) / 2;
+      if (!Less(heap_[i], heap_[parent])) break;
+      std::swap(heap_[i], heap_[parent]);
+      i = parent;
+    }
+  }
+
+  void SiftDown(size_t i) {
+    const size_t n = heap_.size();
+    while (true) {
+      size_t smallest = i;
+      const size_t left = 2 * i + 1;
+      const size_t right = left + 1;
+      if (left < n && Less(heap_[left], heap_[smallest])) smallest = left;
+      if (right < n && Less(heap_[right], heap_[smallest])) smallest = right;
+      if (smallest == i) break;
+      std::swap(heap_[i], heap_[smallest]);
+      i = smallest;
+    }
+  }
+
+  // Removes the item at heap position i.
+  void RemoveAt(size_t i) {
+    std::swap(heap_[i], heap_.back());
+    heap_.pop_back();
+    if (i < heap_.size()) {
+      SiftDown(i);
+      SiftUp(i);
+    }
+  }
+
+  // Maximum number of candidates.
+  const int max_size_;
+
+  // Whether the gold candidate is exempt from eviction.
+  const bool protect_gold_;
+
+  // Insertion counter used for ordering candidates with identical keys.
+  int64 sequence_ = 0;
+
+  // Candidates in min-heap order.
+  std::vector<Item> heap_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(BeamAgenda);
+};
+
+}  // namespace syntaxnet
+
+#endif  // SYNTAXNET_BEAM_AGENDA_H_
@@ -0,0 +1,182 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "syntaxnet/beam_agenda.h"
+
+#include <map>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "syntaxnet/base.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace syntaxnet {
+namespace {
+
+// Reference agenda with the behavior of the multimap based beam: every
+// accepted candidate is allocated and inserted, then the beam is pruned.
+class MultimapAgenda {
+ public:
+  typedef std::pair<double, int> KeyType;
+
+  MultimapAgenda(int max_size, bool protect_gold)
+      : max_size_(max_size), protect_gold_(protect_gold) {}
+
+  void Clear() { slots_.clear(); }
+
+  bool MaybePush(double score, bool is_gold, int payload) {
+    if (!is_gold && static_cast<int>(slots_.size()) >= max_size_ &&
+        score <= slots_.begin()->first.first) {
+      return false;
+    }
+    slots_.emplace(KeyType(score, -static_cast<int>(is_gold)),
+                   std::unique_ptr<int>(new int(payload)));
+    if (static_cast<int>(slots_.size()) <= max_size_) return false;
+    auto bottom = slots_.begin();
+    bool skipped_gold = false;
+    if (protect_gold_ && bottom->first.second < 0) {
+      skipped_gold = true;
+      ++bottom;
+    }
+    slots_.erase(bottom);
+    return skipped_gold;
+  }
+
+  std::vector<int> Payloads() const {
+    std::vector<int> payloads;
+    for (const auto &item : slots_) payloads.push_back(*item.second);
+    return payloads;
+  }
+
+ private:
+  const int max_size_;
+  const bool protect_gold_;
+  std::multimap<KeyType, std::unique_ptr<int>> slots_;
+};
+
+std::vector<int> Payloads(BeamAgenda<int> *agenda) {
+  std::vector<int> payloads;
+  for (const auto &item : agenda->SortedItems()) {
+    payloads.push_back(item.payload);
+  }
+  return payloads;
+}
+
+// Pushes the same candidates to both agendas and checks that they agree.
+void CheckSameAsMultimap(int max_size, bool protect_gold,
+                         const std::vector<double> &scores, int gold_index) {
+  BeamAgenda<int> agenda(max_size, protect_gold);
+  MultimapAgenda reference(max_size, protect_gold);
+  for (size_t i = 0; i < scores.size(); ++i) {
+    const bool is_gold = static_cast<int>(i) == gold_index;
+    EXPECT_EQ(reference.MaybePush(scores[i], is_gold, i),
+              agenda.MaybePush(scores[i], is_gold, i));
+  }
+  EXPECT_EQ(reference.Payloads(), Payloads(&agenda));
+}
+
+TEST(BeamAgendaTest, KeepsHighestScores) {
+  BeamAgenda<int> agenda(3, true);
+  const std::vector<double> scores = {0.5, 3.0, 1.0, 2.0, -1.0, 4.0};
+  for (size_t i = 0; i < scores.size(); ++i) {
+    EXPECT_FALSE(agenda.MaybePush(scores[i], false, i));
+  }
+  EXPECT_EQ(std::vector<int>({3, 1, 5}), Payloads(&agenda));
+}
+
+TEST(BeamAgendaTest, ProtectsGold) {
+  BeamAgenda<int> agenda(2, true);
+  EXPECT_FALSE(agenda.MaybePush(0.0, true, 0));
+  EXPECT_FALSE(agenda.MaybePush(1.0, false, 1));
+  EXPECT_TRUE(agenda.MaybePush(2.0, false, 2));
+  EXPECT_EQ(std::vector<int>({0, 2}), Payloads(&agenda));
+}
+
+TEST(BeamAgendaTest, EvictsGoldWithoutProtection) {
+  BeamAgenda<int> agenda(2, false);
+  EXPECT_FALSE(agenda.MaybePush(0.0, true, 0));
+  EXPECT_FALSE(agenda.MaybePush(1.0, false, 1));
+  EXPECT_FALSE(agenda.MaybePush(2.0, false, 2));
+  EXPECT_EQ(std::vector<int>({1, 2}), Payloads(&agenda));
+}
+
+TEST(BeamAgendaTest, TiesMatchMultimap) {
+  // All-zero scores, as seen at the onset of training.
+  for (bool protect_gold : {false, true}) {
+    CheckSameAsMultimap(4, protect_gold, std::vector<double>(20, 0.0), 7);
+    CheckSameAsMultimap(4, protect_gold, std::vector<double>(20, 0.0), 0);
+    CheckSameAsMultimap(4, protect_gold, std::vector<double>(20, 0.0), -1);
+  }
+}
+
+TEST(BeamAgendaTest, RandomScoresMatchMultimap) {
+  std::mt19937 random(12345);
+  std::uniform_int_distribution<int> coarse(0, 5);
+  std::uniform_real_distribution<double> fine(-1.0, 1.0);
+  for (int trial = 0; trial < 200; ++trial) {
+    const int max_size = 1 + trial % 9;
+    const int num_candidates = trial % 50;
+    std::vector<double> scores;
+    for (int i = 0; i < num_candidates; ++i) {
+      // Use coarse scores half of the time to get plenty of ties.
+      scores.push_back(trial % 2 == 0 ? coarse(random) : fine(random));
+    }
+    const int gold_index = num_candidates == 0 ? -1 : trial % num_candidates;
+    CheckSameAsMultimap(max_size, trial % 3 != 0, scores, gold_index);
+  }
+}
+
+// Scores for the benchmarks: 'beam_size' slots with 'kNumActions' allowed
+// actions each, as in one step of the beam parser.
+const int kNumActions = 100;
+
+std::vector<double> BenchmarkScores(int beam_size) {
+  std::mt19937 random(0);
+  std::uniform_real_distribution<double> distribution(-10.0, 10.0);
+  std::vector<double> scores(beam_size * kNumActions);
+  for (double &score : scores) score = distribution(random);
+  return scores;
+}
+
+template <typename Agenda>
+void RunBeamSteps(int iters, int beam_size) {
+  tensorflow::testing::StopTiming();
+  const std::vector<double> scores = BenchmarkScores(beam_size);
+  Agenda agenda(beam_size, true);
+  tensorflow::testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    agenda.Clear();
+    for (size_t j = 0; j < scores.size(); ++j) {
+      agenda.MaybePush(scores[j], j == 0, j);
+    }
+  }
+  tensorflow::testing::ItemsProcessed(static_cast<int64>(iters));
+}
+
+void BM_MultimapAgenda(int iters, int beam_size) {
+  RunBeamSteps<MultimapAgenda>(iters, beam_size);
+}
+BENCHMARK(BM_MultimapAgenda)->Arg(8)->Arg(16)->Arg(32)->Arg(64);
+
+void BM_BeamAgenda(int iters, int beam_size) {
+  RunBeamSteps<BeamAgenda<int>>(iters, beam_size);
+}
+BENCHMARK(BM_BeamAgenda)->Arg(8)->Arg(16)->Arg(32)->Arg(64);
+
+}  // namespace
+}  // namespace syntaxnet
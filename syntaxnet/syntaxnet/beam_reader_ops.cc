@@ -15,13 +15,15 @@ limitations under the License.
 
 #include <algorithm>
 #include <deque>
-#include <map>
+#include <functional>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "syntaxnet/base.h"
+#include "syntaxnet/beam_agenda.h"
+#include "syntaxnet/embedding_feature_extractor.h"
 #include "syntaxnet/parser_state.h"
 #include "syntaxnet/parser_transitions.h"
 #include "syntaxnet/sentence.pb.h"
@@ -36,6 +38,7 @@ limitations under the License.
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/util/work_sharder.h"
 
 using tensorflow::DEVICE_CPU;
 using tensorflow::DT_BOOL;
@@ -55,6 +58,29 @@ using tensorflow::errors::InvalidArgument;
 
 namespace syntaxnet {
 
+// A single step in the transition history of a path through the beam. Paths
+// sharing a prefix share the corresponding history nodes, so extending a path
+// by one step is O(1) instead of a copy of the whole history.
+struct HistoryNode {
+  HistoryNode(int32 slot, int32 action, float score,
+              std::shared_ptr<const HistoryNode> previous)
+      : slot(slot),
+        action(action),
+        score(score),
+        length(previous == nullptr ? 1 : previous->length + 1),
+        previous(std::move(previous)) {}
+
+  const int32 slot;
+  const int32 action;
+  const float score;
+
+  // Number of steps in the history ending with this node.
+  const int length;
+
+  // History preceding this step, or null for the first step.
+  const std::shared_ptr<const HistoryNode> previous;
+};
+
 // Wraps ParserState so that the history of transitions (actions
 // performed and the beam slot they were performed in) are recorded.
 struct ParserStateWithHistory {
@@ -62,25 +88,41 @@ struct ParserStateWithHistory {
   // New state with an empty history.
   explicit ParserStateWithHistory(const ParserState &s) : state(s.Clone()) {}
 
-  // New state obtained by cloning the given state and applying the given
-  // action. The given beam slot and action are appended to the history.
-  ParserStateWithHistory(const ParserStateWithHistory &next,
+  // New state obtained by applying the given action to the given state. The
+  // given beam slot and action are appended to the history.
+  ParserStateWithHistory(const ParserStateWithHistory &previous,
                          const ParserTransitionSystem &transitions, int32 slot,
-                         int32 action, float score)
-      : state(next.state->Clone()),
-        slot_history(next.slot_history),
-        action_history(next.action_history),
-        score_history(next.score_history) {
+                         int32 action, float score, bool is_gold)
+      : state(previous.state->Clone()),
+        history(std::make_shared<const HistoryNode>(slot, action, score,
+                                                    previous.history)) {
     transitions.PerformAction(action, state.get());
-    slot_history.push_back(slot);
-    action_history.push_back(action);
-    score_history.push_back(score);
+    state->set_is_gold(is_gold);
+  }
+
+  // Returns the number of steps in the history.
+  int HistorySize() const { return history == nullptr ? 0 : history->length; }
+
+  // Fills the slot, action and score histories, oldest step first.
+  void GetHistory(std::vector<int32> *slot_history,
+                  std::vector<int32> *action_history,
+                  std::vector<float> *score_history) const {
+    const int size = HistorySize();
+    slot_history->resize(size);
+    action_history->resize(size);
+    score_history->resize(size);
+    int step = size;
+    for (const HistoryNode *node = history.get(); node != nullptr;
+         node = node->previous.get()) {
+      --step;
+      (*slot_history)[step] = node->slot;
+      (*action_history)[step] = node->action;
+      (*score_history)[step] = node->score;
+    }
   }
 
   std::unique_ptr<ParserState> state;
-  std::vector<int32> slot_history;
-  std::vector<int32> action_history;
-  std::vector<float> score_history;
+  std::shared_ptr<const HistoryNode> history;
 
  private:
   TF_DISALLOW_COPY_AND_ASSIGN(ParserStateWithHistory);
@@ -111,24 +153,45 @@ struct BatchStateOptions {
 
   // Parameter for deciding which tokens to score.
   string scoring_type;
+
+  // Whether features are output as flat tensors of indices, ids and weights
+  // instead of serialized SparseFeatures protos.
+  bool dense_features = false;
+  // Options for reading ahead in the corpus on background threads.
+  PrefetchOptions prefetch_options;
 };
 
+// Returns the types of the feature outputs of the beam ops: one string matrix
+// of serialized SparseFeatures per feature space, or the indices, ids and
+// weights of all feature spaces in dense form.
+std::vector<DataType> FeatureOutputTypes(int feature_size,
+                                         bool dense_features) {
+  std::vector<DataType> output_types;
+  if (dense_features) {
+    output_types.insert(output_types.end(), feature_size, DT_INT32);
+    output_types.insert(output_types.end(), feature_size, DT_INT64);
+    output_types.insert(output_types.end(), feature_size, DT_FLOAT);
+  } else {
+    output_types.insert(output_types.end(), feature_size, DT_STRING);
+  }
+  return output_types;
+}
+
 // Encapsulates the environment needed to parse with a beam, keeping a
 // record of path histories.
 class BeamState {
  public:
-  // The agenda is keyed by a tuple that is the score followed by an
+  // The beam is keyed by a tuple that is the score followed by an
   // int that is -1 if the path coincides with the gold path and 0
-  // otherwise. The lexicographic ordering of the keys therefore
-  // ensures that for all paths sharing the same score, the gold path
-  // will always be at the bottom. This situation can occur at the
+  // otherwise. The slots are kept in lexicographic order of the keys,
+  // which ensures that for all paths sharing the same score, the gold
+  // path will always be at the bottom. This situation can occur at the
   // onset of training when all weights are zero and therefore all
   // paths have an identically zero score.
   typedef std::pair<double, int> KeyType;
-  typedef std::multimap<KeyType, std::unique_ptr<ParserStateWithHistory>>
-      AgendaType;
-  typedef std::pair<const KeyType, std::unique_ptr<ParserStateWithHistory>>
+  typedef std::pair<KeyType, std::unique_ptr<ParserStateWithHistory>>
       AgendaItem;
+  typedef std::vector<AgendaItem> AgendaType;
   typedef Eigen::Tensor<float, 2, Eigen::RowMajor, Eigen::DenseIndex>
       ScoreMatrixType;
 
@@ -142,7 +205,9 @@ class BeamState {
   //     actions are taken on the states.
   enum State { ALIVE = 0, DYING = 1, DEAD = 2 };
 
-  explicit BeamState(const BatchStateOptions &options) : options_(options) {}
+  explicit BeamState(const BatchStateOptions &options)
+      : options_(options),
+        agenda_(options.max_beam_size, !options.continue_until_all_final) {}
 
   void Reset() {
     if (options_.always_start_new_sentences ||
@@ -154,8 +219,10 @@ class BeamState {
       state_ = DEAD;  // EOF has been reached.
     } else {
       gold_->set_is_gold(true);
-      slots_.emplace(KeyType(0.0, -1), std::unique_ptr<ParserStateWithHistory>(
-          new ParserStateWithHistory(*gold_)));
+      slots_.emplace_back(
+          KeyType(0.0, -1),
+          std::unique_ptr<ParserStateWithHistory>(
+              new ParserStateWithHistory(*gold_)));
       state_ = ALIVE;
     }
   }
@@ -174,13 +241,14 @@ class BeamState {
   }
 
   // This method updates the beam. For all elements of the beam, all
-  // allowed transitions are scored and insterted into a new beam. The
-  // beam size is capped by discarding the lowest scoring slots at any
-  // given time. There is one exception to this process: the gold path
-  // is forced to remain in the beam at all times, even if it scores
-  // low. This is to ensure that the gold path can be used for
+  // allowed transitions are scored and insterted into the agenda. The
+  // beam size is capped by discarding the lowest scoring candidates at
+  // any given time. There is one exception to this process: the gold
+  // path is forced to remain in the beam at all times, even if it
+  // scores low. This is to ensure that the gold path can be used for
   // training at the moment it would otherwise fall off (and be absent
-  // from) the beam.
+  // from) the beam. Parser states are only created for the candidates
+  // that remain on the agenda once all transitions have been scored.
   void Advance(const ScoreMatrixType &scores) {
     // If the beam was in the state of DYING, it is now DEAD.
     if (state_ == DYING) state_ = DEAD;
@@ -196,6 +264,7 @@ class BeamState {
     // Advance beam.
     AgendaType previous_slots;
     previous_slots.swap(slots_);
+    agenda_.Clear();
 
     CHECK_EQ(state_, ALIVE);
 
@@ -218,26 +287,85 @@ class BeamState {
           }
           CHECK_LT(slot, score_rows);
           MaybeInsertWithNewAction(item, slot, scores(slot, action), action);
-          PruneBeam();
         }
       } else {
         // Final state: no need to advance.
-        MaybeInsert(&item);
-        PruneBeam();
+        MaybeInsert(item, slot);
       }
       ++slot;
     }
+
+    // Create the states that survived on the agenda, from lowest to highest.
+    slots_.reserve(agenda_.size());
+    for (const Agenda::Item &candidate : agenda_.SortedItems()) {
+      AgendaItem &previous = previous_slots[candidate.payload.slot];
+      if (candidate.payload.action < 0) {
+        // Final state carried over unchanged.
+        slots_.emplace_back(previous.first, std::move(previous.second));
+      } else {
+        const KeyType key{candidate.score,
+                          -static_cast<int>(candidate.is_gold)};
+        slots_.emplace_back(
+            key, std::unique_ptr<ParserStateWithHistory>(
+                     new ParserStateWithHistory(
+                         *previous.second, *transition_system_,
+                         candidate.payload.slot, candidate.payload.action,
+                         candidate.payload.delta_score, candidate.is_gold)));
+      }
+    }
     UpdateAllFinal();
   }
 
-  void PopulateFeatureOutputs(
-      std::vector<std::vector<std::vector<SparseFeatures>>> *features) {
+  // Extracts the features of all slots and writes them to the rows of the
+  // output matrices starting at the given row. Only touches state owned by
+  // this beam, so different beams can be populated concurrently.
+  tensorflow::Status PopulateFeatureOutputs(
+      int row, const std::vector<Tensor *> &outputs) {
     for (const AgendaItem &item : slots_) {
       VLOG(2) << "State: " << item.second->state->ToString();
       std::vector<std::vector<SparseFeatures>> f =
           features_->ExtractSparseFeatures(*workspace_, *item.second->state);
-      for (size_t i = 0; i < f.size(); ++i) (*features)[i].push_back(f[i]);
+      CHECK_EQ(outputs.size(), f.size());
+      for (size_t i = 0; i < f.size(); ++i) {
+        auto output = outputs[i]->matrix<string>();
+        CHECK_EQ(output.dimension(1), f[i].size());
+        for (size_t k = 0; k < f[i].size(); ++k) {
+          if (!options_.allow_feature_weights && f[i][k].weight_size() > 0) {
+            return FailedPrecondition(
+                "Feature weights are not allowed when allow_feature_weights "
+                "is set to false.");
+          }
+          output(row, k) = f[i][k].SerializeAsString();
+        }
+      }
+      ++row;
     }
+    return tensorflow::Status::OK();
+  }
+
+  // Extracts the features of all slots in dense form, numbering the slots
+  // from the given row. Only touches state owned by this beam.
+  tensorflow::Status PopulateDenseFeatureOutputs(int row) {
+    dense_features_.resize(features_->NumEmbeddings());
+    for (DenseFeatures &features : dense_features_) features.Clear();
+    for (const AgendaItem &item : slots_) {
+      VLOG(2) << "State: " << item.second->state->ToString();
+      features_->ExtractDenseFeatures(*workspace_, *item.second->state, row++,
+                                      &dense_features_);
+    }
+    for (const DenseFeatures &features : dense_features_) {
+      if (!options_.allow_feature_weights && features.has_weights) {
+        return FailedPrecondition(
+            "Feature weights are not allowed when allow_feature_weights "
+            "is set to false.");
+      }
+    }
+    return tensorflow::Status::OK();
+  }
+
+  // Dense features of all slots, as computed by PopulateDenseFeatureOutputs().
+  const std::vector<DenseFeatures> &dense_features() const {
+    return dense_features_;
   }
 
   int BeamSize() const { return slots_.size(); }
@@ -300,60 +428,56 @@ class BeamState {
     }
   }
 
-  // Removes the first non-gold beam element if the beam is larger than
-  // the maximum beam size. If the gold element was at the bottom of the
-  // beam, sets the beam state to DYING, otherwise leaves the state alone.
-  void PruneBeam() {
-    if (static_cast<int>(slots_.size()) > options_.max_beam_size) {
-      auto bottom = slots_.begin();
-      if (!options_.continue_until_all_final &&
-          bottom->second->state->is_gold()) {
-        state_ = DYING;
-        ++bottom;
-      }
-      slots_.erase(bottom);
-    }
-  }
-
-  // Inserts an item in the beam if
+  // Offers a candidate to the agenda if
   //   - the item is gold,
   //   - the beam is not full, or
   //   - the item's new score is greater than the lowest score in the beam after
   //     the score has been incremented by given delta_score.
-  // Inserted items have slot, delta_score and action appended to their history.
+  // Candidates that make it into the beam have slot, delta_score and action
+  // appended to their history. If the gold candidate was at the bottom of a
+  // full beam, sets the beam state to DYING.
   void MaybeInsertWithNewAction(const AgendaItem &item, const int slot,
                                 const double delta_score, const int action) {
     const double score = item.first.first + delta_score;
     const bool is_gold =
         item.second->state->is_gold() && action == gold_action_;
-    if (is_gold || static_cast<int>(slots_.size()) < options_.max_beam_size ||
-        score > slots_.begin()->first.first) {
-      const KeyType key{score, -static_cast<int>(is_gold)};
-      slots_.emplace(key, std::unique_ptr<ParserStateWithHistory>(
-                              new ParserStateWithHistory(
-                                  *item.second, *transition_system_, slot,
-                                  action, delta_score)))
-          ->second->state->set_is_gold(is_gold);
+    const Candidate candidate{slot, action, static_cast<float>(delta_score)};
+    if (agenda_.MaybePush(score, is_gold, candidate)) {
+      state_ = DYING;
     }
   }
 
-  // Inserts an item in the beam if
+  // Offers a final state to the agenda if
   //   - the item is gold,
   //   - the beam is not full, or
-  //   - the item's new score is greater than the lowest score in the beam.
-  // The history of inserted items is left untouched.
-  void MaybeInsert(AgendaItem *item) {
-    const bool is_gold = item->second->state->is_gold();
-    const double score = item->first.first;
-    if (is_gold || static_cast<int>(slots_.size()) < options_.max_beam_size ||
-        score > slots_.begin()->first.first) {
-      slots_.emplace(item->first, std::move(item->second));
+  //   - the item's score is greater than the lowest score in the beam.
+  // The history of such items is left untouched.
+  void MaybeInsert(const AgendaItem &item, const int slot) {
+    const bool is_gold = item.second->state->is_gold();
+    if (agenda_.MaybePush(item.first.first, is_gold,
+                          Candidate{slot, -1, 0.0f})) {
+      state_ = DYING;
     }
   }
 
+  // A candidate for the next beam: the slot of the state it is derived from
+  // and the action applied to it, or -1 for a final state carried over.
+  struct Candidate {
+    int32 slot;
+    int32 action;
+    float delta_score;
+  };
+  typedef BeamAgenda<Candidate> Agenda;
+
   // Limits the number of slots on the beam.
   const BatchStateOptions &options_;
 
+  // Candidates for the next beam, reused across steps.
+  Agenda agenda_;
+
+  // Dense features of the slots, reused across steps.
+  std::vector<DenseFeatures> dense_features_;
+
   int gold_action_ = -1;
   State state_ = ALIVE;
   bool all_final_ = false;
@@ -372,8 +496,8 @@ class BatchState {
 
   void Init(TaskContext *task_context) {
     // Create sentence batch.
-    sentence_batch_.reset(
-        new SentenceBatch(BatchSize(), options_.corpus_name));
+    sentence_batch_.reset(new SentenceBatch(BatchSize(), options_.corpus_name,
+                                            options_.prefetch_options));
     sentence_batch_->Init(task_context);
 
     // Create transition system.
@@ -432,6 +556,18 @@ class BatchState {
     UpdateOffsets();
   }
 
+  // Advances all beams in parallel on the intra-op thread pool. Beams hold
+  // different sentences and do not share any mutable state.
+  void AdvanceBeams(OpKernelContext *context,
+                    const TTypes<float>::ConstMatrix &scores) {
+    auto advance = [this, &scores](int64 start, int64 limit) {
+      for (int64 beam_id = start; beam_id < limit; ++beam_id) {
+        AdvanceBeam(beam_id, scores);
+      }
+    };
+    ShardBeams(context, advance);
+  }
+
   void AdvanceBeam(const int beam_id,
                    const TTypes<float>::ConstMatrix &scores) {
     const int offset = beam_offsets_.back()[beam_id];
@@ -456,40 +592,84 @@ class BatchState {
     step_offsets_.push_back(step_offsets_.back() + output_size);
   }
 
+  // Outputs the features of all slots of all beams that are not DEAD. Beams
+  // are processed in parallel, each one writing to its own rows, so that the
+  // output is the same as when processing them in order.
   tensorflow::Status PopulateFeatureOutputs(OpKernelContext *context) {
+    if (options_.dense_features) return PopulateDenseFeatureOutputs(context);
     const int feature_size = FeatureSize();
-    std::vector<std::vector<std::vector<SparseFeatures>>> features(
-        feature_size);
-    for (int beam_id = 0; beam_id < BatchSize(); ++beam_id) {
-      if (!beams_[beam_id].IsDead()) {
-        beams_[beam_id].PopulateFeatureOutputs(&features);
-      }
-    }
-    CHECK_EQ(features.size(), feature_size);
-    Tensor *output;
     const int total_slots = beam_offsets_.back().back();
+    std::vector<Tensor *> outputs(feature_size);
     for (int i = 0; i < feature_size; ++i) {
-      std::vector<std::vector<SparseFeatures>> &f = features[i];
-      CHECK_EQ(total_slots, f.size());
-      if (total_slots == 0) {
-        TF_RETURN_IF_ERROR(
-            context->allocate_output(i, TensorShape({0, 0}), &output));
-      } else {
-        const int size = f[0].size();
-        TF_RETURN_IF_ERROR(context->allocate_output(
-            i, TensorShape({total_slots, size}), &output));
-        for (int j = 0; j < total_slots; ++j) {
-          CHECK_EQ(size, f[j].size());
-          for (int k = 0; k < size; ++k) {
-            if (!options_.allow_feature_weights && f[j][k].weight_size() > 0) {
-              return FailedPrecondition(
-                  "Feature weights are not allowed when allow_feature_weights "
-                  "is set to false.");
-            }
-            output->matrix<string>()(j, k) = f[j][k].SerializeAsString();
-          }
+      TensorShape shape({0, 0});
+      if (total_slots > 0) {
+        shape = TensorShape({total_slots, features_.FeatureSize(i)});
+      }
+      TF_RETURN_IF_ERROR(context->allocate_output(i, shape, &outputs[i]));
+    }
+    if (total_slots == 0) return tensorflow::Status::OK();
+
+    std::vector<tensorflow::Status> status(BatchSize());
+    auto populate = [this, &outputs, &status](int64 start, int64 limit) {
+      for (int64 beam_id = start; beam_id < limit; ++beam_id) {
+        if (!beams_[beam_id].IsDead()) {
+          status[beam_id] = beams_[beam_id].PopulateFeatureOutputs(
+              beam_offsets_.back()[beam_id], outputs);
         }
       }
+    };
+    ShardBeams(context, populate);
+    for (const tensorflow::Status &beam_status : status) {
+      TF_RETURN_IF_ERROR(beam_status);
+    }
+    return tensorflow::Status::OK();
+  }
+
+  // Like PopulateFeatureOutputs(), but outputs the features in dense form. The
+  // indices, ids and weights of feature space i are written to outputs i,
+  // FeatureSize() + i and 2 * FeatureSize() + i, concatenated in beam order.
+  tensorflow::Status PopulateDenseFeatureOutputs(OpKernelContext *context) {
+    std::vector<tensorflow::Status> status(BatchSize());
+    auto populate = [this, &status](int64 start, int64 limit) {
+      for (int64 beam_id = start; beam_id < limit; ++beam_id) {
+        if (!beams_[beam_id].IsDead()) {
+          status[beam_id] = beams_[beam_id].PopulateDenseFeatureOutputs(
+              beam_offsets_.back()[beam_id]);
+        }
+      }
+    };
+    ShardBeams(context, populate);
+    for (const tensorflow::Status &beam_status : status) {
+      TF_RETURN_IF_ERROR(beam_status);
+    }
+
+    const int feature_size = FeatureSize();
+    for (int i = 0; i < feature_size; ++i) {
+      int total_size = 0;
+      for (const BeamState &beam : beams_) {
+        if (!beam.IsDead()) total_size += beam.dense_features()[i].size();
+      }
+      Tensor *indices;
+      Tensor *ids;
+      Tensor *weights;
+      TF_RETURN_IF_ERROR(context->allocate_output(
+          i, TensorShape({total_size}), &indices));
+      TF_RETURN_IF_ERROR(context->allocate_output(
+          feature_size + i, TensorShape({total_size}), &ids));
+      TF_RETURN_IF_ERROR(context->allocate_output(
+          2 * feature_size + i, TensorShape({total_size}), &weights));
+      int32 *indices_out = indices->vec<int32>().data();
+      int64 *ids_out = ids->vec<int64>().data();
+      float *weights_out = weights->vec<float>().data();
+      for (const BeamState &beam : beams_) {
+        if (beam.IsDead()) continue;
+        const DenseFeatures &f = beam.dense_features()[i];
+        indices_out = std::copy(f.indices.begin(), f.indices.end(),
+                                indices_out);
+        ids_out = std::copy(f.ids.begin(), f.ids.end(), ids_out);
+        weights_out = std::copy(f.weights.begin(), f.weights.end(),
+                                weights_out);
+      }
     }
     return tensorflow::Status::OK();
   }
@@ -502,6 +682,11 @@ class BatchState {
 
   int FeatureSize() const { return features_.embedding_dims().size(); }
 
+  // Number of outputs used for features.
+  int NumFeatureOutputs() const {
+    return options_.dense_features ? 3 * FeatureSize() : FeatureSize();
+  }
+
   int NumActions() const {
     return transition_system_->NumActions(label_map_->Size());
   }
@@ -514,7 +699,25 @@ class BatchState {
 
   const string &ScoringType() const { return options_.scoring_type; }
 
+  bool dense_features() const { return options_.dense_features; }
+
  private:
+  // Runs work(start, limit) over ranges of beam ids on the intra-op thread
+  // pool of the given context.
+  void ShardBeams(OpKernelContext *context,
+                  const std::function<void(int64, int64)> &work) {
+    const tensorflow::DeviceBase::CpuWorkerThreads &worker_threads =
+        *context->device()->tensorflow_cpu_worker_threads();
+    const int64 cost_per_beam =
+        kCostPerSlotAction * options_.max_beam_size * NumActions();
+    tensorflow::Shard(worker_threads.num_threads, worker_threads.workers,
+                      BatchSize(), cost_per_beam, work);
+  }
+
+  // Rough cost estimate, in cycles, of scoring one action for one slot. Used
+  // to decide how finely the beams of a batch are sharded.
+  static const int64 kCostPerSlotAction = 100;
+
   const BatchStateOptions options_;
 
   // How many times the document source has been rewound.
@@ -550,10 +753,15 @@ class BatchState {
 // remain alive for the duration of the parse.
 class BeamParseReader : public OpKernel {
  public:
-  explicit BeamParseReader(OpKernelConstruction *context) : OpKernel(context) {
+  // If dense_features is true, features are output as flat tensors of indices,
+  // ids and weights instead of serialized SparseFeatures protos.
+  explicit BeamParseReader(OpKernelConstruction *context,
+                           bool dense_features = false)
+      : OpKernel(context) {
     string file_path;
     int feature_size;
     BatchStateOptions options;
+    options.dense_features = dense_features;
     OP_REQUIRES_OK(context, context->GetAttr("task_context", &file_path));
     OP_REQUIRES_OK(context, context->GetAttr("feature_size", &feature_size));
     OP_REQUIRES_OK(context,
@@ -572,6 +780,15 @@ class BeamParseReader : public OpKernel {
     OP_REQUIRES_OK(context,
                    context->GetAttr("always_start_new_sentences",
                                     &options.always_start_new_sentences));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("prefetch_depth",
+                                    &options.prefetch_options.prefetch_depth));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("num_parse_threads",
+                                    &options.prefetch_options.num_threads));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("deterministic_order",
+                                    &options.prefetch_options.deterministic));
 
     // Reads task context from file.
     string data;
@@ -584,6 +801,10 @@ class BeamParseReader : public OpKernel {
     OP_REQUIRES(
         context, options.batch_size > 0,
         InvalidArgument("Batch size ", options.batch_size, " too small."));
+    OP_REQUIRES(context, options.prefetch_options.prefetch_depth >= 0,
+                InvalidArgument("prefetch_depth must be non-negative"));
+    OP_REQUIRES(context, options.prefetch_options.num_threads >= 1,
+                InvalidArgument("num_parse_threads must be positive"));
     options.scoring_type = task_context.Get(
         tensorflow::strings::StrCat(options.arg_prefix, "_scoring"), "");
 
@@ -598,7 +819,8 @@ class BeamParseReader : public OpKernel {
         InvalidArgument("Task context requires feature_size=", required_size));
 
     // Set expected signature.
-    std::vector<DataType> output_types(feature_size, DT_STRING);
+    std::vector<DataType> output_types =
+        FeatureOutputTypes(feature_size, dense_features);
     output_types.push_back(DT_INT64);
     output_types.push_back(DT_INT32);
     OP_REQUIRES_OK(context, context->MatchSignature({}, output_types));
@@ -610,11 +832,11 @@ class BeamParseReader : public OpKernel {
     // Write features.
     batch_state_->ResetBeams();
     batch_state_->ResetOffsets();
-    batch_state_->PopulateFeatureOutputs(context);
+    OP_REQUIRES_OK(context, batch_state_->PopulateFeatureOutputs(context));
 
     // Forward the beam state vector.
     Tensor *output;
-    const int feature_size = batch_state_->FeatureSize();
+    const int feature_size = batch_state_->NumFeatureOutputs();
     OP_REQUIRES_OK(context, context->allocate_output(feature_size,
                                                      TensorShape({}), &output));
     output->scalar<int64>()() = reinterpret_cast<int64>(batch_state_.get());
@@ -638,16 +860,31 @@ class BeamParseReader : public OpKernel {
 REGISTER_KERNEL_BUILDER(Name("BeamParseReader").Device(DEVICE_CPU),
                         BeamParseReader);
 
+// BeamParseReader that outputs features in dense form.
+class DenseBeamParseReader : public BeamParseReader {
+ public:
+  explicit DenseBeamParseReader(OpKernelConstruction *context)
+      : BeamParseReader(context, true) {}
+};
+
+REGISTER_KERNEL_BUILDER(Name("DenseBeamParseReader").Device(DEVICE_CPU),
+                        DenseBeamParseReader);
+
 // Updates the beam based on incoming scores and outputs new feature vectors
 // based on the updated beam.
 class BeamParser : public OpKernel {
  public:
-  explicit BeamParser(OpKernelConstruction *context) : OpKernel(context) {
+  // The dense_features flag must match the one of the reader that created the
+  // beam state, which Compute() checks.
+  explicit BeamParser(OpKernelConstruction *context,
+                      bool dense_features = false)
+      : OpKernel(context), dense_features_(dense_features) {
     int feature_size;
     OP_REQUIRES_OK(context, context->GetAttr("feature_size", &feature_size));
 
     // Set expected signature.
-    std::vector<DataType> output_types(feature_size, DT_STRING);
+    std::vector<DataType> output_types =
+        FeatureOutputTypes(feature_size, dense_features);
     output_types.push_back(DT_INT64);
     output_types.push_back(DT_BOOL);
     OP_REQUIRES_OK(context,
@@ -661,19 +898,24 @@ class BeamParser : public OpKernel {
     const TTypes<float>::ConstMatrix scores = context->input(1).matrix<float>();
     VLOG(2) << "Scores: " << scores;
     CHECK_EQ(scores.dimension(1), batch_state->NumActions());
+    OP_REQUIRES(
+        context, batch_state->dense_features() == dense_features_,
+        InvalidArgument(
+            "The beam state was created by a ",
+            batch_state->dense_features() ? "dense" : "sparse",
+            " beam parse reader, but the beam parser outputs ",
+            dense_features_ ? "dense" : "sparse", " features"));
 
     // In AdvanceBeam we use beam_offsets_[beam_id] to determine the slice of
     // scores that should be used for advancing, but beam_offsets_[beam_id] only
     // exists for beams that have a sentence loaded.
     const int batch_size = batch_state->BatchSize();
-    for (int beam_id = 0; beam_id < batch_size; ++beam_id) {
-      batch_state->AdvanceBeam(beam_id, scores);
-    }
+    batch_state->AdvanceBeams(context, scores);
     batch_state->UpdateOffsets();
 
     // Forward the beam state unmodified.
     Tensor *output;
-    const int feature_size = batch_state->FeatureSize();
+    const int feature_size = batch_state->NumFeatureOutputs();
     OP_REQUIRES_OK(context, context->allocate_output(feature_size,
                                                      TensorShape({}), &output));
     output->scalar<int64>()() = context->input(0).scalar<int64>()();
@@ -691,11 +933,24 @@ class BeamParser : public OpKernel {
   }
 
  private:
+  // Whether features are output in dense form.
+  const bool dense_features_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(BeamParser);
 };
 
 REGISTER_KERNEL_BUILDER(Name("BeamParser").Device(DEVICE_CPU), BeamParser);
 
+// BeamParser that outputs features in dense form.
+class DenseBeamParser : public BeamParser {
+ public:
+  explicit DenseBeamParser(OpKernelConstruction *context)
+      : BeamParser(context, true) {}
+};
+
+REGISTER_KERNEL_BUILDER(Name("DenseBeamParser").Device(DEVICE_CPU),
+                        DenseBeamParser);
+
 // Extracts the paths for the elements of the current beams and returns
 // indices into a scoring matrix that is assumed to have been
 // constructed along with the beam search.
@@ -753,18 +1008,20 @@ class BeamParserOutput : public OpKernel {
       // Populate the vectors that will index into the concatenated
       // scores tensor.
       int slot = 0;
+      std::vector<int32> slot_history;
+      std::vector<int32> action_history;
+      std::vector<float> score_history;
       for (const auto &item : batch_state->Beam(beam_id).slots_) {
+        item.second->GetHistory(&slot_history, &action_history,
+                                &score_history);
         beam_ids.push_back(beam_id);
         slot_ids.push_back(slot);
         path_scores.push_back(item.first.first);
         VLOG(2) << "PATH SCORE @ beam_id:" << beam_id << " slot:" << slot
                 << " : " << item.first.first << " " << item.first.second;
-        VLOG(2) << "SLOT HISTORY: "
-                << utils::Join(item.second->slot_history, " ");
-        VLOG(2) << "SCORE HISTORY: "
-                << utils::Join(item.second->score_history, " ");
-        VLOG(2) << "ACTION HISTORY: "
-                << utils::Join(item.second->action_history, " ");
+        VLOG(2) << "SLOT HISTORY: " << utils::Join(slot_history, " ");
+        VLOG(2) << "SCORE HISTORY: " << utils::Join(score_history, " ");
+        VLOG(2) << "ACTION HISTORY: " << utils::Join(action_history, " ");
 
         // Record where the gold path ended up.
         if (item.second->state->is_gold()) {
@@ -772,10 +1029,10 @@ class BeamParserOutput : public OpKernel {
           gold_slot[beam_id] = slot;
         }
 
-        for (size_t step = 0; step < item.second->slot_history.size(); ++step) {
+        for (size_t step = 0; step < slot_history.size(); ++step) {
           const int step_beam_offset = batch_state->GetOffset(step, beam_id);
-          const int slot_index = item.second->slot_history[step];
-          const int action_index = item.second->action_history[step];
+          const int slot_index = slot_history[step];
+          const int action_index = action_history[step];
           indices.push_back(num_actions * (step_beam_offset + slot_index) +
                             action_index);
           path_ids.push_back(path_id);
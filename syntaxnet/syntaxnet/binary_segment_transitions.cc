@@ -197,7 +197,8 @@ class LastWordFeatureFunction : public ParserFeatureFunction {
     const int start_offset = state.GetToken(start).start();
     const int length = state.GetToken(end).end() - start_offset + 1;
     const auto *data = sentence.text().data() + start_offset;
-    return word_map_.LookupIndex(string(data, length), unk_id_);
+    return word_map_.LookupIndex(tensorflow::StringPiece(data, length),
+                                 unk_id_);
   }
 
  private:
@@ -0,0 +1,166 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "syntaxnet/base.h"
+#include "syntaxnet/document_format.h"
+#include "syntaxnet/sentence.pb.h"
+#include "syntaxnet/task_context.h"
+#include "syntaxnet/utils.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace syntaxnet {
+namespace {
+
+const char kSentence[] =
+    "# sent_id = 1\n"
+    "1\tBob\t_\tPROPN\tNNP\tNumber=Sing\t2\tnsubj\t_\t_\n"
+    "2-3\tbrought's\t_\t_\t_\t_\t_\t_\t_\t_\n"
+    "2\tbrought\tbring\tVERB\tVBD\tMood=Ind|Tense=Past\t0\tROOT\t_\t_\n"
+    "3\tthe\t_\tDET\tDT\tdef\t4\tdet\t_\t_\n"
+    "4\tpizza\t_\tNOUN\tNN\t_\t2\tdobj\t_\t_\n"
+    "5\t_\t_\t.\t.\t=oops|=\t2\tpunct\t_\t_\n";
+
+std::vector<Sentence *> Parse(DocumentFormat *format, const string &value) {
+  std::vector<Sentence *> sentences;
+  format->ConvertFromString("key", value, &sentences);
+  return sentences;
+}
+
+class CoNLLSyntaxFormatTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    format_.reset(DocumentFormat::Create("conll-sentence"));
+    format_->Setup(&context_);
+  }
+
+  TaskContext context_;
+  std::unique_ptr<DocumentFormat> format_;
+};
+
+TEST_F(CoNLLSyntaxFormatTest, ConvertFromString) {
+  std::vector<Sentence *> sentences = Parse(format_.get(), kSentence);
+  ASSERT_EQ(1, sentences.size());
+  std::unique_ptr<Sentence> sentence(sentences[0]);
+  EXPECT_EQ("key", sentence->docid());
+  EXPECT_EQ("Bob brought the pizza _", sentence->text());
+  ASSERT_EQ(5, sentence->token_size());
+
+  const Token &bob = sentence->token(0);
+  EXPECT_EQ("Bob", bob.word());
+  EXPECT_EQ(0, bob.start());
+  EXPECT_EQ(2, bob.end());
+  EXPECT_EQ(1, bob.head());
+  EXPECT_EQ("NNP", bob.tag());
+  EXPECT_EQ("PROPN", bob.category());
+  EXPECT_EQ("nsubj", bob.label());
+
+  const Token &brought = sentence->token(1);
+  EXPECT_EQ(4, brought.start());
+  EXPECT_EQ(10, brought.end());
+  EXPECT_FALSE(brought.has_head());
+  const TokenMorphology &morph =
+      brought.GetExtension(TokenMorphology::morphology);
+  ASSERT_EQ(2, morph.attribute_size());
+  EXPECT_EQ("Mood", morph.attribute(0).name());
+  EXPECT_EQ("Ind", morph.attribute(0).value());
+  EXPECT_EQ("Tense", morph.attribute(1).name());
+  EXPECT_EQ("Past", morph.attribute(1).value());
+
+  // Attributes without a value are switched on.
+  const Token &the = sentence->token(2);
+  ASSERT_EQ(1, the.GetExtension(TokenMorphology::morphology).attribute_size());
+  EXPECT_EQ("def",
+            the.GetExtension(TokenMorphology::morphology).attribute(0).name());
+  EXPECT_EQ("on",
+            the.GetExtension(TokenMorphology::morphology).attribute(0).value());
+
+  // Underscores are only cleared from the optional fields.
+  const Token &pizza = sentence->token(3);
+  EXPECT_FALSE(pizza.HasExtension(TokenMorphology::morphology));
+  const Token &punct = sentence->token(4);
+  EXPECT_EQ("_", punct.word());
+  EXPECT_EQ(0, punct.GetExtension(TokenMorphology::morphology).attribute_size());
+}
+
+TEST_F(CoNLLSyntaxFormatTest, SkipsEmptySentences) {
+  EXPECT_TRUE(Parse(format_.get(), "").empty());
+  EXPECT_TRUE(Parse(format_.get(), "\n\n# comment\n").empty());
+}
+
+TEST_F(CoNLLSyntaxFormatTest, RoundTrip) {
+  const string value =
+      "1\tBob\t_\tPROPN\tNNP\tNumber=Sing\t2\tnsubj\t_\t_\n"
+      "2\tsleeps\t_\tVERB\tVBZ\t_\t0\tROOT\t_\t_\n\n";
+  std::vector<Sentence *> sentences = Parse(format_.get(), value);
+  ASSERT_EQ(1, sentences.size());
+  std::unique_ptr<Sentence> sentence(sentences[0]);
+  string key, output;
+  format_->ConvertToString(*sentence, &key, &output);
+  EXPECT_EQ("key", key);
+  EXPECT_EQ(value, output);
+}
+
+TEST(SplitPiecesTest, MatchesSplit) {
+  std::vector<tensorflow::StringPiece> pieces;
+  for (const string &text : {"", "a", "\t", "a\tbc\t\td\t", "\t\tx"}) {
+    const std::vector<string> expected = utils::Split(text, '\t');
+    utils::SplitPieces(text, '\t', &pieces);
+    ASSERT_EQ(expected.size(), pieces.size()) << text;
+    for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_EQ(expected[i], pieces[i].ToString());
+    }
+  }
+}
+
+// Reads a synthetic corpus of 'num_sentences' sentences of 25 tokens each.
+void BM_ConvertFromString(int iters, int num_sentences) {
+  tensorflow::testing::StopTiming();
+  TaskContext context;
+  std::unique_ptr<DocumentFormat> format(
+      DocumentFormat::Create("conll-sentence"));
+  format->Setup(&context);
+  const int kNumTokens = 25;
+  string record;
+  for (int i = 1; i <= kNumTokens; ++i) {
+    tensorflow::strings::StrAppend(&record, i, "\tword", i, "\t_\tNOUN\tNN\t",
+                                   "Case=Nom|Number=Sing\t", i - 1,
+                                   "\tdep\t_\t_\n");
+  }
+  int64 bytes = 0;
+  std::vector<Sentence *> sentences;
+  tensorflow::testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    for (int j = 0; j < num_sentences; ++j) {
+      format->ConvertFromString("key", record, &sentences);
+      bytes += record.size();
+    }
+    tensorflow::testing::StopTiming();
+    utils::STLDeleteElements(&sentences);
+    tensorflow::testing::StartTiming();
+  }
+  tensorflow::testing::BytesProcessed(bytes);
+  tensorflow::testing::ItemsProcessed(static_cast<int64>(iters) *
+                                      num_sentences * kNumTokens);
+}
+BENCHMARK(BM_ConvertFromString)->Arg(1000)->Arg(10000);
+
+}  // namespace
+}  // namespace syntaxnet
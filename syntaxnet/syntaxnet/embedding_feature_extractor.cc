@@ -15,6 +15,7 @@ limitations under the License.
 
 #include "syntaxnet/embedding_feature_extractor.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "syntaxnet/feature_extractor.h"
@@ -79,4 +80,51 @@ GenericEmbeddingFeatureExtractor::ConvertExample(
   return sparse_features;
 }
 
+void GenericEmbeddingFeatureExtractor::ConvertExampleToDense(
+    const std::vector<FeatureVector> &feature_vectors, int row,
+    std::vector<DenseFeatures> *dense) const {
+  DCHECK_EQ(dense->size(), feature_vectors.size());
+  for (size_t i = 0; i < feature_vectors.size(); ++i) {
+    DenseFeatures &output = (*dense)[i];
+    const int begin = output.size();
+    const int row_offset = row * generic_feature_extractor(i).feature_types();
+    for (int j = 0; j < feature_vectors[i].size(); ++j) {
+      const FeatureType &feature_type = *feature_vectors[i].type(j);
+      const FeatureValue value = feature_vectors[i].value(j);
+      const bool is_continuous = feature_type.name().find("continuous") == 0;
+      const int64 id = is_continuous ? FloatFeatureValue(value).id : value;
+      if (id >= 0) {
+        output.indices.push_back(row_offset + feature_type.base());
+        output.ids.push_back(id);
+        output.weights.push_back(
+            is_continuous ? FloatFeatureValue(value).weight : 1.0f);
+        if (is_continuous) output.has_weights = true;
+      }
+    }
+
+    // Order the new entries by slot, as they would be after a round trip
+    // through SparseFeatures. Feature extractors usually produce them in order
+    // already.
+    if (!std::is_sorted(output.indices.begin() + begin, output.indices.end())) {
+      // Only the new entries are copied, not the earlier rows of the batch.
+      const std::vector<int32> indices(output.indices.begin() + begin,
+                                       output.indices.end());
+      const std::vector<int64> ids(output.ids.begin() + begin,
+                                   output.ids.end());
+      const std::vector<float> weights(output.weights.begin() + begin,
+                                       output.weights.end());
+      std::vector<int> order(indices.size());
+      for (size_t k = 0; k < order.size(); ++k) order[k] = k;
+      std::stable_sort(order.begin(), order.end(), [&indices](int a, int b) {
+        return indices[a] < indices[b];
+      });
+      for (size_t k = 0; k < order.size(); ++k) {
+        output.indices[begin + k] = indices[order[k]];
+        output.ids[begin + k] = ids[order[k]];
+        output.weights[begin + k] = weights[order[k]];
+      }
+    }
+  }
+}
+
 }  // namespace syntaxnet
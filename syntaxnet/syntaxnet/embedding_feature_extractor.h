@@ -33,6 +33,32 @@ limitations under the License.
 
 namespace syntaxnet {
 
+// Flat representation of the features extracted by one feature extractor class
+// for a batch of objects, which avoids building and serializing SparseFeatures
+// protos. The entries are laid out like the output of UnpackSparseFeatures on
+// the equivalent flattened SparseFeatures matrix: entry j has id ids[j] and
+// weight weights[j], and belongs to the feature slot indices[j], where feature
+// f of the object in row r has slot r * FeatureSize() + f.
+struct DenseFeatures {
+  std::vector<int32> indices;
+  std::vector<int64> ids;
+  std::vector<float> weights;
+
+  // Whether any entry has an explicit weight, i.e. is a continuous feature.
+  bool has_weights = false;
+
+  // Number of entries.
+  int size() const { return ids.size(); }
+
+  // Removes all entries, keeping the allocated storage.
+  void Clear() {
+    indices.clear();
+    ids.clear();
+    weights.clear();
+    has_weights = false;
+  }
+};
+
 // An EmbeddingFeatureExtractor manages the extraction of features for
 // embedding-based models. It wraps a sequence of underlying classes of feature
 // extractors, along with associated predicate maps. Each class of feature
@@ -107,6 +133,12 @@ class GenericEmbeddingFeatureExtractor {
   std::vector<std::vector<SparseFeatures>> ConvertExample(
       const std::vector<FeatureVector> &feature_vectors) const;
 
+  // Like ConvertExample(), but appends the features to the given dense
+  // representation, one per feature extractor class, as the given row of the
+  // batch. String descriptions are never added.
+  void ConvertExampleToDense(const std::vector<FeatureVector> &feature_vectors,
+                             int row, std::vector<DenseFeatures> *dense) const;
+
  private:
   // Embedding space names for parameter sharing.
   std::vector<string> embedding_names_;
@@ -180,6 +212,17 @@ class EmbeddingFeatureExtractor : public GenericEmbeddingFeatureExtractor {
     return ConvertExample(features);
   }
 
+  // Like ExtractSparseFeatures(), but appends the features to the given dense
+  // representation as the given row of the batch. The dense representation
+  // must have one element per feature extractor class.
+  void ExtractDenseFeatures(const WorkspaceSet &workspaces, const OBJ &obj,
+                            ARGS... args, int row,
+                            std::vector<DenseFeatures> *dense) const {
+    std::vector<FeatureVector> features(feature_extractors_.size());
+    ExtractFeatures(workspaces, obj, args..., &features);
+    ConvertExampleToDense(features, row, dense);
+  }
+
   // Extracts features using the extractors. Note that features must already
   // be initialized to the correct number of feature extractors. No predicate
   // mapping is applied.
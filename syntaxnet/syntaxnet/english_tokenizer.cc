@@ -0,0 +1,205 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "syntaxnet/english_tokenizer.h"
+
+namespace syntaxnet {
+namespace {
+
+// Character normalization rules. These are literal strings rather than
+// regular expressions, so they can all be applied in a single scan. None of
+// the replacements can form a pattern of a later rule, so for UTF-8 text this
+// gives the same result as applying the rules one after the other.
+//
+// Note that '|' is deliberately absent: earlier versions passed it to
+// RE2::GlobalReplace as a regular expression, where it only matches the empty
+// string, so '|' has always been kept in the output.
+const char *const kNormalizationRules[][2] = {
+    // Punctuation.
+    {"’", "'"},
+    {"…", "..."},
+    {"---", "--"},
+    {"—", "--"},
+    {"–", "--"},
+    {"，", ","},
+    {"。", "."},
+    {"！", "!"},
+    {"？", "?"},
+    {"：", ":"},
+    {"；", ";"},
+    {"＆", "&"},
+
+    // Brackets.
+    {"[", "("},
+    {"]", ")"},
+    {"{", "("},
+    {"}", ")"},
+    {"【", "("},
+    {"】", ")"},
+    {"（", "("},
+    {"）", ")"},
+
+    // Quotation marks.
+    {"″", "\""},
+    {"“", "\""},
+    {"„", "\""},
+    {"‵‵", "\""},
+    {"”", "\""},
+    {"‘", "\""},
+    {"′′", "\""},
+    {"‹", "\""},
+    {"›", "\""},
+    {"«", "\""},
+    {"»", "\""},
+
+    // Discarded punctuation that breaks sentences.
+    {"·", ""},
+    {"•", ""},
+    {"●", ""},
+    {"▪", ""},
+    {"■", ""},
+    {"□", ""},
+    {"❑", ""},
+    {"◆", ""},
+    {"★", ""},
+    {"＊", ""},
+    {"♦", ""},
+};
+
+// Tokenization rules, as regular expressions and rewrite strings for
+// RE2::GlobalReplace. These depend on context and on the output of the
+// previous rules, so they are applied one after the other.
+const char *const kTokenizationRules[][2] = {
+    // attempt to get correct directional quotes
+    {R"re(^")re", "`` "},
+    {R"re(([ \([{<])")re", "\\1 `` "},
+    // close quotes handled at end
+
+    {R"re(\.\.\.)re", " ... "},
+    {"[,;:@#$%&]", " \\0 "},
+
+    // Assume sentence tokenization has been done first, so split FINAL
+    // periods only.
+    {R"re(([^.])(\.)([\]\)}>"']*)[ ]*$)re", "\\1 \\2\\3 "},
+    // however, we may as well split ALL question marks and exclamation
+    // points, since they shouldn't have the abbrev.-marker ambiguity
+    // problem
+    {"[?!]", " \\0 "},
+
+    // parentheses, brackets, etc.
+    {R"re([\]\[\(\){}<>])re", " \\0 "},
+
+    // Like Adwait Ratnaparkhi's MXPOST, we use the parsed-file version of
+    // these symbols.
+    {"\\(", "-LRB-"},
+    {"\\)", "-RRB-"},
+    {"\\]", "-LSB-"},
+    {"\\]", "-RSB-"},
+    {"{", "-LCB-"},
+    {"}", "-RCB-"},
+
+    {"--", " -- "},
+
+    // First off, add a space to the beginning and end of each line, to
+    // reduce necessary number of regexps.
+    {"$", " "},
+    {"^", " "},
+
+    {"\"", " '' "},
+    // possessive or close-single-quote
+    {"([^'])' ", "\\1 ' "},
+    // as in it's, I'm, we'd
+    {"'([sSmMdD]) ", " '\\1 "},
+    {"'ll ", " 'll "},
+    {"'re ", " 're "},
+    {"'ve ", " 've "},
+    {"n't ", " n't "},
+    {"'LL ", " 'LL "},
+    {"'RE ", " 'RE "},
+    {"'VE ", " 'VE "},
+    {"N'T ", " N'T "},
+
+    {" ([Cc])annot ", " \\1an not "},
+    {" ([Dd])'ye ", " \\1' ye "},
+    {" ([Gg])imme ", " \\1im me "},
+    {" ([Gg])onna ", " \\1on na "},
+    {" ([Gg])otta ", " \\1ot ta "},
+    {" ([Ll])emme ", " \\1em me "},
+    {" ([Mm])ore'n ", " \\1ore 'n "},
+    {" '([Tt])is ", " '\\1 is "},
+    {" '([Tt])was ", " '\\1 was "},
+    {" ([Ww])anna ", " \\1an na "},
+    {" ([Ww])haddya ", " \\1ha dd ya "},
+    {" ([Ww])hatcha ", " \\1ha t cha "},
+
+    // clean out extra spaces
+    {"  *", " "},
+    {"^ *", ""},
+};
+
+}  // namespace
+
+EnglishTokenizer::EnglishTokenizer() : normalization_rules_by_byte_(256) {
+  for (const auto &rule : kNormalizationRules) {
+    const int index = normalization_rules_.size();
+    normalization_rules_.push_back({rule[0], rule[1]});
+    const uint8 first_byte = normalization_rules_.back().pattern[0];
+    normalization_rules_by_byte_[first_byte].push_back(index);
+  }
+  for (const auto &rule : kTokenizationRules) {
+    std::unique_ptr<RE2> pattern(new RE2(rule[0]));
+    CHECK(pattern->ok()) << "Invalid tokenization rule: " << rule[0];
+    tokenization_rules_.emplace_back(std::move(pattern), rule[1]);
+  }
+}
+
+string EnglishTokenizer::Tokenize(const string &text) const {
+  string rewritten;
+  rewritten.reserve(text.size() + text.size() / 4);
+  Normalize(text, &rewritten);
+  for (const auto &rule : tokenization_rules_) {
+    RE2::GlobalReplace(&rewritten, *rule.first, rule.second);
+  }
+  return rewritten;
+}
+
+void EnglishTokenizer::Normalize(const string &text, string *output) const {
+  const size_t size = text.size();
+  size_t copied = 0;
+  size_t i = 0;
+  while (i < size) {
+    const std::vector<int> &candidates =
+        normalization_rules_by_byte_[static_cast<uint8>(text[i])];
+    const LiteralRule *match = nullptr;
+    for (int index : candidates) {
+      const LiteralRule &rule = normalization_rules_[index];
+      if (text.compare(i, rule.pattern.size(), rule.pattern) == 0) {
+        match = &rule;
+        break;
+      }
+    }
+    if (match == nullptr) {
+      ++i;
+      continue;
+    }
+    output->append(text, copied, i - copied);
+    output->append(match->replacement);
+    i += match->pattern.size();
+    copied = i;
+  }
+  output->append(text, copied, size - copied);
+}
+
+}  // namespace syntaxnet
@@ -0,0 +1,73 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Penn Treebank style tokenizer for raw English text.
+
+#ifndef SYNTAXNET_ENGLISH_TOKENIZER_H_
+#define SYNTAXNET_ENGLISH_TOKENIZER_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "syntaxnet/base.h"
+#include "tensorflow/core/platform/regexp.h"
+
+namespace syntaxnet {
+
+// Tokenizer that attempts to perform Penn Treebank tokenization on arbitrary
+// raw text. Adapted from https://www.cis.upenn.edu/~treebank/tokenizer.sed
+// by Robert MacIntyre, University of Pennsylvania, late 1995.
+//
+// All rules are compiled once on construction. Character normalization is
+// done with a single scan over the text using a table of literal
+// substitutions indexed by their first byte, and the context-sensitive
+// tokenization rules are applied with precompiled regular expressions.
+class EnglishTokenizer {
+ public:
+  EnglishTokenizer();
+
+  // Returns the tokenized version of a single sentence, with tokens separated
+  // by spaces.
+  string Tokenize(const string &text) const;
+
+ private:
+  // A literal substitution.
+  struct LiteralRule {
+    string pattern;
+    string replacement;
+  };
+
+  // Applies all normalization rules to the text in a single left-to-right
+  // scan, appending the result to output. At every position, the first rule
+  // whose pattern matches is applied, otherwise the byte is copied as is.
+  void Normalize(const string &text, string *output) const;
+
+  // Normalization rules, in priority order.
+  std::vector<LiteralRule> normalization_rules_;
+
+  // Indices of the normalization rules whose pattern starts with a given byte.
+  std::vector<std::vector<int>> normalization_rules_by_byte_;
+
+  // Tokenization rules, applied in order with RE2::GlobalReplace.
+  std::vector<std::pair<std::unique_ptr<RE2>, string>> tokenization_rules_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(EnglishTokenizer);
+};
+
+}  // namespace syntaxnet
+
+#endif  // SYNTAXNET_ENGLISH_TOKENIZER_H_
@@ -0,0 +1,240 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "syntaxnet/english_tokenizer.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "syntaxnet/base.h"
+#include "tensorflow/core/platform/regexp.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace syntaxnet {
+namespace {
+
+// Reference implementation: every rule is passed to RE2::GlobalReplace as a
+// pattern string, one rule after the other.
+string ReferenceTokenize(const string &value) {
+  std::vector<std::pair<string, string>> preproc_rules = {
+      // Punctuation.
+      {"’", "'"},
+      {"…", "..."},
+      {"---", "--"},
+      {"—", "--"},
+      {"–", "--"},
+      {"，", ","},
+      {"。", "."},
+      {"！", "!"},
+      {"？", "?"},
+      {"：", ":"},
+      {"；", ";"},
+      {"＆", "&"},
+
+      // Brackets.
+      {"\\[", "("},
+      {"]", ")"},
+      {"{", "("},
+      {"}", ")"},
+      {"【", "("},
+      {"】", ")"},
+      {"（", "("},
+      {"）", ")"},
+
+      // Quotation marks.
+      {"\"", "\""},
+      {"″", "\""},
+      {"“", "\""},
+      {"„", "\""},
+      {"‵‵", "\""},
+      {"”", "\""},
+      {"’", "\""},
+      {"‘", "\""},
+      {"′′", "\""},
+      {"‹", "\""},
+      {"›", "\""},
+      {"«", "\""},
+      {"»", "\""},
+
+      // Discarded punctuation that breaks sentences.
+      {"|", ""},
+      {"·", ""},
+      {"•", ""},
+      {"●", ""},
+      {"▪", ""},
+      {"■", ""},
+      {"□", ""},
+      {"❑", ""},
+      {"◆", ""},
+      {"★", ""},
+      {"＊", ""},
+      {"♦", ""},
+  };
+
+  std::vector<std::pair<string, string>> rules = {
+      // attempt to get correct directional quotes
+      {R"re(^")re", "`` "},
+      {R"re(([ \([{<])")re", "\\1 `` "},
+      // close quotes handled at end
+
+      {R"re(\.\.\.)re", " ... "},
+      {"[,;:@#$%&]", " \\0 "},
+
+      // Assume sentence tokenization has been done first, so split FINAL
+      // periods only.
+      {R"re(([^.])(\.)([\]\)}>"']*)[ ]*$)re", "\\1 \\2\\3 "},
+      // however, we may as well split ALL question marks and exclamation
+      // points, since they shouldn't have the abbrev.-marker ambiguity
+      // problem
+      {"[?!]", " \\0 "},
+
+      // parentheses, brackets, etc.
+      {R"re([\]\[\(\){}<>])re", " \\0 "},
+
+      // Like Adwait Ratnaparkhi's MXPOST, we use the parsed-file version of
+      // these symbols.
+      {"\\(", "-LRB-"},
+      {"\\)", "-RRB-"},
+      {"\\]", "-LSB-"},
+      {"\\]", "-RSB-"},
+      {"{", "-LCB-"},
+      {"}", "-RCB-"},
+
+      {"--", " -- "},
+
+      // First off, add a space to the beginning and end of each line, to
+      // reduce necessary number of regexps.
+      {"$", " "},
+      {"^", " "},
+
+      {"\"", " '' "},
+      // possessive or close-single-quote
+      {"([^'])' ", "\\1 ' "},
+      // as in it's, I'm, we'd
+      {"'([sSmMdD]) ", " '\\1 "},
+      {"'ll ", " 'll "},
+      {"'re ", " 're "},
+      {"'ve ", " 've "},
+      {"n't ", " n't "},
+      {"'LL ", " 'LL "},
+      {"'RE ", " 'RE "},
+      {"'VE ", " 'VE "},
+      {"N'T ", " N'T "},
+
+      {" ([Cc])annot ", " \\1an not "},
+      {" ([Dd])'ye ", " \\1' ye "},
+      {" ([Gg])imme ", " \\1im me "},
+      {" ([Gg])onna ", " \\1on na "},
+      {" ([Gg])otta ", " \\1ot ta "},
+      {" ([Ll])emme ", " \\1em me "},
+      {" ([Mm])ore'n ", " \\1ore 'n "},
+      {" '([Tt])is ", " '\\1 is "},
+      {" '([Tt])was ", " '\\1 was "},
+      {" ([Ww])anna ", " \\1an na "},
+      {" ([Ww])haddya ", " \\1ha dd ya "},
+      {" ([Ww])hatcha ", " \\1ha t cha "},
+
+      // clean out extra spaces
+      {"  *", " "},
+      {"^ *", ""},
+  };
+
+  string rewritten = value;
+  for (const std::pair<string, string> &rule : preproc_rules) {
+    RE2::GlobalReplace(&rewritten, rule.first, rule.second);
+  }
+  for (const std::pair<string, string> &rule : rules) {
+    RE2::GlobalReplace(&rewritten, rule.first, rule.second);
+  }
+  return rewritten;
+}
+
+const char *const kSentences[] = {
+    "",
+    " ",
+    "Hello world.",
+    "\"I can't believe it's not butter!\" she said.",
+    "He said \"gimme that\" and 'tis true; I cannot, won't and shouldn't.",
+    "Prices rose 5% (or $3.50) at Smith & Co. -- see [1] or {2} <3>...",
+    "It’s “quoted” — and… „also” «this» ‹that› ‵‵odd′′ ″too″ ‘x’.",
+    "Ｆｕｌｌ，width。punctuation！？：；＆ and （brackets） 【here】.",
+    "Bullets · • ● ▪ ■ □ ❑ ◆ ★ ＊ ♦ and a pipe | stay out.",
+    "Dashes: a---b, a----b, a—-b, -–-, ---—.",
+    "WE'LL SEE, THEY'RE HERE, WE'VE GONE, DON'T STOP.",
+    "Whaddya wanna do? Whatcha gonna do? Lemme go, I gotta go. More'n that.",
+    "D'ye know 'Twas the night?",
+    "Trailing period with quotes.\"')  ",
+    "   leading and   multiple   spaces   ",
+    "@user #tag a:b c;d e,f",
+    "Ends with abbreviation etc.",
+    "...",
+    "\"",
+    "'",
+};
+
+TEST(EnglishTokenizerTest, MatchesReference) {
+  EnglishTokenizer tokenizer;
+  for (const char *sentence : kSentences) {
+    EXPECT_EQ(ReferenceTokenize(sentence), tokenizer.Tokenize(sentence))
+        << "Input: " << sentence;
+  }
+}
+
+TEST(EnglishTokenizerTest, MatchesReferenceOnConcatenations) {
+  EnglishTokenizer tokenizer;
+  for (const char *first : kSentences) {
+    for (const char *second : kSentences) {
+      const string sentence = string(first) + second;
+      EXPECT_EQ(ReferenceTokenize(sentence), tokenizer.Tokenize(sentence))
+          << "Input: " << sentence;
+    }
+  }
+}
+
+TEST(EnglishTokenizerTest, Tokenize) {
+  EnglishTokenizer tokenizer;
+  EXPECT_EQ("`` I ca n't do it , '' he said . ",
+            tokenizer.Tokenize("\"I can't do it,\" he said."));
+}
+
+void BM_ReferenceTokenize(int iters) {
+  int64 num_sentences = 0;
+  for (int i = 0; i < iters; ++i) {
+    for (const char *sentence : kSentences) {
+      ReferenceTokenize(sentence);
+      ++num_sentences;
+    }
+  }
+  tensorflow::testing::ItemsProcessed(num_sentences);
+}
+BENCHMARK(BM_ReferenceTokenize);
+
+void BM_EnglishTokenizer(int iters) {
+  EnglishTokenizer tokenizer;
+  int64 num_sentences = 0;
+  for (int i = 0; i < iters; ++i) {
+    for (const char *sentence : kSentences) {
+      tokenizer.Tokenize(sentence);
+      ++num_sentences;
+    }
+  }
+  tensorflow::testing::ItemsProcessed(num_sentences);
+}
+BENCHMARK(BM_EnglishTokenizer);
+
+}  // namespace
+}  // namespace syntaxnet
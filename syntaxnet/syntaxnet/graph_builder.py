@@ -60,11 +60,34 @@ def EmbeddingLookupFeatures(params, sparse_features, allow_weights):
     weight of each id. It returns a tensor with each entry of sparse_features
     replaced by this combined embedding.
   """
+  sparse_features = tf.convert_to_tensor(sparse_features)
+  indices, ids, weights = gen_parser_ops.unpack_sparse_features(sparse_features)
+  return EmbeddingLookupDenseFeatures(params, indices, ids, weights,
+                                      tf.size(sparse_features), allow_weights)
+
+
+def EmbeddingLookupDenseFeatures(params, indices, ids, weights, num_slots,
+                                 allow_weights):
+  """Computes embeddings for features given in dense form.
+
+  Args:
+    params: list of 2D tensors containing vector embeddings
+    indices: 1D int32 tensor with the feature slot of each feature id, as
+      output by the Dense* reader ops or by UnpackSparseFeatures.
+    ids: 1D int64 tensor of feature ids.
+    weights: 1D float tensor of feature weights.
+    num_slots: total number of feature slots, i.e. the batch size times the
+      number of features in the feature group.
+    allow_weights: boolean to control whether the weights are used to multiply
+      the embeddings.
+
+  Returns:
+    A tensor with num_slots rows, where each row is the sum of the embeddings of
+    the ids in the corresponding slot, weighted by their weights.
+  """
   if not isinstance(params, list):
     params = [params]
   # Lookup embeddings.
-  sparse_features = tf.convert_to_tensor(sparse_features)
-  indices, ids, weights = gen_parser_ops.unpack_sparse_features(sparse_features)
   embeddings = tf.nn.embedding_lookup(params, ids)
 
   if allow_weights:
@@ -73,7 +96,7 @@ def EmbeddingLookupFeatures(params, sparse_features, allow_weights):
     embeddings *= tf.reshape(weights, broadcast_weights_shape)
 
   # Sum embeddings by index.
-  return tf.unsorted_segment_sum(embeddings, indices, tf.size(sparse_features))
+  return tf.unsorted_segment_sum(embeddings, indices, num_slots)
 
 
 class GreedyParser(object):
@@ -14,7 +14,11 @@ limitations under the License.
 ==============================================================================*/
 
 #include <stddef.h>
+#include <deque>
+#include <memory>
 #include <string>
+#include <unordered_set>
+#include <vector>
 
 #include "syntaxnet/affix.h"
 #include "syntaxnet/dictionary.pb.h"
@@ -22,10 +26,14 @@ limitations under the License.
 #include "syntaxnet/segmenter_utils.h"
 #include "syntaxnet/sentence.pb.h"
 #include "syntaxnet/sentence_batch.h"
+#include "syntaxnet/sentence_prefetcher.h"
 #include "syntaxnet/term_frequency_map.h"
 #include "syntaxnet/utils.h"
 #include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/lib/core/notification.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/cpu_info.h"
 #include "tensorflow/core/platform/env.h"
 
 // A task that collects term statistics over a corpus and saves a set of
@@ -45,6 +53,10 @@ namespace syntaxnet {
 
 // A workflow task that creates term maps (e.g., word, tag, etc.).
 //
+// The corpus is split into shards of consecutive documents, which are counted
+// in parallel and merged in corpus order, so the saved maps and affix tables
+// do not depend on the number of threads.
+//
 // Non-flag task parameters:
 // int lexicon_max_prefix_length (3):
 //   The maximum prefix length for lexicon words.
@@ -58,6 +70,12 @@ class LexiconBuilder : public OpKernel {
                                              &max_prefix_length_));
     OP_REQUIRES_OK(context, context->GetAttr("lexicon_max_suffix_length",
                                              &max_suffix_length_));
+    OP_REQUIRES_OK(context, context->GetAttr("num_threads", &num_threads_));
+    OP_REQUIRES(context, num_threads_ >= 0,
+                InvalidArgument("num_threads must be non-negative"));
+    if (num_threads_ == 0) {
+      num_threads_ = tensorflow::port::NumSchedulableCPUs();
+    }
 
     string file_path, data;
     OP_REQUIRES_OK(context, context->GetAttr("task_context", &file_path));
@@ -70,7 +88,88 @@ class LexiconBuilder : public OpKernel {
 
   // Counts term frequencies.
   void Compute(OpKernelContext *context) override {
-    // Term frequency maps to be populated by the corpus.
+    // Totals over the corpus, merged from the shards.
+    LexiconShard total;
+
+    // Affix tables to be populated by the corpus.
+    AffixTable prefixes(AffixTable::PREFIX, max_prefix_length_);
+    AffixTable suffixes(AffixTable::SUFFIX, max_suffix_length_);
+
+    // Make a pass over the corpus. Documents are converted ahead of time on
+    // the prefetcher threads, and shards are counted on the pool threads.
+    PrefetchOptions prefetch_options;
+    prefetch_options.prefetch_depth = kDocumentsPerShard;
+    prefetch_options.num_threads = num_threads_;
+    SentencePrefetcher corpus(*task_context_.GetInput(corpus_name_),
+                              &task_context_, prefetch_options);
+    std::deque<std::unique_ptr<LexiconShard>> pending;
+    tensorflow::thread::ThreadPool pool(tensorflow::Env::Default(),
+                                        "lexicon_builder", num_threads_);
+    const size_t max_pending = 2 * num_threads_;
+    bool end_of_corpus = false;
+    while (!end_of_corpus || !pending.empty()) {
+      if (!end_of_corpus && pending.size() < max_pending) {
+        std::unique_ptr<LexiconShard> shard(new LexiconShard());
+        while (static_cast<int>(shard->documents.size()) <
+               kDocumentsPerShard) {
+          Sentence *document = corpus.Read();
+          if (document == nullptr) {
+            end_of_corpus = true;
+            break;
+          }
+          shard->documents.emplace_back(document);
+        }
+        if (!shard->documents.empty()) {
+          LexiconShard *shard_ptr = shard.get();
+          pool.Schedule([shard_ptr]() { CountShard(shard_ptr); });
+          pending.push_back(std::move(shard));
+        }
+        continue;
+      }
+
+      // Merge the oldest shard once it has been counted.
+      pending.front()->done.WaitForNotification();
+      MergeShard(*pending.front(), &total, &prefixes, &suffixes);
+      pending.pop_front();
+    }
+    LOG(INFO) << "Term maps collected over " << total.num_tokens
+              << " tokens from " << total.num_documents << " documents";
+
+    // Write mappings to disk.
+    total.words.Save(
+        TaskContext::InputFile(*task_context_.GetInput("word-map")));
+    total.lcwords.Save(
+        TaskContext::InputFile(*task_context_.GetInput("lcword-map")));
+    total.tags.Save(TaskContext::InputFile(*task_context_.GetInput("tag-map")));
+    total.categories.Save(
+        TaskContext::InputFile(*task_context_.GetInput("category-map")));
+    total.labels.Save(
+        TaskContext::InputFile(*task_context_.GetInput("label-map")));
+    total.chars.Save(
+        TaskContext::InputFile(*task_context_.GetInput("char-map")));
+
+    // Write affixes to disk.
+    WriteAffixTable(prefixes, TaskContext::InputFile(
+                                  *task_context_.GetInput("prefix-table")));
+    WriteAffixTable(suffixes, TaskContext::InputFile(
+                                  *task_context_.GetInput("suffix-table")));
+
+    // Write tag-to-category mapping to disk.
+    total.tag_to_category.Save(
+        TaskContext::InputFile(*task_context_.GetInput("tag-to-category")));
+  }
+
+ private:
+  // Number of consecutive documents counted together.
+  static const int kDocumentsPerShard = 1000;
+
+  // Documents of a shard of the corpus, and the term statistics collected over
+  // them.
+  struct LexiconShard {
+    // Documents to count, in corpus order. Deleted once counted.
+    std::vector<std::unique_ptr<Sentence>> documents;
+
+    // Term frequency maps.
     TermFrequencyMap words;
     TermFrequencyMap lcwords;
     TermFrequencyMap tags;
@@ -78,19 +177,25 @@ class LexiconBuilder : public OpKernel {
     TermFrequencyMap labels;
     TermFrequencyMap chars;
 
-    // Affix tables to be populated by the corpus.
-    AffixTable prefixes(AffixTable::PREFIX, max_prefix_length_);
-    AffixTable suffixes(AffixTable::SUFFIX, max_suffix_length_);
-
     // Tag-to-category mapping.
     TagToCategoryMap tag_to_category;
 
-    // Make a pass over the corpus.
+    // Distinct words in order of first occurrence. Adding the affixes of these
+    // words in this order assigns the same affix ids as adding the affixes of
+    // every token.
+    std::vector<string> affix_words;
+    std::unordered_set<string> seen_words;
+
     int64 num_tokens = 0;
     int64 num_documents = 0;
-    Sentence *document;
-    TextReader corpus(*task_context_.GetInput(corpus_name_), &task_context_);
-    while ((document = corpus.Read()) != nullptr) {
+
+    // Notified once the documents have been counted.
+    tensorflow::Notification done;
+  };
+
+  // Counts the terms of all documents in a shard.
+  static void CountShard(LexiconShard *shard) {
+    for (const auto &document : shard->documents) {
       // Gather token information.
       for (int t = 0; t < document->token_size(); ++t) {
         // Get token and lowercased word.
@@ -103,55 +208,62 @@ class LexiconBuilder : public OpKernel {
         CHECK(lcword.find('\n') == string::npos);
 
         // Increment frequencies (only for terms that exist).
-        if (!word.empty() && !HasSpaces(word)) words.Increment(word);
-        if (!lcword.empty() && !HasSpaces(lcword)) lcwords.Increment(lcword);
-        if (!token.tag().empty()) tags.Increment(token.tag());
-        if (!token.category().empty()) categories.Increment(token.category());
-        if (!token.label().empty()) labels.Increment(token.label());
-
-        // Add prefixes/suffixes for the current word.
-        prefixes.AddAffixesForWord(word.c_str(), word.size());
-        suffixes.AddAffixesForWord(word.c_str(), word.size());
+        if (!word.empty() && !HasSpaces(word)) shard->words.Increment(word);
+        if (!lcword.empty() && !HasSpaces(lcword)) {
+          shard->lcwords.Increment(lcword);
+        }
+        if (!token.tag().empty()) shard->tags.Increment(token.tag());
+        if (!token.category().empty()) {
+          shard->categories.Increment(token.category());
+        }
+        if (!token.label().empty()) shard->labels.Increment(token.label());
 
         // Add mapping from tag to category.
-        tag_to_category.SetCategory(token.tag(), token.category());
+        shard->tag_to_category.SetCategory(token.tag(), token.category());
 
         // Add characters.
         std::vector<tensorflow::StringPiece> char_sp;
         SegmenterUtils::GetUTF8Chars(word, &char_sp);
         for (const auto &c : char_sp) {
           const string c_str = c.ToString();
-          if (!c_str.empty() && !HasSpaces(c_str)) chars.Increment(c_str);
+          if (!c_str.empty() && !HasSpaces(c_str)) {
+            shard->chars.Increment(c_str);
+          }
+        }
+
+        // Keep the word for adding its prefixes/suffixes.
+        if (shard->seen_words.insert(word).second) {
+          shard->affix_words.push_back(std::move(word));
         }
 
         // Update the number of processed tokens.
-        ++num_tokens;
+        ++shard->num_tokens;
       }
-
-      delete document;
-      ++num_documents;
+      ++shard->num_documents;
     }
-    LOG(INFO) << "Term maps collected over " << num_tokens << " tokens from "
-              << num_documents << " documents";
-
-    // Write mappings to disk.
-    words.Save(TaskContext::InputFile(*task_context_.GetInput("word-map")));
-    lcwords.Save(TaskContext::InputFile(*task_context_.GetInput("lcword-map")));
-    tags.Save(TaskContext::InputFile(*task_context_.GetInput("tag-map")));
-    categories.Save(
-        TaskContext::InputFile(*task_context_.GetInput("category-map")));
-    labels.Save(TaskContext::InputFile(*task_context_.GetInput("label-map")));
-    chars.Save(TaskContext::InputFile(*task_context_.GetInput("char-map")));
-
-    // Write affixes to disk.
-    WriteAffixTable(prefixes, TaskContext::InputFile(
-                                  *task_context_.GetInput("prefix-table")));
-    WriteAffixTable(suffixes, TaskContext::InputFile(
-                                  *task_context_.GetInput("suffix-table")));
+    shard->documents.clear();
+    shard->done.Notify();
+  }
 
-    // Write tag-to-category mapping to disk.
-    tag_to_category.Save(
-        TaskContext::InputFile(*task_context_.GetInput("tag-to-category")));
+  // Adds the statistics of a shard to the totals. Shards must be merged in
+  // corpus order.
+  static void MergeShard(const LexiconShard &shard, LexiconShard *total,
+                         AffixTable *prefixes, AffixTable *suffixes) {
+    total->words.Merge(shard.words);
+    total->lcwords.Merge(shard.lcwords);
+    total->tags.Merge(shard.tags);
+    total->categories.Merge(shard.categories);
+    total->labels.Merge(shard.labels);
+    total->chars.Merge(shard.chars);
+    total->tag_to_category.Merge(shard.tag_to_category);
+
+    // Add prefixes/suffixes for the new words.
+    for (const string &word : shard.affix_words) {
+      prefixes->AddAffixesForWord(word.c_str(), word.size());
+      suffixes->AddAffixesForWord(word.c_str(), word.size());
+    }
+    total->num_tokens += shard.num_tokens;
+    total->num_documents += shard.num_documents;
   }
 
  private:
@@ -179,6 +291,9 @@ class LexiconBuilder : public OpKernel {
   // Max length for suffix table.
   int max_suffix_length_;
 
+  // Number of threads for converting and counting documents.
+  int num_threads_;
+
   // Task context used to configure this op.
   TaskContext task_context_;
 };
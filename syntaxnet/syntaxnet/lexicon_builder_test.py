@@ -154,9 +154,19 @@ class LexiconBuilderTest(test_util.TensorFlowTestCase):
     for word in filter(None, TOKENIZED_DOCS.replace('\n', ' ').split(' ')):
       self.assertIn(word.encode('utf-8'), word_map)
 
-  def BuildLexicon(self):
+  def BuildLexicon(self, num_threads=0):
     with self.test_session():
-      gen_parser_ops.lexicon_builder(task_context=self.context_file).run()
+      gen_parser_ops.lexicon_builder(task_context=self.context_file,
+                                     num_threads=num_threads).run()
+
+  def ReadLexiconFiles(self):
+    contents = {}
+    for name in ('word-map', 'lcword-map', 'tag-map',
+                 'category-map', 'label-map', 'prefix-table',
+                 'suffix-table', 'tag-to-category', 'char-map'):
+      with open(os.path.join(FLAGS.test_tmpdir, name), 'rb') as f:
+        contents[name] = f.read()
+    return contents
 
   def testCoNLLFormat(self):
     self.WriteContext('conll-sentence')
@@ -193,5 +203,26 @@ class LexiconBuilderTest(test_util.TensorFlowTestCase):
     self.ValidateDocuments()
     self.BuildLexicon()
 
+  def testParallelBuildMatchesSingleThread(self):
+    self.WriteContext('conll-sentence')
+
+    # Enough documents for several shards, with new words in each of them.
+    documents = []
+    for i in range(4000):
+      lines = []
+      for j, line in enumerate((CONLL_DOC1 if i % 2 else CONLL_DOC2)
+                               .split('\n')):
+        fields = line.split(' ')
+        if j % 3 == 0:
+          fields[1] += u'क' * (i % 5) + unichr(ord(u'a') + (i * j) % 26) * 2
+        lines.append(u'\t'.join(fields))
+      documents.append(u'\n'.join(lines))
+    with open(self.corpus_file, 'w') as f:
+      f.write((u'\n\n'.join(documents) + u'\n').encode('utf-8'))
+    self.BuildLexicon(num_threads=1)
+    expected = self.ReadLexiconFiles()
+    self.BuildLexicon(num_threads=4)
+    self.assertEqual(expected, self.ReadLexiconFiles())
+
 if __name__ == '__main__':
   googletest.main()
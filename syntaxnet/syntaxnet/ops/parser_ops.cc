@@ -28,6 +28,9 @@ REGISTER_OP("GoldParseReader")
     .Attr("batch_size: int")
     .Attr("corpus_name: string='documents'")
     .Attr("arg_prefix: string='brain_parser'")
+    .Attr("prefetch_depth: int=0")
+    .Attr("num_parse_threads: int=1")
+    .Attr("deterministic_order: bool=true")
     .SetIsStateful()
     .Doc(R"doc(
 Reads sentences, parses them, and returns (gold action, feature) pairs.
@@ -41,6 +44,50 @@ feature_size: number of feature outputs emitted by this reader.
 batch_size: number of sentences to parse at a time.
 corpus_name: name of task input in the task context to read parses from.
 arg_prefix: prefix for context parameters.
+prefetch_depth: number of documents to read ahead on background threads, or 0
+                to read documents synchronously.
+num_parse_threads: number of threads converting documents when prefetching.
+deterministic_order: whether prefetched documents are returned in corpus order.
+)doc");
+
+REGISTER_OP("DenseGoldParseReader")
+    .Output("feature_indices: feature_size * int32")
+    .Output("feature_ids: feature_size * int64")
+    .Output("feature_weights: feature_size * float")
+    .Output("num_epochs: int32")
+    .Output("gold_actions: int32")
+    .Attr("task_context: string")
+    .Attr("feature_size: int")
+    .Attr("batch_size: int")
+    .Attr("corpus_name: string='documents'")
+    .Attr("arg_prefix: string='brain_parser'")
+    .Attr("prefetch_depth: int=0")
+    .Attr("num_parse_threads: int=1")
+    .Attr("deterministic_order: bool=true")
+    .SetIsStateful()
+    .Doc(R"doc(
+Like GoldParseReader, but outputs the features in dense form instead of as
+serialized SparseFeatures protos.
+
+For each feature group, feature_indices, feature_ids and feature_weights are
+what UnpackSparseFeatures would output for the flattened features matrix of
+GoldParseReader: the index of a feature id is
+batch_index * num_features_in_group + feature.
+
+feature_indices: feature slot of each feature id, for each feature group.
+feature_ids: feature ids, for each feature group.
+feature_weights: feature weights, for each feature group.
+num_epochs: number of times this reader went over the training corpus.
+gold_actions: action to perform at the current parser state.
+task_context: file path at which to read the task context.
+feature_size: number of feature groups emitted by this reader.
+batch_size: number of sentences to parse at a time.
+corpus_name: name of task input in the task context to read parses from.
+arg_prefix: prefix for context parameters.
+prefetch_depth: number of documents to read ahead on background threads, or 0
+                to read documents synchronously.
+num_parse_threads: number of threads converting documents when prefetching.
+deterministic_order: whether prefetched documents are returned in corpus order.
 )doc");
 
 REGISTER_OP("DecodedParseReader")
@@ -54,6 +101,9 @@ REGISTER_OP("DecodedParseReader")
     .Attr("batch_size: int")
     .Attr("corpus_name: string='documents'")
     .Attr("arg_prefix: string='brain_parser'")
+    .Attr("prefetch_depth: int=0")
+    .Attr("num_parse_threads: int=1")
+    .Attr("deterministic_order: bool=true")
     .SetIsStateful()
     .Doc(R"doc(
 Reads sentences and parses them taking parsing transitions based on the
@@ -69,6 +119,48 @@ feature_size: number of feature outputs emitted by this reader.
 batch_size: number of sentences to parse at a time.
 corpus_name: name of task input in the task context to read parses from.
 arg_prefix: prefix for context parameters.
+prefetch_depth: number of documents to read ahead on background threads, or 0
+                to read documents synchronously.
+num_parse_threads: number of threads converting documents when prefetching.
+deterministic_order: whether prefetched documents are returned in corpus order.
+)doc");
+
+REGISTER_OP("DenseDecodedParseReader")
+    .Input("transition_scores: float")
+    .Output("feature_indices: feature_size * int32")
+    .Output("feature_ids: feature_size * int64")
+    .Output("feature_weights: feature_size * float")
+    .Output("num_epochs: int32")
+    .Output("eval_metrics: int32")
+    .Output("documents: string")
+    .Attr("task_context: string")
+    .Attr("feature_size: int")
+    .Attr("batch_size: int")
+    .Attr("corpus_name: string='documents'")
+    .Attr("arg_prefix: string='brain_parser'")
+    .Attr("prefetch_depth: int=0")
+    .Attr("num_parse_threads: int=1")
+    .Attr("deterministic_order: bool=true")
+    .SetIsStateful()
+    .Doc(R"doc(
+Like DecodedParseReader, but outputs the features in dense form, as described
+for DenseGoldParseReader.
+
+transition_scores: scores for every transition from the current parser state.
+feature_indices: feature slot of each feature id, for each feature group.
+feature_ids: feature ids, for each feature group.
+feature_weights: feature weights, for each feature group.
+num_epochs: number of times this reader went over the training corpus.
+eval_metrics: token counts used to compute evaluation metrics.
+task_context: file path at which to read the task context.
+feature_size: number of feature groups emitted by this reader.
+batch_size: number of sentences to parse at a time.
+corpus_name: name of task input in the task context to read parses from.
+arg_prefix: prefix for context parameters.
+prefetch_depth: number of documents to read ahead on background threads, or 0
+                to read documents synchronously.
+num_parse_threads: number of threads converting documents when prefetching.
+deterministic_order: whether prefetched documents are returned in corpus order.
 )doc");
 
 REGISTER_OP("BeamParseReader")
@@ -84,6 +176,9 @@ REGISTER_OP("BeamParseReader")
     .Attr("arg_prefix: string='brain_parser'")
     .Attr("continue_until_all_final: bool=false")
     .Attr("always_start_new_sentences: bool=false")
+    .Attr("prefetch_depth: int=0")
+    .Attr("num_parse_threads: int=1")
+    .Attr("deterministic_order: bool=true")
     .SetIsStateful()
     .Doc(R"doc(
 Reads sentences and creates a beam parser.
@@ -102,6 +197,10 @@ continue_until_all_final: whether to continue parsing after the gold path falls
                           off the beam.
 always_start_new_sentences: whether to skip to the beginning of a new sentence
                             after each training step.
+prefetch_depth: number of documents to read ahead on background threads, or 0
+                to read documents synchronously.
+num_parse_threads: number of threads converting documents when prefetching.
+deterministic_order: whether prefetched documents are returned in corpus order.
 )doc");
 
 REGISTER_OP("BeamParser")
@@ -124,6 +223,75 @@ alive: whether the gold state is still in the beam.
 feature_size: number of feature outputs emitted by this reader.
 )doc");
 
+REGISTER_OP("DenseBeamParseReader")
+    .Output("feature_indices: feature_size * int32")
+    .Output("feature_ids: feature_size * int64")
+    .Output("feature_weights: feature_size * float")
+    .Output("beam_state: int64")
+    .Output("num_epochs: int32")
+    .Attr("task_context: string")
+    .Attr("feature_size: int")
+    .Attr("beam_size: int")
+    .Attr("batch_size: int=1")
+    .Attr("corpus_name: string='documents'")
+    .Attr("allow_feature_weights: bool=true")
+    .Attr("arg_prefix: string='brain_parser'")
+    .Attr("continue_until_all_final: bool=false")
+    .Attr("always_start_new_sentences: bool=false")
+    .Attr("prefetch_depth: int=0")
+    .Attr("num_parse_threads: int=1")
+    .Attr("deterministic_order: bool=true")
+    .SetIsStateful()
+    .Doc(R"doc(
+Like BeamParseReader, but outputs the features in dense form, as described for
+DenseGoldParseReader, with one row per slot of the beams. The beam state must
+be advanced with DenseBeamParser.
+
+feature_indices: feature slot of each feature id, for each feature group.
+feature_ids: feature ids, for each feature group.
+feature_weights: feature weights, for each feature group.
+beam_state: beam state handle.
+task_context: file path at which to read the task context.
+feature_size: number of feature groups emitted by this reader.
+beam_size: limit on the beam size.
+corpus_name: name of task input in the task context to read parses from.
+allow_feature_weights: whether the op is expected to output weighted features.
+                       If false, it will check that no weights are specified.
+arg_prefix: prefix for context parameters.
+continue_until_all_final: whether to continue parsing after the gold path falls
+                          off the beam.
+always_start_new_sentences: whether to skip to the beginning of a new sentence
+                            after each training step.
+prefetch_depth: number of documents to read ahead on background threads, or 0
+                to read documents synchronously.
+num_parse_threads: number of threads converting documents when prefetching.
+deterministic_order: whether prefetched documents are returned in corpus order.
+)doc");
+
+REGISTER_OP("DenseBeamParser")
+    .Input("beam_state: int64")
+    .Input("transition_scores: float")
+    .Output("feature_indices: feature_size * int32")
+    .Output("feature_ids: feature_size * int64")
+    .Output("feature_weights: feature_size * float")
+    .Output("next_beam_state: int64")
+    .Output("alive: bool")
+    .Attr("feature_size: int")
+    .SetIsStateful()
+    .Doc(R"doc(
+Like BeamParser, but outputs the features in dense form, as described for
+DenseGoldParseReader. Must be used with a beam state from DenseBeamParseReader.
+
+beam_state: beam state.
+transition_scores: scores for every transition from the current parser state.
+feature_indices: feature slot of each feature id, for each feature group.
+feature_ids: feature ids, for each feature group.
+feature_weights: feature weights, for each feature group.
+next_beam_state: beam state handle.
+alive: whether the gold state is still in the beam.
+feature_size: number of feature groups emitted by this reader.
+)doc");
+
 REGISTER_OP("BeamParserOutput")
     .Input("beam_state: int64")
     .Output("indices_and_paths: int32")
@@ -165,6 +333,7 @@ REGISTER_OP("LexiconBuilder")
     .Attr("corpus_name: string='documents'")
     .Attr("lexicon_max_prefix_length: int = 3")
     .Attr("lexicon_max_suffix_length: int = 3")
+    .Attr("num_threads: int = 0")
     .Doc(R"doc(
 An op that collects term statistics over a corpus and saves a set of term maps.
 
@@ -172,6 +341,8 @@ task_context: file path at which to read the task context.
 corpus_name: name of the context input to compute lexicons.
 lexicon_max_prefix_length: maximum prefix length for lexicon words.
 lexicon_max_suffix_length: maximum suffix length for lexicon words.
+num_threads: number of threads for reading and counting the corpus, or 0 to use
+             one thread per CPU. The term maps do not depend on this value.
 )doc");
 
 REGISTER_OP("FeatureSize")
@@ -15,6 +15,8 @@ limitations under the License.
 
 #include "syntaxnet/parser_state.h"
 
+#include <algorithm>
+
 #include "syntaxnet/kbest_syntax.pb.h"
 #include "syntaxnet/sentence.pb.h"
 #include "syntaxnet/term_frequency_map.h"
@@ -38,9 +40,15 @@ ParserState::ParserState(Sentence *sentence,
   stack_.reserve(num_tokens_ + 1);
 
   // Allocate space for head indices and labels. Initialize the head for all
-  // tokens to be the artificial root node, i.e. token -1.
-  head_.resize(num_tokens_, -1);
-  label_.resize(num_tokens_, RootLabel());
+  // tokens to be the artificial root node, i.e. token -1. All chunks start out
+  // identical, so they share the same storage until an arc is added.
+  const int num_chunks = (num_tokens_ + kArcChunkSize - 1) / kArcChunkSize;
+  if (num_chunks > 0) {
+    std::shared_ptr<ArcChunk> initial(new ArcChunk);
+    std::fill(initial->head, initial->head + kArcChunkSize, -1);
+    std::fill(initial->label, initial->label + kArcChunkSize, RootLabel());
+    arcs_.assign(num_chunks, initial);
+  }
 
   // Transition system-specific preprocessing.
   if (transition_state_ != nullptr) transition_state_->Init(this);
@@ -59,8 +67,7 @@ ParserState *ParserState::Clone() const {
   new_state->root_label_ = root_label_;
   new_state->next_ = next_;
   new_state->stack_.assign(stack_.begin(), stack_.end());
-  new_state->head_.assign(head_.begin(), head_.end());
-  new_state->label_.assign(label_.begin(), label_.end());
+  new_state->arcs_ = arcs_;
   new_state->score_ = score_;
   new_state->is_gold_ = is_gold_;
   return new_state;
@@ -116,13 +123,17 @@ bool ParserState::StackEmpty() const { return stack_.empty(); }
 int ParserState::Head(int index) const {
   DCHECK_GE(index, -1);
   DCHECK_LT(index, num_tokens_);
-  return index == -1 ? -1 : head_[index];
+  return index == -1
+             ? -1
+             : arcs_[index / kArcChunkSize]->head[index % kArcChunkSize];
 }
 
 int ParserState::Label(int index) const {
   DCHECK_GE(index, -1);
   DCHECK_LT(index, num_tokens_);
-  return index == -1 ? RootLabel() : label_[index];
+  return index == -1
+             ? RootLabel()
+             : arcs_[index / kArcChunkSize]->label[index % kArcChunkSize];
 }
 
 int ParserState::Parent(int index, int n) const {
@@ -198,8 +209,10 @@ int ParserState::RightSibling(int index, int n) const {
 void ParserState::AddArc(int index, int head, int label) {
   DCHECK_GE(index, 0);
   DCHECK_LT(index, num_tokens_);
-  head_[index] = head;
-  label_[index] = label;
+  std::shared_ptr<ArcChunk> &chunk = arcs_[index / kArcChunkSize];
+  if (chunk.use_count() > 1) chunk.reset(new ArcChunk(*chunk));
+  chunk->head[index % kArcChunkSize] = head;
+  chunk->label[index % kArcChunkSize] = label;
 }
 
 int ParserState::GoldHead(int index) const {
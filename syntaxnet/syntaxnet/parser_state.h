@@ -18,6 +18,7 @@ limitations under the License.
 #ifndef SYNTAXNET_PARSER_STATE_H_
 #define SYNTAXNET_PARSER_STATE_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -58,7 +59,9 @@ class ParserState {
   // Deletes the parser state.
   ~ParserState();
 
-  // Clones the parser state.
+  // Clones the parser state. The partial dependency tree is shared with the
+  // clone and only copied chunk by chunk when either state adds an arc, so
+  // cloning is cheap even for long sentences.
   ParserState *Clone() const;
 
   // Returns the root label.
@@ -212,12 +215,19 @@ class ParserState {
   // Parse stack of partially processed tokens.
   std::vector<int> stack_;
 
-  // List of head positions for the (partial) dependency tree.
-  std::vector<int> head_;
+  // Number of tokens in each copy-on-write chunk of the dependency tree.
+  static const int kArcChunkSize = 32;
 
-  // List of dependency relation labels describing the (partial) dependency
-  // tree.
-  std::vector<int> label_;
+  // Head positions and dependency relation labels for a block of
+  // kArcChunkSize consecutive tokens of the (partial) dependency tree.
+  struct ArcChunk {
+    int head[kArcChunkSize];
+    int label[kArcChunkSize];
+  };
+
+  // Chunks describing the (partial) dependency tree. Chunks are shared
+  // between cloned states and copied on the first write.
+  std::vector<std::shared_ptr<ArcChunk>> arcs_;
 
   // Score of the parser state.
   double score_ = 0.0;
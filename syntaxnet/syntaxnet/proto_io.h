@@ -16,6 +16,8 @@ limitations under the License.
 #ifndef SYNTAXNET_PROTO_IO_H_
 #define SYNTAXNET_PROTO_IO_H_
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -38,6 +40,8 @@ limitations under the License.
 #include "tensorflow/core/lib/io/record_writer.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
 
 namespace syntaxnet {
 
@@ -142,17 +146,165 @@ class StdIn : public tensorflow::RandomAccessFile {
   TF_DISALLOW_COPY_AND_ASSIGN(StdIn);
 };
 
-// Reads sentence protos from a text file.
+// Reads the records of one text file at a time with a document format. If
+// read ahead is enabled, the records are read on a background thread into a
+// bounded queue, so that several files can be read in parallel.
+class TextRecordStream {
+ public:
+  // Creates a stream, which reads nothing until a file is opened. If
+  // read_ahead is positive, up to that many records are read ahead.
+  TextRecordStream(DocumentFormat *format, int read_ahead)
+      : format_(format), read_ahead_(read_ahead) {}
+
+  ~TextRecordStream() { Close(); }
+
+  const string &filename() const { return filename_; }
+
+  // Reads the next record, and returns false at end of file.
+  bool ReadRecord(string *record) {
+    if (read_ahead_ == 0) return format_->ReadRecord(buffer_.get(), record);
+    tensorflow::mutex_lock lock(mu_);
+    while (records_.empty() && !end_of_file_) records_ready_.wait(lock);
+    if (records_.empty()) return false;
+    *record = std::move(records_.front());
+    records_.pop_front();
+    space_ready_.notify_one();
+    return true;
+  }
+
+  // Opens the given file, closing the current one and discarding any records
+  // read ahead from it.
+  void Open(const string &filename) {
+    Close();
+    filename_ = filename;
+    if (filename_ == "-") {
+      static const int kInputBufferSize = 8 * 1024; /* bytes */
+      file_.reset(new StdIn());
+      stream_.reset(new tensorflow::io::RandomAccessInputStream(file_.get()));
+      buffer_.reset(new tensorflow::io::BufferedInputStream(file_.get(),
+                                                            kInputBufferSize));
+    } else {
+      static const int kInputBufferSize = 1 * 1024 * 1024; /* bytes */
+      TF_CHECK_OK(
+          tensorflow::Env::Default()->NewRandomAccessFile(filename_, &file_));
+      stream_.reset(new tensorflow::io::RandomAccessInputStream(file_.get()));
+      buffer_.reset(new tensorflow::io::BufferedInputStream(file_.get(),
+                                                            kInputBufferSize));
+    }
+    if (read_ahead_ > 0) {
+      {
+        tensorflow::mutex_lock lock(mu_);
+        records_.clear();
+        end_of_file_ = false;
+        cancelled_ = false;
+      }
+      thread_.reset(tensorflow::Env::Default()->StartThread(
+          tensorflow::ThreadOptions(), "text_record_stream",
+          [this]() { ReadAhead(); }));
+    }
+  }
+
+  // Stops reading ahead and closes the current file, if any.
+  void Close() {
+    StopReadAhead();
+    buffer_.reset();
+    stream_.reset();
+    file_.reset();
+  }
+
+ private:
+  // Reads records into the queue until end of file or cancellation.
+  void ReadAhead() {
+    while (true) {
+      {
+        tensorflow::mutex_lock lock(mu_);
+        while (!cancelled_ && records_.size() >= read_ahead_) {
+          space_ready_.wait(lock);
+        }
+        if (cancelled_) return;
+      }
+      string record;
+      const bool has_record = format_->ReadRecord(buffer_.get(), &record);
+      tensorflow::mutex_lock lock(mu_);
+      if (!has_record) {
+        end_of_file_ = true;
+        records_ready_.notify_all();
+        return;
+      }
+      records_.push_back(std::move(record));
+      records_ready_.notify_one();
+    }
+  }
+
+  // Stops the read ahead thread, if any.
+  void StopReadAhead() {
+    if (thread_ == nullptr) return;
+    {
+      tensorflow::mutex_lock lock(mu_);
+      cancelled_ = true;
+    }
+    space_ready_.notify_all();
+
+    // Deleting the thread waits for it to finish.
+    thread_.reset();
+  }
+
+  string filename_;
+  DocumentFormat *format_;  // not owned
+  const size_t read_ahead_;
+  std::unique_ptr<tensorflow::RandomAccessFile>
+      file_;  // must outlive buffer_, stream_
+  std::unique_ptr<tensorflow::io::RandomAccessInputStream>
+      stream_;  // Must outlive buffer_
+  std::unique_ptr<tensorflow::io::BufferedInputStream> buffer_;
+
+  // Read ahead thread and queue.
+  std::unique_ptr<tensorflow::Thread> thread_;
+  tensorflow::mutex mu_;
+  tensorflow::condition_variable records_ready_;
+  tensorflow::condition_variable space_ready_;
+  std::deque<string> records_ GUARDED_BY(mu_);
+  bool end_of_file_ GUARDED_BY(mu_) = false;
+  bool cancelled_ GUARDED_BY(mu_) = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(TextRecordStream);
+};
+
+// Reads sentence protos from text files. The input can have several parts,
+// and the file pattern of each part can contain wildcards. The records of
+// multiple files are interleaved round-robin, with each file read ahead in
+// parallel on its own thread. At most kMaxActiveStreams files are open at
+// once; when one of them ends, the next file of the input takes its place.
 class TextReader {
  public:
+  // Number of records read ahead for each file of a multi-file input.
+  static const int kReadAheadRecords = 256;
+
+  // Maximum number of files that are open and read ahead at the same time.
+  static const int kMaxActiveStreams = 16;
+
   explicit TextReader(const TaskInput &input, TaskContext *context) {
     CHECK_EQ(input.record_format_size(), 1)
         << "TextReader only supports inputs with one record format: "
         << input.DebugString();
-    CHECK_EQ(input.part_size(), 1)
-        << "TextReader only supports inputs with one part: "
-        << input.DebugString();
-    filename_ = TaskContext::InputFile(input);
+    CHECK_GE(input.part_size(), 1)
+        << "TextReader requires at least one part: " << input.DebugString();
+    for (const TaskInput::Part &part : input.part()) {
+      for (const string &filename : MatchingFiles(part.file_pattern())) {
+        filenames_.push_back(filename);
+      }
+    }
+    const int read_ahead = filenames_.size() > 1 ? kReadAheadRecords : 0;
+    const int num_slots =
+        std::min<int>(filenames_.size(), kMaxActiveStreams);
+    for (int i = 0; i < num_slots; ++i) {
+      stream_formats_.emplace_back(
+          DocumentFormat::Create(input.record_format(0)));
+      stream_formats_.back()->Setup(context);
+      streams_.emplace_back(
+          new TextRecordStream(stream_formats_.back().get(), read_ahead));
+    }
+    stream_files_.resize(num_slots);
     format_.reset(DocumentFormat::Create(input.record_format(0)));
     format_->Setup(context);
     Reset();
@@ -163,8 +315,10 @@ class TextReader {
     // commented out blocks.
     std::vector<Sentence *> sentences;
     string key, value;
-    while (sentences.empty() && format_->ReadRecord(buffer_.get(), &value)) {
-      key = tensorflow::strings::StrCat(filename_, ":", sentence_count_);
+    int stream = 0;
+    while (sentences.empty() && ReadRecord(&value, &stream)) {
+      key = tensorflow::strings::StrCat(filename(stream), ":",
+                                        sentence_counts_[stream]);
       format_->ConvertFromString(key, value, &sentences);
       CHECK_LE(sentences.size(), 1);
     }
@@ -172,37 +326,86 @@ class TextReader {
       // End of file reached.
       return nullptr;
     } else {
-      ++sentence_count_;
+      ++sentence_counts_[stream];
       return sentences[0];
     }
   }
 
+  // Reads the next record of the input without converting it, and returns
+  // false at end of file. If stream is not null, it is set to the index of
+  // the file the record was read from.
+  bool ReadRecord(string *record, int *stream = nullptr) {
+    while (!active_streams_.empty()) {
+      if (next_stream_ >= active_streams_.size()) next_stream_ = 0;
+      const int index = active_streams_[next_stream_];
+      if (streams_[index]->ReadRecord(record)) {
+        ++next_stream_;
+        if (stream != nullptr) *stream = stream_files_[index];
+        return true;
+      }
+
+      // The file has ended, so the stream goes on with the next file of the
+      // input, or is closed if there are none left.
+      if (next_file_ < filenames_.size()) {
+        stream_files_[index] = next_file_;
+        streams_[index]->Open(filenames_[next_file_++]);
+      } else {
+        streams_[index]->Close();
+        active_streams_.erase(active_streams_.begin() + next_stream_);
+      }
+    }
+    return false;
+  }
+
   void Reset() {
-    sentence_count_ = 0;
-    if (filename_ == "-") {
-      static const int kInputBufferSize = 8 * 1024; /* bytes */
-      file_.reset(new StdIn());
-      stream_.reset(new tensorflow::io::RandomAccessInputStream(file_.get()));
-      buffer_.reset(new tensorflow::io::BufferedInputStream(file_.get(),
-                                                            kInputBufferSize));
-    } else {
-      static const int kInputBufferSize = 1 * 1024 * 1024; /* bytes */
-      TF_CHECK_OK(
-          tensorflow::Env::Default()->NewRandomAccessFile(filename_, &file_));
-      stream_.reset(new tensorflow::io::RandomAccessInputStream(file_.get()));
-      buffer_.reset(new tensorflow::io::BufferedInputStream(file_.get(),
-                                                            kInputBufferSize));
+    active_streams_.clear();
+    next_file_ = 0;
+    for (size_t i = 0; i < streams_.size(); ++i) {
+      stream_files_[i] = next_file_;
+      streams_[i]->Open(filenames_[next_file_++]);
+      active_streams_.push_back(i);
     }
+    next_stream_ = 0;
+    sentence_counts_.assign(filenames_.size(), 0);
   }
 
+  // Returns the number of files of the input, and their names. Records are
+  // identified by the index of their file as "stream".
+  int num_streams() const { return filenames_.size(); }
+  const string &filename(int stream) const { return filenames_[stream]; }
+
  private:
-  string filename_;
-  int sentence_count_ = 0;
-  std::unique_ptr<tensorflow::RandomAccessFile>
-      file_;  // must outlive buffer_, stream_
-  std::unique_ptr<tensorflow::io::RandomAccessInputStream>
-      stream_;  // Must outlive buffer_
-  std::unique_ptr<tensorflow::io::BufferedInputStream> buffer_;
+  // Returns the files matching a file pattern in sorted order. Patterns
+  // without wildcards are returned as is, so "-" still reads from stdin.
+  static std::vector<string> MatchingFiles(const string &pattern) {
+    if (pattern.find_first_of("*?[") == string::npos) return {pattern};
+    std::vector<string> filenames;
+    TF_CHECK_OK(
+        tensorflow::Env::Default()->GetMatchingPaths(pattern, &filenames));
+    CHECK(!filenames.empty()) << "No files match " << pattern;
+    std::sort(filenames.begin(), filenames.end());
+    return filenames;
+  }
+
+  // All files of the input, and the index of the next one to open.
+  std::vector<string> filenames_;
+  size_t next_file_ = 0;
+
+  // Streams reading up to kMaxActiveStreams files at once, with their formats
+  // for reading records and the index of the file each one is reading.
+  std::vector<std::unique_ptr<DocumentFormat>> stream_formats_;
+  std::vector<std::unique_ptr<TextRecordStream>> streams_;
+  std::vector<int> stream_files_;
+
+  // Streams that have not reached end of file, and the position of the next
+  // one to read from.
+  std::vector<int> active_streams_;
+  size_t next_stream_ = 0;
+
+  // Number of sentences read from each file, used for keys.
+  std::vector<int> sentence_counts_;
+
+  // Format for converting records.
   std::unique_ptr<DocumentFormat> format_;
 };
 
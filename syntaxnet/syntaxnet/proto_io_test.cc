@@ -0,0 +1,179 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "syntaxnet/proto_io.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "syntaxnet/base.h"
+#include "syntaxnet/sentence.pb.h"
+#include "syntaxnet/task_context.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace syntaxnet {
+namespace {
+
+class TextReaderTest : public ::testing::Test {
+ protected:
+  // Writes a file with one single-token sentence per word, and returns its
+  // name.
+  string WriteCorpus(const string &name, const std::vector<string> &words) {
+    string corpus;
+    for (const string &word : words) {
+      tensorflow::strings::StrAppend(&corpus, "1\t", word,
+                                     "\t_\tX\tX\t_\t0\tROOT\t_\t_\n\n");
+    }
+    const string filename =
+        tensorflow::strings::StrCat(tensorflow::testing::TmpDir(), "/", name);
+    TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(),
+                                              filename, corpus));
+    return filename;
+  }
+
+  // Adds a part with the given file pattern to the corpus input.
+  void AddPart(const string &file_pattern) {
+    TaskInput *input = context_.GetInput("documents");
+    if (input->record_format_size() == 0) {
+      input->add_record_format("conll-sentence");
+    }
+    input->add_part()->set_file_pattern(file_pattern);
+  }
+
+  // Reads all sentences, as "docid word" strings.
+  std::vector<string> ReadAll(TextReader *reader) {
+    std::vector<string> sentences;
+    while (true) {
+      std::unique_ptr<Sentence> sentence(reader->Read());
+      if (sentence == nullptr) break;
+      sentences.push_back(tensorflow::strings::StrCat(sentence->docid(), " ",
+                                                      sentence->text()));
+    }
+    return sentences;
+  }
+
+  TaskContext context_;
+};
+
+TEST_F(TextReaderTest, ReadsSingleFile) {
+  const string filename = WriteCorpus("single", {"a", "b"});
+  AddPart(filename);
+  TextReader reader(*context_.GetInput("documents"), &context_);
+  EXPECT_EQ(1, reader.num_streams());
+  const std::vector<string> expected = {
+      tensorflow::strings::StrCat(filename, ":0 a"),
+      tensorflow::strings::StrCat(filename, ":1 b"),
+  };
+  EXPECT_EQ(expected, ReadAll(&reader));
+}
+
+TEST_F(TextReaderTest, InterleavesPartsAndPatterns) {
+  const string first = WriteCorpus("multi-1", {"a1", "a2", "a3"});
+  const string second = WriteCorpus("multi-2", {"b1"});
+  const string third = WriteCorpus("other", {"c1", "c2"});
+  AddPart(tensorflow::strings::StrCat(tensorflow::testing::TmpDir(),
+                                      "/multi-*"));
+  AddPart(third);
+  TextReader reader(*context_.GetInput("documents"), &context_);
+  ASSERT_EQ(3, reader.num_streams());
+  EXPECT_EQ(first, reader.filename(0));
+  EXPECT_EQ(second, reader.filename(1));
+  EXPECT_EQ(third, reader.filename(2));
+
+  // Files are read round-robin, and keys count the sentences of each file.
+  const std::vector<string> expected = {
+      tensorflow::strings::StrCat(first, ":0 a1"),
+      tensorflow::strings::StrCat(second, ":0 b1"),
+      tensorflow::strings::StrCat(third, ":0 c1"),
+      tensorflow::strings::StrCat(first, ":1 a2"),
+      tensorflow::strings::StrCat(third, ":1 c2"),
+      tensorflow::strings::StrCat(first, ":2 a3"),
+  };
+  EXPECT_EQ(expected, ReadAll(&reader));
+  EXPECT_EQ(nullptr, reader.Read());
+
+  reader.Reset();
+  EXPECT_EQ(expected, ReadAll(&reader));
+}
+
+TEST_F(TextReaderTest, ReadsLargeFilesInParallel) {
+  // Enough sentences to fill the read ahead queues several times.
+  std::vector<string> words;
+  for (int i = 0; i < 5 * TextReader::kReadAheadRecords; ++i) {
+    words.push_back(tensorflow::strings::StrCat("w", i));
+  }
+  AddPart(WriteCorpus("large-1", words));
+  AddPart(WriteCorpus("large-2", words));
+  TextReader reader(*context_.GetInput("documents"), &context_);
+  const std::vector<string> sentences = ReadAll(&reader);
+  ASSERT_EQ(2 * words.size(), sentences.size());
+  for (size_t i = 0; i < words.size(); ++i) {
+    EXPECT_EQ(tensorflow::strings::StrCat(reader.filename(0), ":", i, " ",
+                                          words[i]),
+              sentences[2 * i]);
+    EXPECT_EQ(tensorflow::strings::StrCat(reader.filename(1), ":", i, " ",
+                                          words[i]),
+              sentences[2 * i + 1]);
+  }
+}
+
+TEST_F(TextReaderTest, ReadsMoreFilesThanActiveStreams) {
+  // Each file is read in full and in order, with only a bounded number of
+  // files open at once.
+  const int num_files = 2 * TextReader::kMaxActiveStreams + 3;
+  for (int i = 0; i < num_files; ++i) {
+    WriteCorpus(tensorflow::strings::StrCat("many-", 100 + i),
+                {tensorflow::strings::StrCat("x", i),
+                 tensorflow::strings::StrCat("y", i)});
+  }
+  AddPart(tensorflow::strings::StrCat(tensorflow::testing::TmpDir(),
+                                      "/many-*"));
+  TextReader reader(*context_.GetInput("documents"), &context_);
+  ASSERT_EQ(num_files, reader.num_streams());
+
+  std::vector<string> expected;
+  for (int i = 0; i < num_files; ++i) {
+    expected.push_back(
+        tensorflow::strings::StrCat(reader.filename(i), ":0 x", i));
+    expected.push_back(
+        tensorflow::strings::StrCat(reader.filename(i), ":1 y", i));
+  }
+  std::vector<string> sentences = ReadAll(&reader);
+
+  // The first sentences come from the first files, which are opened first.
+  ASSERT_EQ(expected.size(), sentences.size());
+  for (int i = 0; i < TextReader::kMaxActiveStreams; ++i) {
+    EXPECT_EQ(expected[2 * i], sentences[i]);
+  }
+
+  // The second sentence of each file comes after its first.
+  for (int i = 0; i < num_files; ++i) {
+    const auto first =
+        std::find(sentences.begin(), sentences.end(), expected[2 * i]);
+    const auto second =
+        std::find(sentences.begin(), sentences.end(), expected[2 * i + 1]);
+    EXPECT_LT(first, second);
+  }
+  std::sort(sentences.begin(), sentences.end());
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(expected, sentences);
+}
+
+}  // namespace
+}  // namespace syntaxnet
@@ -14,6 +14,7 @@ limitations under the License.
 ==============================================================================*/
 
 #include <math.h>
+#include <algorithm>
 #include <deque>
 #include <memory>
 #include <string>
@@ -21,6 +22,7 @@ limitations under the License.
 #include <vector>
 
 #include "syntaxnet/base.h"
+#include "syntaxnet/embedding_feature_extractor.h"
 #include "syntaxnet/feature_extractor.h"
 #include "syntaxnet/parser_state.h"
 #include "syntaxnet/parser_transitions.h"
@@ -58,13 +60,27 @@ namespace syntaxnet {
 
 class ParsingReader : public OpKernel {
  public:
-  explicit ParsingReader(OpKernelConstruction *context) : OpKernel(context) {
+  // If dense_features is true, features are output as flat tensors of indices,
+  // ids and weights instead of serialized SparseFeatures protos.
+  ParsingReader(OpKernelConstruction *context, bool dense_features)
+      : OpKernel(context), dense_features_(dense_features) {
     string file_path, corpus_name;
     OP_REQUIRES_OK(context, context->GetAttr("task_context", &file_path));
     OP_REQUIRES_OK(context, context->GetAttr("feature_size", &feature_size_));
     OP_REQUIRES_OK(context, context->GetAttr("batch_size", &max_batch_size_));
     OP_REQUIRES_OK(context, context->GetAttr("corpus_name", &corpus_name));
     OP_REQUIRES_OK(context, context->GetAttr("arg_prefix", &arg_prefix_));
+    PrefetchOptions prefetch_options;
+    OP_REQUIRES_OK(context, context->GetAttr("prefetch_depth",
+                                             &prefetch_options.prefetch_depth));
+    OP_REQUIRES_OK(context, context->GetAttr("num_parse_threads",
+                                             &prefetch_options.num_threads));
+    OP_REQUIRES_OK(context, context->GetAttr("deterministic_order",
+                                             &prefetch_options.deterministic));
+    OP_REQUIRES(context, prefetch_options.prefetch_depth >= 0,
+                InvalidArgument("prefetch_depth must be non-negative"));
+    OP_REQUIRES(context, prefetch_options.num_threads >= 1,
+                InvalidArgument("num_parse_threads must be positive"));
 
     // Reads task context from file.
     string data;
@@ -76,7 +92,7 @@ class ParsingReader : public OpKernel {
 
     // Set up the batch reader.
     sentence_batch_.reset(
-        new SentenceBatch(max_batch_size_, corpus_name));
+        new SentenceBatch(max_batch_size_, corpus_name, prefetch_options));
     sentence_batch_->Init(&task_context_);
 
     // Set up the parsing features and transition system.
@@ -142,41 +158,18 @@ class ParsingReader : public OpKernel {
       for (int i = 0; i < max_batch_size_; ++i) AdvanceSentence(i);
     }
 
-    // Create the outputs for each feature space.
-    std::vector<Tensor *> feature_outputs(features_->NumEmbeddings());
-    for (size_t i = 0; i < feature_outputs.size(); ++i) {
-      OP_REQUIRES_OK(context, context->allocate_output(
-                                  i, TensorShape({sentence_batch_->size(),
-                                                  features_->FeatureSize(i)}),
-                                  &feature_outputs[i]));
-    }
-
-    // Populate feature outputs.
-    for (int i = 0, index = 0; i < max_batch_size_; ++i) {
-      if (states_[i] == nullptr) continue;
-
-      // Extract features from the current parser state, and fill up the
-      // available batch slots.
-      std::vector<std::vector<SparseFeatures>> features =
-          features_->ExtractSparseFeatures(workspaces_[i], *states_[i]);
-
-      for (size_t feature_space = 0; feature_space < features.size();
-           ++feature_space) {
-        int feature_size = features[feature_space].size();
-        CHECK(feature_size == features_->FeatureSize(feature_space));
-        auto features_output = feature_outputs[feature_space]->matrix<string>();
-        for (int k = 0; k < feature_size; ++k) {
-          features_output(index, k) =
-              features[feature_space][k].SerializeAsString();
-        }
-      }
-      ++index;
+    // Output the features of the current parser states.
+    if (dense_features_) {
+      OP_REQUIRES_OK(context, PopulateDenseFeatureOutputs(context));
+    } else {
+      OP_REQUIRES_OK(context, PopulateFeatureOutputs(context));
     }
 
     // Return the number of epochs.
     Tensor *epoch_output;
-    OP_REQUIRES_OK(context, context->allocate_output(
-                                feature_size_, TensorShape({}), &epoch_output));
+    OP_REQUIRES_OK(context,
+                   context->allocate_output(num_feature_outputs(),
+                                            TensorShape({}), &epoch_output));
     auto num_epochs = epoch_output->scalar<int32>();
     num_epochs() = num_epochs_;
 
@@ -194,7 +187,14 @@ class ParsingReader : public OpKernel {
 
   // Returns the output type specification of the this base class.
   std::vector<DataType> default_outputs() const {
-    std::vector<DataType> output_types(feature_size_, DT_STRING);
+    std::vector<DataType> output_types;
+    if (dense_features_) {
+      output_types.insert(output_types.end(), feature_size_, DT_INT32);
+      output_types.insert(output_types.end(), feature_size_, DT_INT64);
+      output_types.insert(output_types.end(), feature_size_, DT_FLOAT);
+    } else {
+      output_types.insert(output_types.end(), feature_size_, DT_STRING);
+    }
     output_types.push_back(DT_INT32);
     return output_types;
   }
@@ -202,7 +202,10 @@ class ParsingReader : public OpKernel {
   // Accessors.
   int max_batch_size() const { return max_batch_size_; }
   int batch_size() const { return sentence_batch_->size(); }
-  int additional_output_index() const { return feature_size_ + 1; }
+  int num_feature_outputs() const {
+    return dense_features_ ? 3 * feature_size_ : feature_size_;
+  }
+  int additional_output_index() const { return num_feature_outputs() + 1; }
   ParserState *state(int i) const { return states_[i].get(); }
   const ParserTransitionSystem &transition_system() const {
     return *transition_system_;
@@ -214,12 +217,90 @@ class ParsingReader : public OpKernel {
   const string &arg_prefix() const { return arg_prefix_; }
 
  private:
+  // Outputs one matrix of serialized SparseFeatures per feature space, with
+  // one row per state in the batch.
+  tensorflow::Status PopulateFeatureOutputs(OpKernelContext *context) {
+    std::vector<Tensor *> feature_outputs(features_->NumEmbeddings());
+    for (size_t i = 0; i < feature_outputs.size(); ++i) {
+      TF_RETURN_IF_ERROR(context->allocate_output(
+          i, TensorShape({sentence_batch_->size(), features_->FeatureSize(i)}),
+          &feature_outputs[i]));
+    }
+
+    for (int i = 0, index = 0; i < max_batch_size_; ++i) {
+      if (states_[i] == nullptr) continue;
+
+      // Extract features from the current parser state, and fill up the
+      // available batch slots.
+      std::vector<std::vector<SparseFeatures>> features =
+          features_->ExtractSparseFeatures(workspaces_[i], *states_[i]);
+
+      for (size_t feature_space = 0; feature_space < features.size();
+           ++feature_space) {
+        int feature_size = features[feature_space].size();
+        CHECK(feature_size == features_->FeatureSize(feature_space));
+        auto features_output = feature_outputs[feature_space]->matrix<string>();
+        for (int k = 0; k < feature_size; ++k) {
+          features_output(index, k) =
+              features[feature_space][k].SerializeAsString();
+        }
+      }
+      ++index;
+    }
+    return tensorflow::Status::OK();
+  }
+
+  // Outputs the indices, ids and weights of the features of each feature
+  // space, as UnpackSparseFeatures would unpack the flattened SparseFeatures
+  // matrix of that space.
+  tensorflow::Status PopulateDenseFeatureOutputs(OpKernelContext *context) {
+    dense_features_buffer_.resize(features_->NumEmbeddings());
+    for (DenseFeatures &features : dense_features_buffer_) features.Clear();
+    for (int i = 0, index = 0; i < max_batch_size_; ++i) {
+      if (states_[i] == nullptr) continue;
+      features_->ExtractDenseFeatures(workspaces_[i], *states_[i], index,
+                                      &dense_features_buffer_);
+      ++index;
+    }
+    return OutputDenseFeatures(dense_features_buffer_, context);
+  }
+
+  // Copies dense features to newly allocated outputs. The indices, ids and
+  // weights of feature space i are written to outputs i, num_spaces + i and
+  // 2 * num_spaces + i respectively.
+  static tensorflow::Status OutputDenseFeatures(
+      const std::vector<DenseFeatures> &features, OpKernelContext *context) {
+    const int num_spaces = features.size();
+    for (int i = 0; i < num_spaces; ++i) {
+      const DenseFeatures &f = features[i];
+      Tensor *output;
+      TF_RETURN_IF_ERROR(
+          context->allocate_output(i, TensorShape({f.size()}), &output));
+      std::copy(f.indices.begin(), f.indices.end(),
+                output->vec<int32>().data());
+      TF_RETURN_IF_ERROR(context->allocate_output(
+          num_spaces + i, TensorShape({f.size()}), &output));
+      std::copy(f.ids.begin(), f.ids.end(), output->vec<int64>().data());
+      TF_RETURN_IF_ERROR(context->allocate_output(
+          2 * num_spaces + i, TensorShape({f.size()}), &output));
+      std::copy(f.weights.begin(), f.weights.end(),
+                output->vec<float>().data());
+    }
+    return tensorflow::Status::OK();
+  }
+
   // Task context used to configure this op.
   TaskContext task_context_;
 
   // Prefix for context parameters.
   string arg_prefix_;
 
+  // Whether features are output in dense form.
+  const bool dense_features_;
+
+  // Dense features of the batch, reused across steps.
+  std::vector<DenseFeatures> dense_features_buffer_;
+
   // mutex to synchronize access to Compute.
   mutex mu_;
 
@@ -258,8 +339,9 @@ class ParsingReader : public OpKernel {
 
 class GoldParseReader : public ParsingReader {
  public:
-  explicit GoldParseReader(OpKernelConstruction *context)
-      : ParsingReader(context) {
+  explicit GoldParseReader(OpKernelConstruction *context,
+                           bool dense_features = false)
+      : ParsingReader(context, dense_features) {
     // Sets up number and type of inputs and outputs.
     std::vector<DataType> output_types = default_outputs();
     output_types.push_back(DT_INT32);
@@ -301,6 +383,16 @@ class GoldParseReader : public ParsingReader {
 REGISTER_KERNEL_BUILDER(Name("GoldParseReader").Device(DEVICE_CPU),
                         GoldParseReader);
 
+// GoldParseReader that outputs features in dense form.
+class DenseGoldParseReader : public GoldParseReader {
+ public:
+  explicit DenseGoldParseReader(OpKernelConstruction *context)
+      : GoldParseReader(context, true) {}
+};
+
+REGISTER_KERNEL_BUILDER(Name("DenseGoldParseReader").Device(DEVICE_CPU),
+                        DenseGoldParseReader);
+
 // DecodedParseReader parses sentences using transition scores computed
 // by a TensorFlow network. This op additionally computes a token correctness
 // evaluation metric which can be used to select hyperparameter settings and
@@ -318,8 +410,9 @@ REGISTER_KERNEL_BUILDER(Name("GoldParseReader").Device(DEVICE_CPU),
 //   - '': scores all tokens.
 class DecodedParseReader : public ParsingReader {
  public:
-  explicit DecodedParseReader(OpKernelConstruction *context)
-      : ParsingReader(context) {
+  explicit DecodedParseReader(OpKernelConstruction *context,
+                              bool dense_features = false)
+      : ParsingReader(context, dense_features) {
     // Sets up number and type of inputs and outputs.
     std::vector<DataType> output_types = default_outputs();
     output_types.push_back(DT_INT32);
@@ -435,6 +528,16 @@ class DecodedParseReader : public ParsingReader {
 REGISTER_KERNEL_BUILDER(Name("DecodedParseReader").Device(DEVICE_CPU),
                         DecodedParseReader);
 
+// DecodedParseReader that outputs features in dense form.
+class DenseDecodedParseReader : public DecodedParseReader {
+ public:
+  explicit DenseDecodedParseReader(OpKernelConstruction *context)
+      : DecodedParseReader(context, true) {}
+};
+
+REGISTER_KERNEL_BUILDER(Name("DenseDecodedParseReader").Device(DEVICE_CPU),
+                        DenseDecodedParseReader);
+
 class WordEmbeddingInitializer : public OpKernel {
  public:
   explicit WordEmbeddingInitializer(OpKernelConstruction *context)
@@ -126,6 +126,39 @@ class ParsingReaderOpsTest(test_util.TensorFlowTestCase):
                  num_steps_a, num_steps_b)
     self.assertEqual(num_steps_a, num_steps_b)
 
+  def testDenseParsingReaderOp(self):
+    # Runs the sparse and dense readers side by side and checks that the dense
+    # features are the unpacked sparse features.
+    feature_size = 3
+    batch_size = 10
+    with self.test_session() as sess:
+      sparse_features, sparse_epochs, sparse_actions = (
+          gen_parser_ops.gold_parse_reader(self._task_context,
+                                           feature_size,
+                                           batch_size,
+                                           corpus_name='training-corpus'))
+      unpacked = [gen_parser_ops.unpack_sparse_features(tf.reshape(f, [-1]))
+                  for f in sparse_features]
+      (indices, ids, weights, dense_epochs, dense_actions) = (
+          gen_parser_ops.dense_gold_parse_reader(self._task_context,
+                                                 feature_size,
+                                                 batch_size,
+                                                 corpus_name='training-corpus'))
+      while True:
+        tf_unpacked, tf_sparse_actions, tf_epochs = sess.run(
+            [unpacked, sparse_actions, sparse_epochs])
+        (tf_indices, tf_ids, tf_weights, tf_dense_actions,
+         tf_dense_epochs) = sess.run(
+             [indices, ids, weights, dense_actions, dense_epochs])
+        self.assertAllEqual(tf_sparse_actions, tf_dense_actions)
+        self.assertEqual(tf_epochs, tf_dense_epochs)
+        for i in range(feature_size):
+          self.assertAllEqual(tf_unpacked[i][0], tf_indices[i])
+          self.assertAllEqual(tf_unpacked[i][1], tf_ids[i])
+          self.assertAllEqual(tf_unpacked[i][2], tf_weights[i])
+        if tf_epochs > 1:
+          break
+
   def testParsingReaderOpWhileLoop(self):
     feature_size = 3
     batch_size = 5
@@ -24,7 +24,8 @@ limitations under the License.
 namespace syntaxnet {
 
 void SentenceBatch::Init(TaskContext *context) {
-  reader_.reset(new TextReader(*context->GetInput(input_name_), context));
+  reader_.reset(new SentencePrefetcher(*context->GetInput(input_name_),
+                                       context, prefetch_options_));
   size_ = 0;
 }
 
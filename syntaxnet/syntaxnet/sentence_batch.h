@@ -26,6 +26,7 @@ limitations under the License.
 #include "syntaxnet/parser_state.h"
 #include "syntaxnet/parser_transitions.h"
 #include "syntaxnet/sentence.pb.h"
+#include "syntaxnet/sentence_prefetcher.h"
 #include "syntaxnet/sparse.pb.h"
 #include "syntaxnet/task_context.h"
 #include "syntaxnet/task_spec.pb.h"
@@ -37,9 +38,11 @@ namespace syntaxnet {
 // by reading in multiple sentences in parallel.
 class SentenceBatch {
  public:
-  SentenceBatch(int batch_size, string input_name)
+  SentenceBatch(int batch_size, string input_name,
+                const PrefetchOptions &prefetch_options = PrefetchOptions())
       : batch_size_(batch_size),
         input_name_(std::move(input_name)),
+        prefetch_options_(prefetch_options),
         sentences_(batch_size) {}
 
   // Initializes all resources and opens the corpus file.
@@ -67,8 +70,11 @@ class SentenceBatch {
   // Input to read from the TaskContext.
   string input_name_;
 
+  // Options for reading ahead in the corpus.
+  PrefetchOptions prefetch_options_;
+
   // Reader for the corpus.
-  std::unique_ptr<TextReader> reader_;
+  std::unique_ptr<SentencePrefetcher> reader_;
 
   // Batch: Sentence objects.
   std::vector<std::unique_ptr<Sentence>> sentences_;
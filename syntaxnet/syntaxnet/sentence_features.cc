@@ -106,15 +106,35 @@ void CharNgram::GetTokenIndices(const Token &token,
   if (use_terminators_) char_sp.push_back("^");
   GetUTF8Chars(token.word(), &char_sp);
   if (use_terminators_) char_sp.push_back("$");
-  for (int start = 0; start < char_sp.size(); ++start) {
-    string char_ngram;
-    for (int index = 0;
-         index < max_char_ngram_length_ && start + index < char_sp.size();
-         ++index) {
-      tensorflow::StringPiece c = char_sp[start + index];
-      if (c == " ") break;  // Never add char ngrams containing spaces.
-      tensorflow::strings::StrAppend(&char_ngram, c);
-      int value = LookupIndex(char_ngram);
+  const int size = char_sp.size();
+
+  // Ngrams of the word itself are looked up as pieces of the word. Only the
+  // ngrams with terminators, which are not part of the word, are copied.
+  string char_ngram;
+  for (int start = 0; start < size; ++start) {
+    for (int end = start; end < size && end - start < max_char_ngram_length_;
+         ++end) {
+      if (char_sp[end] == " ") break;  // Never add char ngrams with spaces.
+      const bool prefix = use_terminators_ && start == 0;
+      const bool suffix = use_terminators_ && end == size - 1;
+      const int first = prefix ? start + 1 : start;
+      const int last = suffix ? end - 1 : end;
+      tensorflow::StringPiece chars;
+      if (first <= last) {
+        const char *data = char_sp[first].data();
+        chars = tensorflow::StringPiece(
+            data, char_sp[last].data() + char_sp[last].size() - data);
+      }
+      int value;
+      if (prefix || suffix) {
+        char_ngram.clear();
+        if (prefix) char_ngram.push_back('^');
+        char_ngram.append(chars.data(), chars.size());
+        if (suffix) char_ngram.push_back('$');
+        value = LookupIndex(char_ngram);
+      } else {
+        value = LookupIndex(chars);
+      }
       if (value != -1) {  // Skip unknown values.
         values->push_back(value);
       }
@@ -127,9 +147,11 @@ void MorphologySet::GetTokenIndices(const Token &token,
   values->clear();
   const TokenMorphology &token_morphology =
       token.GetExtension(TokenMorphology::morphology);
+  string name_value;
   for (const TokenMorphology::Attribute &att : token_morphology.attribute()) {
-    int value =
-        LookupIndex(tensorflow::strings::StrCat(att.name(), "=", att.value()));
+    name_value.clear();
+    tensorflow::strings::StrAppend(&name_value, att.name(), "=", att.value());
+    int value = LookupIndex(name_value);
     if (value != -1) {  // Skip unknown values.
       values->push_back(value);
     }
@@ -254,7 +254,7 @@ class TermFrequencyMapSetFeature : public TokenLookupSetFeature {
 
   // Returns the term index or the unknown value. Used inside GetTokenIndex()
   // specializations for convenience.
-  int LookupIndex(const string &term) const {
+  int LookupIndex(tensorflow::StringPiece term) const {
     return term_map_->LookupIndex(term, -1);
   }
 
@@ -0,0 +1,174 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "syntaxnet/sentence_prefetcher.h"
+
+#include "tensorflow/core/lib/strings/strcat.h"
+
+namespace syntaxnet {
+
+SentencePrefetcher::SentencePrefetcher(const TaskInput &input,
+                                       TaskContext *context,
+                                       const PrefetchOptions &options)
+    : options_(options) {
+  CHECK_GE(options_.prefetch_depth, 0);
+  CHECK_GE(options_.num_threads, 1);
+  reader_.reset(new TextReader(input, context));
+  sentence_counts_.assign(reader_->num_streams(), 0);
+  if (options_.prefetch_depth > 0) {
+    for (int i = 0; i < options_.num_threads; ++i) {
+      formats_.emplace_back(DocumentFormat::Create(input.record_format(0)));
+      formats_.back()->Setup(context);
+    }
+    StartThreads();
+  }
+}
+
+SentencePrefetcher::~SentencePrefetcher() { StopThreads(); }
+
+Sentence *SentencePrefetcher::Read() {
+  if (options_.prefetch_depth == 0) return reader_->Read();
+  tensorflow::mutex_lock lock(mu_);
+  while (true) {
+    // In deterministic mode, the next record is the first one not consumed.
+    auto next = results_.begin();
+    const bool ready =
+        next != results_.end() &&
+        (!options_.deterministic || next->first == num_consumed_);
+    if (!ready) {
+      if (end_of_input_ && num_consumed_ == num_read_) return nullptr;
+      results_ready_.wait(lock);
+      continue;
+    }
+    const int stream = next->second.stream;
+    std::unique_ptr<Sentence> sentence = std::move(next->second.sentence);
+    results_.erase(next);
+    ++num_consumed_;
+    space_ready_.notify_one();
+
+    // Skips records without a sentence, e.g., blank lines at the beginning of
+    // a file or commented out blocks.
+    if (sentence == nullptr) continue;
+
+    // Document ids count the sentences returned so far, as in TextReader, so
+    // they can only be assigned once the sentences are taken in order.
+    sentence->set_docid(tensorflow::strings::StrCat(
+        reader_->filename(stream), ":", sentence_counts_[stream]++));
+    return sentence.release();
+  }
+}
+
+void SentencePrefetcher::Reset() {
+  if (options_.prefetch_depth == 0) {
+    reader_->Reset();
+    return;
+  }
+  StopThreads();
+  reader_->Reset();
+  sentence_counts_.assign(reader_->num_streams(), 0);
+  {
+    tensorflow::mutex_lock lock(mu_);
+    records_.clear();
+    results_.clear();
+    num_read_ = 0;
+    num_consumed_ = 0;
+    end_of_input_ = false;
+    cancelled_ = false;
+  }
+  StartThreads();
+}
+
+void SentencePrefetcher::StartThreads() {
+  tensorflow::Env *env = tensorflow::Env::Default();
+  threads_.emplace_back(env->StartThread(tensorflow::ThreadOptions(),
+                                         "sentence_reader",
+                                         [this]() { ReadLoop(); }));
+  for (const auto &format : formats_) {
+    DocumentFormat *thread_format = format.get();
+    threads_.emplace_back(env->StartThread(
+        tensorflow::ThreadOptions(), "sentence_converter",
+        [this, thread_format]() { ConvertLoop(thread_format); }));
+  }
+}
+
+void SentencePrefetcher::StopThreads() {
+  {
+    tensorflow::mutex_lock lock(mu_);
+    cancelled_ = true;
+  }
+  records_ready_.notify_all();
+  space_ready_.notify_all();
+
+  // Deleting a thread waits for it to finish.
+  threads_.clear();
+}
+
+void SentencePrefetcher::ReadLoop() {
+  while (true) {
+    {
+      tensorflow::mutex_lock lock(mu_);
+      while (!cancelled_ &&
+             num_read_ - num_consumed_ >= options_.prefetch_depth) {
+        space_ready_.wait(lock);
+      }
+      if (cancelled_) return;
+    }
+
+    // Only this thread uses the reader, so it is read without holding the
+    // lock.
+    Record record;
+    const bool has_record = reader_->ReadRecord(&record.value, &record.stream);
+
+    tensorflow::mutex_lock lock(mu_);
+    if (!has_record) {
+      end_of_input_ = true;
+      records_ready_.notify_all();
+      results_ready_.notify_all();
+      return;
+    }
+    records_.emplace_back(num_read_++, std::move(record));
+    records_ready_.notify_one();
+  }
+}
+
+void SentencePrefetcher::ConvertLoop(DocumentFormat *format) {
+  std::vector<Sentence *> sentences;
+  while (true) {
+    std::pair<int64, Record> record;
+    {
+      tensorflow::mutex_lock lock(mu_);
+      while (!cancelled_ && !end_of_input_ && records_.empty()) {
+        records_ready_.wait(lock);
+      }
+      if (cancelled_ || records_.empty()) return;
+      record = std::move(records_.front());
+      records_.pop_front();
+    }
+
+    // The document id is assigned by Read().
+    sentences.clear();
+    format->ConvertFromString(reader_->filename(record.second.stream),
+                              record.second.value, &sentences);
+    CHECK_LE(sentences.size(), 1);
+
+    tensorflow::mutex_lock lock(mu_);
+    Result &result = results_[record.first];
+    result.stream = record.second.stream;
+    result.sentence.reset(sentences.empty() ? nullptr : sentences[0]);
+    results_ready_.notify_one();
+  }
+}
+
+}  // namespace syntaxnet
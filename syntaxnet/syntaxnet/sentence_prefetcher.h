@@ -0,0 +1,150 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Corpus reader that reads and converts sentences ahead of their use on
+// background threads.
+
+#ifndef SYNTAXNET_SENTENCE_PREFETCHER_H_
+#define SYNTAXNET_SENTENCE_PREFETCHER_H_
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "syntaxnet/base.h"
+#include "syntaxnet/document_format.h"
+#include "syntaxnet/proto_io.h"
+#include "syntaxnet/sentence.pb.h"
+#include "syntaxnet/task_context.h"
+#include "syntaxnet/task_spec.pb.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+
+namespace syntaxnet {
+
+// Options for reading a corpus ahead of its use.
+struct PrefetchOptions {
+  // Maximum number of records read ahead of the consumer. If zero, sentences
+  // are read and converted synchronously on the calling thread.
+  int prefetch_depth = 0;
+
+  // Number of threads converting records into sentences.
+  int num_threads = 1;
+
+  // Whether sentences are returned in corpus order. Otherwise they are
+  // returned as soon as they are converted, which avoids waiting for slow
+  // records when the order does not matter.
+  bool deterministic = true;
+};
+
+// Reads sentences from a corpus like TextReader. With a non-zero prefetch
+// depth, one background thread reads the records of the corpus into a bounded
+// queue and a pool of threads, each with its own document format, converts
+// them into sentences. Read() then only waits for the next converted sentence.
+//
+// In deterministic mode, the sentences and their document ids are the same as
+// the ones returned by TextReader::Read().
+class SentencePrefetcher {
+ public:
+  SentencePrefetcher(const TaskInput &input, TaskContext *context,
+                     const PrefetchOptions &options);
+  ~SentencePrefetcher();
+
+  // Returns the next sentence of the corpus, or nullptr at end of file. The
+  // caller takes ownership of the sentence.
+  Sentence *Read();
+
+  // Rewinds to the beginning of the corpus, discarding prefetched sentences.
+  void Reset();
+
+ private:
+  // Starts and stops the background threads.
+  void StartThreads();
+  void StopThreads();
+
+  // Main loop of the thread reading records.
+  void ReadLoop();
+
+  // Main loop of a thread converting records with the given format.
+  void ConvertLoop(DocumentFormat *format);
+
+  // Options for prefetching.
+  const PrefetchOptions options_;
+
+  // Reader for the corpus. Only the reading thread reads records from it while
+  // the threads run, but file names can be looked up from any thread.
+  std::unique_ptr<TextReader> reader_;
+
+  // Document formats for converting records, one per thread.
+  std::vector<std::unique_ptr<DocumentFormat>> formats_;
+
+  // Number of sentences returned from each file since the last reset, used
+  // for generating document ids.
+  std::vector<int> sentence_counts_;
+
+  // Background threads.
+  std::vector<std::unique_ptr<tensorflow::Thread>> threads_;
+
+  tensorflow::mutex mu_;
+
+  // Signaled when records are added, or when the input is exhausted.
+  tensorflow::condition_variable records_ready_;
+
+  // Signaled when converted records are added.
+  tensorflow::condition_variable results_ready_;
+
+  // Signaled when the consumer takes a converted record.
+  tensorflow::condition_variable space_ready_;
+
+  // A record of the corpus, with the file it was read from.
+  struct Record {
+    int stream;
+    string value;
+  };
+
+  // A converted record, with the file it was read from. Records without a
+  // sentence are kept with a null sentence, so that the next position in the
+  // corpus is always known.
+  struct Result {
+    int stream;
+    std::unique_ptr<Sentence> sentence;
+  };
+
+  // Records waiting to be converted, with their position in the corpus.
+  std::deque<std::pair<int64, Record>> records_ GUARDED_BY(mu_);
+
+  // Converted records by position in the corpus.
+  std::map<int64, Result> results_ GUARDED_BY(mu_);
+
+  // Number of records read, and taken by the consumer, since the last reset.
+  int64 num_read_ GUARDED_BY(mu_) = 0;
+  int64 num_consumed_ GUARDED_BY(mu_) = 0;
+
+  // Whether all records of the corpus have been read.
+  bool end_of_input_ GUARDED_BY(mu_) = false;
+
+  // Whether the background threads should stop.
+  bool cancelled_ GUARDED_BY(mu_) = false;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(SentencePrefetcher);
+};
+
+}  // namespace syntaxnet
+
+#endif  // SYNTAXNET_SENTENCE_PREFETCHER_H_
@@ -0,0 +1,178 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "syntaxnet/sentence_prefetcher.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "syntaxnet/base.h"
+#include "syntaxnet/sentence.pb.h"
+#include "syntaxnet/task_context.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/test.h"
+
+namespace syntaxnet {
+namespace {
+
+const int kNumSentences = 500;
+
+class SentencePrefetcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // Writes a corpus of sentences with a varying number of tokens, with some
+    // records that do not contain any sentence.
+    string corpus = "# leading comment\n\n";
+    for (int i = 0; i < kNumSentences; ++i) {
+      for (int j = 1; j <= 1 + i % 7; ++j) {
+        tensorflow::strings::StrAppend(&corpus, j, "\tw", i, "_", j,
+                                       "\t_\tX\tX\t_\t0\tROOT\t_\t_\n");
+      }
+      corpus += i % 10 == 0 ? "\n# comment\n\n" : "\n";
+    }
+    const string filename =
+        tensorflow::strings::StrCat(tensorflow::testing::TmpDir(), "corpus");
+    TF_CHECK_OK(tensorflow::WriteStringToFile(tensorflow::Env::Default(),
+                                              filename, corpus));
+    TaskInput *input = context_.GetInput("documents");
+    input->add_record_format("conll-sentence");
+    input->add_part()->set_file_pattern(filename);
+  }
+
+  // Reads all sentences of the corpus, serialized, in the order returned.
+  std::vector<string> ReadAll(SentencePrefetcher *prefetcher) {
+    std::vector<string> sentences;
+    while (true) {
+      std::unique_ptr<Sentence> sentence(prefetcher->Read());
+      if (sentence == nullptr) break;
+      sentences.push_back(sentence->SerializeAsString());
+    }
+
+    // Reading past the end keeps returning nothing.
+    EXPECT_EQ(nullptr, prefetcher->Read());
+    return sentences;
+  }
+
+  std::vector<string> ReadAll(const PrefetchOptions &options) {
+    SentencePrefetcher prefetcher(*context_.GetInput("documents"), &context_,
+                                  options);
+    return ReadAll(&prefetcher);
+  }
+
+  TaskContext context_;
+};
+
+TEST_F(SentencePrefetcherTest, SynchronousReadsAllSentences) {
+  const std::vector<string> sentences = ReadAll(PrefetchOptions());
+  ASSERT_EQ(kNumSentences, sentences.size());
+  Sentence first;
+  ASSERT_TRUE(first.ParseFromString(sentences[0]));
+  EXPECT_EQ(tensorflow::strings::StrCat(tensorflow::testing::TmpDir(),
+                                        "corpus:0"),
+            first.docid());
+  EXPECT_EQ("w0_1", first.text());
+}
+
+TEST_F(SentencePrefetcherTest, DeterministicPrefetchingKeepsOrder) {
+  const std::vector<string> expected = ReadAll(PrefetchOptions());
+  for (int depth : {1, 4, 64}) {
+    for (int num_threads : {1, 3}) {
+      PrefetchOptions options;
+      options.prefetch_depth = depth;
+      options.num_threads = num_threads;
+      EXPECT_EQ(expected, ReadAll(options))
+          << "depth=" << depth << " threads=" << num_threads;
+    }
+  }
+}
+
+TEST_F(SentencePrefetcherTest, NonDeterministicPrefetchingReadsAll) {
+  PrefetchOptions options;
+  options.prefetch_depth = 16;
+  options.num_threads = 4;
+  options.deterministic = false;
+  SentencePrefetcher prefetcher(*context_.GetInput("documents"), &context_,
+                                options);
+  std::vector<string> texts;
+  std::vector<string> docids;
+  while (true) {
+    std::unique_ptr<Sentence> sentence(prefetcher.Read());
+    if (sentence == nullptr) break;
+    texts.push_back(sentence->text());
+    docids.push_back(sentence->docid());
+  }
+  ASSERT_EQ(kNumSentences, texts.size());
+
+  // The same sentences are read, and document ids are still numbered in the
+  // order the sentences are returned.
+  std::vector<string> expected_texts;
+  std::vector<string> expected_docids;
+  const string prefix =
+      tensorflow::strings::StrCat(tensorflow::testing::TmpDir(), "corpus:");
+  for (int i = 0; i < kNumSentences; ++i) {
+    string text;
+    for (int j = 1; j <= 1 + i % 7; ++j) {
+      tensorflow::strings::StrAppend(&text, j == 1 ? "" : " ", "w", i, "_", j);
+    }
+    expected_texts.push_back(text);
+    expected_docids.push_back(tensorflow::strings::StrCat(prefix, i));
+  }
+  std::sort(texts.begin(), texts.end());
+  std::sort(expected_texts.begin(), expected_texts.end());
+  EXPECT_EQ(expected_texts, texts);
+  EXPECT_EQ(expected_docids, docids);
+}
+
+TEST_F(SentencePrefetcherTest, MultiplePartsMatchTextReader) {
+  const string filename =
+      tensorflow::strings::StrCat(tensorflow::testing::TmpDir(), "corpus");
+  context_.GetInput("documents")->add_part()->set_file_pattern(filename);
+  TextReader reader(*context_.GetInput("documents"), &context_);
+  std::vector<string> expected;
+  while (true) {
+    std::unique_ptr<Sentence> sentence(reader.Read());
+    if (sentence == nullptr) break;
+    expected.push_back(sentence->SerializeAsString());
+  }
+  ASSERT_EQ(2 * kNumSentences, expected.size());
+  PrefetchOptions options;
+  options.prefetch_depth = 8;
+  options.num_threads = 3;
+  EXPECT_EQ(expected, ReadAll(options));
+}
+
+TEST_F(SentencePrefetcherTest, ResetRewindsCorpus) {
+  const std::vector<string> expected = ReadAll(PrefetchOptions());
+  PrefetchOptions options;
+  options.prefetch_depth = 8;
+  options.num_threads = 2;
+  SentencePrefetcher prefetcher(*context_.GetInput("documents"), &context_,
+                                options);
+
+  // Resets in the middle of the corpus, with sentences still in flight.
+  for (int i = 0; i < 10; ++i) delete prefetcher.Read();
+  prefetcher.Reset();
+  EXPECT_EQ(expected, ReadAll(&prefetcher));
+
+  // Resets at the end of the corpus.
+  prefetcher.Reset();
+  EXPECT_EQ(expected, ReadAll(&prefetcher));
+}
+
+}  // namespace
+}  // namespace syntaxnet
@@ -27,30 +27,93 @@ limitations under the License.
 
 namespace syntaxnet {
 
-int TermFrequencyMap::Increment(const string &term) {
-  CHECK_EQ(term_index_.size(), term_data_.size());
-  const TermIndex::const_iterator it = term_index_.find(term);
-  if (term_index_.find(term) != term_index_.end()) {
+namespace {
+
+// Seed for hashing terms.
+const uint32 kTermHashSeed = 0x7E12A5C3;
+
+// Minimum number of slots in a non-empty hashtable.
+const size_t kMinSlots = 16;
+
+}  // namespace
+
+int TermFrequencyMap::Increment(tensorflow::StringPiece term) {
+  return Increment(term, 1);
+}
+
+int TermFrequencyMap::Increment(tensorflow::StringPiece term, int64 count) {
+  if (slots_.empty()) Reserve(1);
+  const uint32 hash = Hash(term);
+  const size_t slot = FindSlot(term, hash);
+  const int index = slots_[slot].index;
+  if (index >= 0) {
     // Increment the existing term.
-    std::pair<string, int64> &data = term_data_[it->second];
-    CHECK_EQ(term, data.first);
-    ++(data.second);
-    return it->second;
+    term_data_[index].second += count;
+    return index;
   } else {
     // Add a new term.
-    const int index = term_index_.size();
-    CHECK_LT(index, std::numeric_limits<int32>::max());  // overflow
-    term_index_[term] = index;
-    term_data_.push_back(std::pair<string, int64>(term, 1));
-    return index;
+    return Insert(term, hash, slot, count);
+  }
+}
+
+void TermFrequencyMap::Merge(const TermFrequencyMap &other) {
+  Reserve(term_data_.size() + other.term_data_.size());
+  for (const auto &data : other.term_data_) {
+    Increment(data.first, data.second);
   }
 }
 
 void TermFrequencyMap::Clear() {
-  term_index_.clear();
+  slots_.clear();
   term_data_.clear();
 }
 
+uint32 TermFrequencyMap::Hash(tensorflow::StringPiece term) {
+  return utils::Hash32(term.data(), term.size(), kTermHashSeed);
+}
+
+size_t TermFrequencyMap::FindSlot(tensorflow::StringPiece term,
+                                  uint32 hash) const {
+  const size_t mask = slots_.size() - 1;
+  size_t position = hash & mask;
+  while (true) {
+    const Slot &slot = slots_[position];
+    if (slot.index < 0) return position;
+    if (slot.hash == hash && term == term_data_[slot.index].first) {
+      return position;
+    }
+    position = (position + 1) & mask;
+  }
+}
+
+int TermFrequencyMap::Insert(tensorflow::StringPiece term, uint32 hash,
+                             size_t slot, int64 frequency) {
+  const int index = term_data_.size();
+  CHECK_LT(index, std::numeric_limits<int32>::max());  // overflow
+  slots_[slot].hash = hash;
+  slots_[slot].index = index;
+  term_data_.emplace_back(term.ToString(), frequency);
+  if (2 * term_data_.size() > slots_.size()) Reserve(term_data_.size() + 1);
+  return index;
+}
+
+void TermFrequencyMap::Reserve(size_t num_terms) {
+  size_t num_slots = kMinSlots;
+  while (num_slots < 2 * num_terms) num_slots *= 2;
+  if (num_slots <= slots_.size()) return;
+
+  // Moves the existing terms to the new table using their stored hashes.
+  std::vector<Slot> old_slots(num_slots, Slot{0, -1});
+  old_slots.swap(slots_);
+  const size_t mask = num_slots - 1;
+  for (const Slot &slot : old_slots) {
+    if (slot.index < 0) continue;
+    size_t position = slot.hash & mask;
+    while (slots_[position].index >= 0) position = (position + 1) & mask;
+    slots_[position] = slot;
+  }
+}
+
 void TermFrequencyMap::Load(const string &filename, int min_frequency,
                             int max_num_terms) {
   Clear();
@@ -69,6 +132,7 @@ void TermFrequencyMap::Load(const string &filename, int min_frequency,
   int32 total = -1;
   CHECK(utils::ParseInt32(line.c_str(), &total));
   CHECK_GE(total, 0);
+  Reserve(std::min(total, max_num_terms));
 
   // Read the mapping.
   int64 last_frequency = -1;
@@ -91,16 +155,15 @@ void TermFrequencyMap::Load(const string &filename, int min_frequency,
     if (frequency < min_frequency) continue;
 
     // Check uniqueness of the mapped terms.
-    CHECK(term_index_.find(term) == term_index_.end())
+    const uint32 hash = Hash(term);
+    const size_t slot = FindSlot(term, hash);
+    CHECK_LT(slots_[slot].index, 0)
         << "File " << filename << " has duplicate term: " << term;
 
     // Assign the next available index.
-    const int index = term_index_.size();
-    term_index_[term] = index;
-    term_data_.push_back(std::pair<string, int64>(term, frequency));
+    Insert(term, hash, slot, frequency);
   }
-  CHECK_EQ(term_index_.size(), term_data_.size());
-  LOG(INFO) << "Loaded " << term_index_.size() << " terms from " << filename
+  LOG(INFO) << "Loaded " << term_data_.size() << " terms from " << filename
             << ".";
 }
 
@@ -114,8 +177,6 @@ struct TermFrequencyMap::SortByFrequencyThenTerm {
 };
 
 void TermFrequencyMap::Save(const string &filename) const {
-  CHECK_EQ(term_index_.size(), term_data_.size());
-
   // Copy and sort the term data.
   std::vector<std::pair<string, int64>> sorted_data(term_data_);
   std::sort(sorted_data.begin(), sorted_data.end(), SortByFrequencyThenTerm());
@@ -123,8 +184,8 @@ void TermFrequencyMap::Save(const string &filename) const {
   // Write the number of terms.
   std::unique_ptr<tensorflow::WritableFile> file;
   TF_CHECK_OK(tensorflow::Env::Default()->NewWritableFile(filename, &file));
-  CHECK_LE(term_index_.size(), std::numeric_limits<int32>::max());  // overflow
-  const int32 num_terms = term_index_.size();
+  CHECK_LE(term_data_.size(), std::numeric_limits<int32>::max());  // overflow
+  const int32 num_terms = term_data_.size();
   const string header = tensorflow::strings::StrCat(num_terms, "\n");
   TF_CHECK_OK(file->Append(header));
 
@@ -136,7 +197,7 @@ void TermFrequencyMap::Save(const string &filename) const {
     TF_CHECK_OK(file->Append(line));
   }
   TF_CHECK_OK(file->Close()) << "for file " << filename;
-  LOG(INFO) << "Saved " << term_index_.size() << " terms to " << filename
+  LOG(INFO) << "Saved " << term_data_.size() << " terms to " << filename
             << ".";
 }
 
@@ -174,6 +235,12 @@ void TagToCategoryMap::SetCategory(const string &tag, const string &category) {
   }
 }
 
+void TagToCategoryMap::Merge(const TagToCategoryMap &other) {
+  for (const auto &pair : other.tag_to_category_) {
+    SetCategory(pair.first, pair.second);
+  }
+}
+
 void TagToCategoryMap::Save(const string &filename) const {
   // Write tag and category on each line.
   std::unique_ptr<tensorflow::WritableFile> file;
@@ -17,13 +17,14 @@ limitations under the License.
 #define SYNTAXNET_TERM_FREQUENCY_MAP_H_
 
 #include <stddef.h>
+#include <map>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "syntaxnet/utils.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
 
 namespace syntaxnet {
 
@@ -39,13 +40,15 @@ class TermFrequencyMap {
   }
 
   // Returns the number of terms with positive frequency.
-  int Size() const { return term_index_.size(); }
+  int Size() const { return term_data_.size(); }
 
   // Returns the index associated with the given term.  If the term does not
-  // exist, the unknown index is returned instead.
-  int LookupIndex(const string &term, int unknown) const {
-    const TermIndex::const_iterator it = term_index_.find(term);
-    return (it != term_index_.end() ? it->second : unknown);
+  // exist, the unknown index is returned instead.  The term is looked up
+  // without copying it, so callers can pass pieces of larger strings.
+  int LookupIndex(tensorflow::StringPiece term, int unknown) const {
+    if (slots_.empty()) return unknown;
+    const int index = slots_[FindSlot(term, Hash(term))].index;
+    return index >= 0 ? index : unknown;
   }
 
   // Returns the term associated with the given index.
@@ -53,7 +56,14 @@ class TermFrequencyMap {
 
   // Increases the frequency of the given term by 1, creating a new entry if
   // necessary, and returns the index of the term.
-  int Increment(const string &term);
+  int Increment(tensorflow::StringPiece term);
+
+  // Increases the frequency of the given term by the given count, creating a
+  // new entry if necessary, and returns the index of the term.
+  int Increment(tensorflow::StringPiece term, int64 count);
+
+  // Adds the frequencies of all terms in the other map to this map.
+  void Merge(const TermFrequencyMap &other);
 
   // Clears all frequencies.
   void Clear();
@@ -73,14 +83,34 @@ class TermFrequencyMap {
   void Save(const string &filename) const;
 
  private:
-  // Hashtable for term-to-index mapping.
-  typedef std::unordered_map<string, int> TermIndex;
+  // Slot of the open-addressing hashtable for term-to-index mapping. The
+  // hash of the term is kept in the slot, so that most mismatching terms are
+  // skipped without comparing strings.
+  struct Slot {
+    uint32 hash;
+    int32 index;  // -1 for empty slots
+  };
 
   // Sorting functor for term data.
   struct SortByFrequencyThenTerm;
 
-  // Mapping from terms to indices.
-  TermIndex term_index_;
+  // Returns the hash of a term.
+  static uint32 Hash(tensorflow::StringPiece term);
+
+  // Returns the position of the slot holding the given term, or of the empty
+  // slot where it would be inserted.  The table must not be empty.
+  size_t FindSlot(tensorflow::StringPiece term, uint32 hash) const;
+
+  // Adds a new term to the given empty slot and returns its index.
+  int Insert(tensorflow::StringPiece term, uint32 hash, size_t slot,
+             int64 frequency);
+
+  // Resizes the hashtable to hold at least the given number of terms.
+  void Reserve(size_t num_terms);
+
+  // Mapping from terms to indices, using linear probing in a power-of-two
+  // table that is kept at most half full.
+  std::vector<Slot> slots_;
 
   // Mapping from indices to term and frequency.
   std::vector<std::pair<string, int64>> term_data_;
@@ -100,6 +130,9 @@ class TagToCategoryMap {
   // Sets the category for the given tag.
   void SetCategory(const string &tag, const string &category);
 
+  // Sets the categories of all tags in the other map.
+  void Merge(const TagToCategoryMap &other);
+
   // Returns the category associated with the given tag.
   const string &GetCategory(const string &tag) const;
 
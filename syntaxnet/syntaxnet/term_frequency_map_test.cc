@@ -0,0 +1,195 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "syntaxnet/term_frequency_map.h"
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "syntaxnet/base.h"
+#include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace syntaxnet {
+namespace {
+
+TEST(TermFrequencyMapTest, IncrementAndLookup) {
+  TermFrequencyMap map;
+  EXPECT_EQ(0, map.Size());
+  EXPECT_EQ(-1, map.LookupIndex("a", -1));
+  EXPECT_EQ(0, map.Increment("a"));
+  EXPECT_EQ(1, map.Increment("b", 5));
+  EXPECT_EQ(0, map.Increment("a"));
+  EXPECT_EQ(2, map.Size());
+  EXPECT_EQ(0, map.LookupIndex("a", -1));
+  EXPECT_EQ(1, map.LookupIndex("b", -1));
+  EXPECT_EQ(7, map.LookupIndex("c", 7));
+  EXPECT_EQ("b", map.GetTerm(1));
+
+  // Terms can be looked up from pieces of larger strings.
+  const string text = "xaby";
+  EXPECT_EQ(0, map.LookupIndex(tensorflow::StringPiece(text).substr(1, 1), -1));
+  EXPECT_EQ(-1,
+            map.LookupIndex(tensorflow::StringPiece(text).substr(1, 2), -1));
+
+  // The empty string is a valid term.
+  EXPECT_EQ(-1, map.LookupIndex("", -1));
+  EXPECT_EQ(2, map.Increment(""));
+  EXPECT_EQ(2, map.LookupIndex("", -1));
+
+  map.Clear();
+  EXPECT_EQ(0, map.Size());
+  EXPECT_EQ(-1, map.LookupIndex("a", -1));
+  EXPECT_EQ(0, map.Increment("b"));
+}
+
+TEST(TermFrequencyMapTest, KeepsIndicesWhenGrowing) {
+  const int kNumTerms = 10000;
+  TermFrequencyMap map;
+  for (int i = 0; i < kNumTerms; ++i) {
+    EXPECT_EQ(i, map.Increment(tensorflow::strings::StrCat("term", i)));
+  }
+  ASSERT_EQ(kNumTerms, map.Size());
+  for (int i = 0; i < kNumTerms; ++i) {
+    const string term = tensorflow::strings::StrCat("term", i);
+    EXPECT_EQ(i, map.LookupIndex(term, -1));
+    EXPECT_EQ(term, map.GetTerm(i));
+  }
+  EXPECT_EQ(-1, map.LookupIndex("term", -1));
+}
+
+TEST(TermFrequencyMapTest, MergeAddsFrequencies) {
+  TermFrequencyMap map;
+  map.Increment("a", 2);
+  map.Increment("b", 1);
+  TermFrequencyMap other;
+  other.Increment("c", 4);
+  other.Increment("a", 3);
+  map.Merge(other);
+  ASSERT_EQ(3, map.Size());
+  EXPECT_EQ(0, map.LookupIndex("a", -1));
+  EXPECT_EQ(1, map.LookupIndex("b", -1));
+  EXPECT_EQ(2, map.LookupIndex("c", -1));
+}
+
+TEST(TermFrequencyMapTest, SaveAndLoad) {
+  TermFrequencyMap map;
+  map.Increment("rare", 1);
+  map.Increment("common", 10);
+  map.Increment("medium", 5);
+  map.Increment("other", 5);
+  const string filename = tensorflow::strings::StrCat(
+      tensorflow::testing::TmpDir(), "term_frequency_map");
+  map.Save(filename);
+
+  // Loaded terms are sorted by descending frequency, then by term.
+  TermFrequencyMap loaded(filename, 0, 0);
+  ASSERT_EQ(4, loaded.Size());
+  EXPECT_EQ(0, loaded.LookupIndex("common", -1));
+  EXPECT_EQ(1, loaded.LookupIndex("medium", -1));
+  EXPECT_EQ(2, loaded.LookupIndex("other", -1));
+  EXPECT_EQ(3, loaded.LookupIndex("rare", -1));
+
+  // Frequency and size limits are applied while loading.
+  loaded.Load(filename, 5, 0);
+  EXPECT_EQ(3, loaded.Size());
+  EXPECT_EQ(-1, loaded.LookupIndex("rare", -1));
+  loaded.Load(filename, 0, 2);
+  EXPECT_EQ(2, loaded.Size());
+  EXPECT_EQ(-1, loaded.LookupIndex("other", -1));
+}
+
+// Number of lookups in each iteration of the benchmarks.
+const int kNumLookups = 100000;
+
+// Vocabulary and lookups for the benchmarks below. The terms are looked up
+// from a text, as features look up pieces of sentences.
+class LookupData {
+ public:
+  explicit LookupData(int num_terms) {
+    for (int i = 0; i < num_terms; ++i) {
+      terms_.push_back(tensorflow::strings::StrCat("word", i * 7919));
+    }
+    for (int i = 0; i < kNumLookups; ++i) {
+      // Every fourth lookup is for an unknown term.
+      const string &term = terms_[(i * 104729) % terms_.size()];
+      const size_t start = text_.size();
+      tensorflow::strings::StrAppend(&text_, term, i % 4 == 0 ? "x" : "");
+      pieces_.emplace_back(start, text_.size() - start);
+    }
+  }
+
+  const std::vector<string> &terms() const { return terms_; }
+
+  // Returns the i'th term to look up.
+  tensorflow::StringPiece lookup(int i) const {
+    return tensorflow::StringPiece(text_).substr(pieces_[i].first,
+                                                 pieces_[i].second);
+  }
+
+ private:
+  std::vector<string> terms_;
+  string text_;
+  std::vector<std::pair<size_t, size_t>> pieces_;
+};
+
+// Baseline: the hashtable previously used by TermFrequencyMap, which needs a
+// string for every lookup.
+void BM_UnorderedMapLookup(int iters, int num_terms) {
+  tensorflow::testing::StopTiming();
+  LookupData data(num_terms);
+  std::unordered_map<string, int> index;
+  for (const string &term : data.terms()) index.emplace(term, index.size());
+  tensorflow::testing::StartTiming();
+  int64 found = 0;
+  for (int i = 0; i < iters; ++i) {
+    for (int j = 0; j < kNumLookups; ++j) {
+      const auto it = index.find(data.lookup(j).ToString());
+      if (it != index.end()) found += it->second;
+    }
+  }
+  tensorflow::testing::StopTiming();
+  CHECK_GT(found, 0);
+  tensorflow::testing::ItemsProcessed(static_cast<int64>(iters) *
+                                      kNumLookups);
+}
+BENCHMARK(BM_UnorderedMapLookup)->Arg(1000)->Arg(100000);
+
+void BM_TermFrequencyMapLookup(int iters, int num_terms) {
+  tensorflow::testing::StopTiming();
+  LookupData data(num_terms);
+  TermFrequencyMap map;
+  for (const string &term : data.terms()) map.Increment(term);
+  tensorflow::testing::StartTiming();
+  int64 found = 0;
+  for (int i = 0; i < iters; ++i) {
+    for (int j = 0; j < kNumLookups; ++j) {
+      const int index = map.LookupIndex(data.lookup(j), -1);
+      if (index >= 0) found += index;
+    }
+  }
+  tensorflow::testing::StopTiming();
+  CHECK_GT(found, 0);
+  tensorflow::testing::ItemsProcessed(static_cast<int64>(iters) *
+                                      kNumLookups);
+}
+BENCHMARK(BM_TermFrequencyMapLookup)->Arg(1000)->Arg(100000);
+
+}  // namespace
+}  // namespace syntaxnet
@@ -18,13 +18,13 @@ limitations under the License.
 #include <vector>
 
 #include "syntaxnet/document_format.h"
+#include "syntaxnet/english_tokenizer.h"
 #include "syntaxnet/segmenter_utils.h"
 #include "syntaxnet/sentence.pb.h"
 #include "syntaxnet/utils.h"
 #include "tensorflow/core/lib/io/buffered_inputstream.h"
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/lib/strings/stringprintf.h"
-#include "tensorflow/core/platform/regexp.h"
 
 namespace syntaxnet {
 
@@ -87,30 +87,37 @@ class CoNLLSyntaxFormat : public DocumentFormat {
     // Create new sentence.
     Sentence *sentence = new Sentence();
 
-    // Each line corresponds to one token.
+    // Each line corresponds to one token. Lines and fields are scanned as
+    // pieces of the value, so nothing is copied until the token is filled in.
     string text;
-    std::vector<string> lines = utils::Split(value, '\n');
+    string scratch;
+    std::vector<tensorflow::StringPiece> fields;
+    tensorflow::StringPiece remaining(value);
 
     // Add each token to the sentence.
-    std::vector<string> fields;
     int expected_id = 1;
-    for (size_t i = 0; i < lines.size(); ++i) {
+    while (!remaining.empty()) {
+      const size_t end_of_line = remaining.find('\n');
+      const tensorflow::StringPiece line = remaining.substr(0, end_of_line);
+      remaining.remove_prefix(end_of_line == tensorflow::StringPiece::npos
+                                  ? remaining.size()
+                                  : end_of_line + 1);
+
       // Split line into tab-separated fields.
-      fields.clear();
-      fields = utils::Split(lines[i], '\t');
+      utils::SplitPieces(line, '\t', &fields);
       if (fields.empty()) continue;
 
       // Skip comment lines.
-      if (fields[0][0] == '#') continue;
+      if (!fields[0].empty() && fields[0][0] == '#') continue;
 
       // Skip CoNLLU lines for multiword tokens which are indicated by
       // hyphenated line numbers, e.g., "2-4".
       // http://universaldependencies.github.io/docs/format.html
-      if (RE2::FullMatch(fields[0], "[0-9]+-[0-9]+")) continue;
+      if (IsMultiwordTokenRange(fields[0])) continue;
 
       // Clear all optional fields equal to '_'.
       for (size_t j = 2; j < fields.size(); ++j) {
-        if (fields[j].length() == 1 && fields[j][0] == '_') fields[j].clear();
+        if (fields[j] == "_") fields[j].clear();
       }
 
       // Check that the line is valid.
@@ -118,34 +125,34 @@ class CoNLLSyntaxFormat : public DocumentFormat {
           << "Every line has to have at least 8 tab separated fields.";
 
       // Check that the ids follow the expected format.
-      const int id = utils::ParseUsing<int>(fields[0], 0, utils::ParseInt32);
+      const int id = ParseIntField(fields[0], &scratch);
       CHECK_EQ(expected_id++, id)
           << "Token ids start at 1 for each new sentence and increase by 1 "
           << "on each new token. Sentences are separated by an empty line.";
 
       // Get relevant fields.
-      const string &word = fields[1];
-      const string &cpostag = fields[3];
-      const string &tag = fields[4];
-      const string &attributes = fields[5];
-      const int head = utils::ParseUsing<int>(fields[6], 0, utils::ParseInt32);
-      const string &label = fields[7];
+      const tensorflow::StringPiece word = fields[1];
+      const tensorflow::StringPiece cpostag = fields[3];
+      const tensorflow::StringPiece tag = fields[4];
+      const tensorflow::StringPiece attributes = fields[5];
+      const int head = ParseIntField(fields[6], &scratch);
+      const tensorflow::StringPiece label = fields[7];
 
       // Add token to sentence text.
       if (!text.empty()) text.append(" ");
       const int start = text.size();
       const int end = start + word.size() - 1;
-      text.append(word);
+      text.append(word.data(), word.size());
 
       // Add token to sentence.
       Token *token = sentence->add_token();
-      token->set_word(word);
+      token->set_word(word.data(), word.size());
       token->set_start(start);
       token->set_end(end);
       if (head > 0) token->set_head(head - 1);
-      if (!tag.empty()) token->set_tag(tag);
-      if (!cpostag.empty()) token->set_category(cpostag);
-      if (!label.empty()) token->set_label(label);
+      if (!tag.empty()) token->set_tag(tag.data(), tag.size());
+      if (!cpostag.empty()) token->set_category(cpostag.data(), cpostag.size());
+      if (!label.empty()) token->set_label(label.data(), label.size());
       if (!attributes.empty()) AddMorphAttributes(attributes, token);
       if (join_category_to_pos_) JoinCategoryToPos(token);
       if (add_pos_as_attribute_) AddPosAsAttribute(token);
@@ -193,33 +200,61 @@ class CoNLLSyntaxFormat : public DocumentFormat {
     return field.empty() ? "_" : field;
   }
 
+  // Returns true if the field is a range of ids, e.g., "2-4", as used for
+  // CoNLL-U multiword tokens.
+  static bool IsMultiwordTokenRange(tensorflow::StringPiece field) {
+    const size_t dash = field.find('-');
+    return dash != tensorflow::StringPiece::npos &&
+           IsDigits(field.substr(0, dash)) && IsDigits(field.substr(dash + 1));
+  }
+
+  // Returns true if the piece is a non-empty sequence of ASCII digits.
+  static bool IsDigits(tensorflow::StringPiece piece) {
+    if (piece.empty()) return false;
+    for (char c : piece) {
+      if (c < '0' || c > '9') return false;
+    }
+    return true;
+  }
+
+  // Parses an integer field like utils::ParseInt32, returning 0 for empty
+  // fields. The field is copied to the given scratch string, whose storage is
+  // reused across fields, to get a terminated string for the parser.
+  static int ParseIntField(tensorflow::StringPiece field, string *scratch) {
+    if (field.empty()) return 0;
+    scratch->assign(field.data(), field.size());
+    return utils::ParseUsing<int>(*scratch, utils::ParseInt32);
+  }
+
   // Creates a TokenMorphology object out of a list of attribute values of the
   // form: a1=v1|a2=v2|... or v1|v2|...
-  void AddMorphAttributes(const string &attributes, Token *token) {
+  void AddMorphAttributes(tensorflow::StringPiece attributes, Token *token) {
     TokenMorphology *morph =
         token->MutableExtension(TokenMorphology::morphology);
-    std::vector<string> att_vals = utils::Split(attributes, '|');
-    for (int i = 0; i < att_vals.size(); ++i) {
-      std::vector<string> att_val = utils::SplitOne(att_vals[i], '=');
-
+    utils::SplitPieces(attributes, '|', &att_vals_);
+    for (const tensorflow::StringPiece &att_val : att_vals_) {
       // Format is either:
       //   1) a1=v1|a2=v2..., e.g., Czech CoNLL data, or,
       //   2) v1|v2|..., e.g., German CoNLL data.
-      const std::pair<string, string> name_value =
-          att_val.size() == 2 ? std::make_pair(att_val[0], att_val[1])
-                              : std::make_pair(att_val[0], "on");
+      const size_t split = att_val.find('=');
+      tensorflow::StringPiece name = att_val;
+      tensorflow::StringPiece value("on");
+      if (split != tensorflow::StringPiece::npos) {
+        name = att_val.substr(0, split);
+        value = att_val.substr(split + 1);
+      }
 
       // We currently don't expect an empty attribute value, but might have an
       // empty attribute name due to data input errors.
-      if (name_value.second.empty()) {
+      if (value.empty()) {
         LOG(WARNING) << "Invalid attributes string: " << attributes
                      << " for token: " << token->ShortDebugString();
         continue;
       }
-      if (!name_value.first.empty()) {
+      if (!name.empty()) {
         TokenMorphology::Attribute *attribute = morph->add_attribute();
-        attribute->set_name(name_value.first);
-        attribute->set_value(name_value.second);
+        attribute->set_name(name.data(), name.size());
+        attribute->set_value(value.data(), value.size());
       }
     }
   }
@@ -279,6 +314,9 @@ class CoNLLSyntaxFormat : public DocumentFormat {
   bool join_category_to_pos_ = false;
   bool add_pos_as_attribute_ = false;
 
+  // Storage for the attribute pieces of a token, reused across tokens.
+  std::vector<tensorflow::StringPiece> att_vals_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(CoNLLSyntaxFormat);
 };
 
@@ -506,150 +544,29 @@ class UntokenizedTextFormat : public TokenizedTextFormat {
 REGISTER_SYNTAXNET_DOCUMENT_FORMAT("untokenized-text", UntokenizedTextFormat);
 
 // Text reader that attmpts to perform Penn Treebank tokenization on arbitrary
-// raw text. Adapted from https://www.cis.upenn.edu/~treebank/tokenizer.sed
-// by Robert MacIntyre, University of Pennsylvania, late 1995.
+// raw text, using EnglishTokenizer.
 // Expected input: raw text with one sentence per line.
 //
 class EnglishTextFormat : public TokenizedTextFormat {
  public:
   EnglishTextFormat() {}
 
+  void Setup(TaskContext *context) override {
+    TokenizedTextFormat::Setup(context);
+    if (tokenizer_ == nullptr) tokenizer_.reset(new EnglishTokenizer());
+  }
+
   void ConvertFromString(const string &key, const string &value,
                          std::vector<Sentence *> *sentences) override {
-    std::vector<std::pair<string, string>> preproc_rules = {
-        // Punctuation.
-        {"’", "'"},
-        {"…", "..."},
-        {"---", "--"},
-        {"—", "--"},
-        {"–", "--"},
-        {"，", ","},
-        {"。", "."},
-        {"！", "!"},
-        {"？", "?"},
-        {"：", ":"},
-        {"；", ";"},
-        {"＆", "&"},
-
-        // Brackets.
-        {"\\[", "("},
-        {"]", ")"},
-        {"{", "("},
-        {"}", ")"},
-        {"【", "("},
-        {"】", ")"},
-        {"（", "("},
-        {"）", ")"},
-
-        // Quotation marks.
-        {"\"", "\""},
-        {"″", "\""},
-        {"“", "\""},
-        {"„", "\""},
-        {"‵‵", "\""},
-        {"”", "\""},
-        {"’", "\""},
-        {"‘", "\""},
-        {"′′", "\""},
-        {"‹", "\""},
-        {"›", "\""},
-        {"«", "\""},
-        {"»", "\""},
-
-        // Discarded punctuation that breaks sentences.
-        {"|", ""},
-        {"·", ""},
-        {"•", ""},
-        {"●", ""},
-        {"▪", ""},
-        {"■", ""},
-        {"□", ""},
-        {"❑", ""},
-        {"◆", ""},
-        {"★", ""},
-        {"＊", ""},
-        {"♦", ""},
-    };
-
-    std::vector<std::pair<string, string>> rules = {
-        // attempt to get correct directional quotes
-        {R"re(^")re", "`` "},
-        {R"re(([ \([{<])")re", "\\1 `` "},
-        // close quotes handled at end
-
-        {R"re(\.\.\.)re", " ... "},
-        {"[,;:@#$%&]", " \\0 "},
-
-        // Assume sentence tokenization has been done first, so split FINAL
-        // periods only.
-        {R"re(([^.])(\.)([\]\)}>"']*)[ ]*$)re", "\\1 \\2\\3 "},
-        // however, we may as well split ALL question marks and exclamation
-        // points, since they shouldn't have the abbrev.-marker ambiguity
-        // problem
-        {"[?!]", " \\0 "},
-
-        // parentheses, brackets, etc.
-        {R"re([\]\[\(\){}<>])re", " \\0 "},
-
-        // Like Adwait Ratnaparkhi's MXPOST, we use the parsed-file version of
-        // these symbols.
-        {"\\(", "-LRB-"},
-        {"\\)", "-RRB-"},
-        {"\\]", "-LSB-"},
-        {"\\]", "-RSB-"},
-        {"{", "-LCB-"},
-        {"}", "-RCB-"},
-
-        {"--", " -- "},
-
-        // First off, add a space to the beginning and end of each line, to
-        // reduce necessary number of regexps.
-        {"$", " "},
-        {"^", " "},
-
-        {"\"", " '' "},
-        // possessive or close-single-quote
-        {"([^'])' ", "\\1 ' "},
-        // as in it's, I'm, we'd
-        {"'([sSmMdD]) ", " '\\1 "},
-        {"'ll ", " 'll "},
-        {"'re ", " 're "},
-        {"'ve ", " 've "},
-        {"n't ", " n't "},
-        {"'LL ", " 'LL "},
-        {"'RE ", " 'RE "},
-        {"'VE ", " 'VE "},
-        {"N'T ", " N'T "},
-
-        {" ([Cc])annot ", " \\1an not "},
-        {" ([Dd])'ye ", " \\1' ye "},
-        {" ([Gg])imme ", " \\1im me "},
-        {" ([Gg])onna ", " \\1on na "},
-        {" ([Gg])otta ", " \\1ot ta "},
-        {" ([Ll])emme ", " \\1em me "},
-        {" ([Mm])ore'n ", " \\1ore 'n "},
-        {" '([Tt])is ", " '\\1 is "},
-        {" '([Tt])was ", " '\\1 was "},
-        {" ([Ww])anna ", " \\1an na "},
-        {" ([Ww])haddya ", " \\1ha dd ya "},
-        {" ([Ww])hatcha ", " \\1ha t cha "},
-
-        // clean out extra spaces
-        {"  *", " "},
-        {"^ *", ""},
-    };
-
-    string rewritten = value;
-    for (const std::pair<string, string> &rule : preproc_rules) {
-      RE2::GlobalReplace(&rewritten, rule.first, rule.second);
-    }
-    for (const std::pair<string, string> &rule : rules) {
-      RE2::GlobalReplace(&rewritten, rule.first, rule.second);
-    }
-    TokenizedTextFormat::ConvertFromString(key, rewritten, sentences);
+    CHECK(tokenizer_ != nullptr) << "Setup() must be called first";
+    TokenizedTextFormat::ConvertFromString(key, tokenizer_->Tokenize(value),
+                                           sentences);
   }
 
  private:
+  // Tokenizer with the compiled tokenization rules.
+  std::unique_ptr<EnglishTokenizer> tokenizer_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(EnglishTextFormat);
 };
 
@@ -105,6 +105,19 @@ std::vector<string> SplitOne(const string &text, char delim) {
   return result;
 }
 
+void SplitPieces(tensorflow::StringPiece text, char delim,
+                 std::vector<tensorflow::StringPiece> *pieces) {
+  pieces->clear();
+  if (text.empty()) return;
+  size_t token_start = 0;
+  for (size_t i = 0; i < text.size() + 1; i++) {
+    if ((i == text.size()) || (text[i] == delim)) {
+      pieces->emplace_back(text.data() + token_start, i - token_start);
+      token_start = i + 1;
+    }
+  }
+}
+
 bool IsAbsolutePath(tensorflow::StringPiece path) {
   return !path.empty() && path[0] == '/';
 }
@@ -56,6 +56,12 @@ std::vector<string> Split(const string &text, char delim);
 // or returns the given string if the given delimiter is not found.
 std::vector<string> SplitOne(const string &text, char delim);
 
+// Splits the given text on every occurrence of the given delimiter char, like
+// Split(), but returns pieces pointing into the text instead of copies. The
+// pieces vector is cleared first, so its storage can be reused between calls.
+void SplitPieces(tensorflow::StringPiece text, char delim,
+                 std::vector<tensorflow::StringPiece> *pieces);
+
 template <typename T>
 string Join(const std::vector<T> &s, const char *sep) {
   string result;
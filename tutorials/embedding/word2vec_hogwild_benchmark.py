@@ -0,0 +1,186 @@
+# Copyright 2015 The TensorFlow Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+"""Benchmarks NegTrainWord2vec with and without hogwild sharding.
+
+Trains embeddings with the custom ops of word2vec_optimized on a synthetic
+corpus, serially and with hogwild=True, for each of several settings of
+intra_op_parallelism_threads.  Reports the examples/sec and the final
+negative-sampling loss of each run, and fails if a hogwild loss is not in the
+same range as the serial loss with the same number of threads.
+
+  python word2vec_hogwild_benchmark.py --intra_op_threads=1,4,16
+"""
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import os
+import sys
+import tempfile
+import threading
+import time
+
+from six.moves import xrange  # pylint: disable=redefined-builtin
+
+import numpy as np
+import tensorflow as tf
+
+word2vec = tf.load_op_library(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'word2vec_ops.so'))
+
+flags = tf.app.flags
+
+flags.DEFINE_string("train_data", None,
+                    "Training data.  By default a synthetic corpus is "
+                    "written to a temporary directory.")
+flags.DEFINE_integer("corpus_words", 1000000,
+                     "Number of words of the synthetic corpus.")
+flags.DEFINE_string("intra_op_threads", "1,4,16",
+                    "Comma-separated intra_op_parallelism_threads settings.")
+flags.DEFINE_integer("num_steps", 2000, "Training steps of each run.")
+flags.DEFINE_integer("concurrent_steps", 12,
+                     "The number of concurrent training steps.")
+flags.DEFINE_integer("batch_size", 500, "Training examples of each step.")
+flags.DEFINE_integer("embedding_size", 100, "The embedding dimension size.")
+flags.DEFINE_integer("num_neg_samples", 5,
+                     "Negative samples per training example.")
+flags.DEFINE_float("learning_rate", 0.025, "Initial learning rate.")
+flags.DEFINE_integer("eval_batches", 20,
+                     "Batches of examples on which the final loss is "
+                     "computed.")
+flags.DEFINE_float("loss_tolerance", 0.1,
+                   "Largest relative difference allowed between the hogwild "
+                   "and the serial loss.")
+
+FLAGS = flags.FLAGS
+
+
+def write_corpus(filename, num_words, vocab_size=2000, num_topics=20,
+                 sentence_length=20):
+  """Writes a corpus of sentences that each draw words from one topic."""
+  rng = np.random.RandomState(0)
+  words_per_topic = vocab_size // num_topics
+  # Zipfian word frequencies within each topic.
+  p = 1.0 / np.arange(1, words_per_topic + 1)
+  p /= p.sum()
+  with open(filename, "w") as f:
+    for _ in xrange(num_words // sentence_length):
+      topic = rng.randint(num_topics)
+      ids = topic * words_per_topic + rng.choice(
+          words_per_topic, size=sentence_length, p=p)
+      f.write(" ".join("w%d" % i for i in ids) + "\n")
+
+
+def softplus(x):
+  return np.logaddexp(0, x)
+
+
+def train(train_data, intra_op_threads, hogwild):
+  """Trains on train_data, returning examples/sec and the final loss."""
+  with tf.Graph().as_default(), tf.Session(config=tf.ConfigProto(
+      intra_op_parallelism_threads=intra_op_threads)) as session:
+    (_, counts, _, _, _, examples,
+     labels) = word2vec.skipgram_word2vec(filename=train_data,
+                                          batch_size=FLAGS.batch_size,
+                                          window_size=5,
+                                          min_count=1,
+                                          subsample=0)
+    counts = session.run(counts)
+    vocab_size = len(counts)
+    dims = FLAGS.embedding_size
+
+    w_in = tf.Variable(
+        tf.random_uniform([vocab_size, dims], -0.5 / dims, 0.5 / dims,
+                          seed=1),
+        name="w_in")
+    w_out = tf.Variable(tf.zeros([vocab_size, dims]), name="w_out")
+    global_step = tf.Variable(0, name="global_step")
+    lr = FLAGS.learning_rate * tf.maximum(
+        0.0001, 1.0 - tf.cast(global_step, tf.float32) / FLAGS.num_steps)
+    inc = global_step.assign_add(1)
+    with tf.control_dependencies([inc]):
+      train_op = word2vec.neg_train_word2vec(
+          w_in,
+          w_out,
+          examples,
+          labels,
+          lr,
+          vocab_count=counts.tolist(),
+          num_negative_samples=FLAGS.num_neg_samples,
+          hogwild=hogwild)
+    tf.global_variables_initializer().run()
+
+    def body():
+      for _ in xrange(FLAGS.num_steps // FLAGS.concurrent_steps):
+        session.run(train_op)
+
+    workers = [threading.Thread(target=body)
+               for _ in xrange(FLAGS.concurrent_steps)]
+    start = time.time()
+    for t in workers:
+      t.start()
+    for t in workers:
+      t.join()
+    elapsed = time.time() - start
+    num_steps = FLAGS.num_steps // FLAGS.concurrent_steps * len(workers)
+    rate = num_steps * FLAGS.batch_size / elapsed
+
+    # The loss of the trained embeddings on fresh examples, with negatives
+    # drawn from the same unigram^0.75 distribution as the training op's.
+    batches = [session.run([examples, labels])
+               for _ in xrange(FLAGS.eval_batches)]
+    eval_examples = np.concatenate([b[0] for b in batches])
+    eval_labels = np.concatenate([b[1] for b in batches])
+    w_in_val, w_out_val = session.run([w_in, w_out])
+
+  rng = np.random.RandomState(1)
+  p = np.power(counts.astype(np.float64), 0.75)
+  p /= p.sum()
+  negatives = rng.choice(
+      vocab_size, size=(len(eval_examples), FLAGS.num_neg_samples), p=p)
+  v_in = w_in_val[eval_examples]
+  pos = np.sum(v_in * w_out_val[eval_labels], axis=1)
+  neg = np.einsum("nd,nkd->nk", v_in, w_out_val[negatives])
+  loss = np.mean(softplus(-pos) + np.sum(softplus(neg), axis=1))
+  return rate, loss
+
+
+def main(_):
+  train_data = FLAGS.train_data
+  if not train_data:
+    train_data = os.path.join(tempfile.mkdtemp(), "corpus.txt")
+    write_corpus(train_data, FLAGS.corpus_words)
+
+  # With w_out all zeros, every target contributes log(2) to the loss.
+  print("Initial loss: %.4f" % ((1 + FLAGS.num_neg_samples) * np.log(2)))
+  print("%8s %8s %14s %8s" % ("threads", "hogwild", "examples/sec", "loss"))
+  failed = False
+  for threads in [int(t) for t in FLAGS.intra_op_threads.split(",")]:
+    losses = {}
+    for hogwild in (False, True):
+      rate, losses[hogwild] = train(train_data, threads, hogwild)
+      print("%8d %8s %14.0f %8.4f" % (threads, hogwild, rate, losses[hogwild]))
+      sys.stdout.flush()
+    if abs(losses[True] - losses[False]) > (
+        FLAGS.loss_tolerance * losses[False]):
+      print("The hogwild loss %.4f is not within %g of the serial loss %.4f" %
+            (losses[True], FLAGS.loss_tolerance, losses[False]))
+      failed = True
+  if failed:
+    sys.exit(1)
+
+
+if __name__ == "__main__":
+  tf.app.run()
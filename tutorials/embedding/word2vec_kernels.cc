@@ -13,23 +13,44 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/framework/resource_mgr.h"
 #include "tensorflow/core/lib/core/stringpiece.h"
+#include "tensorflow/core/lib/gtl/inlined_vector.h"
 #include "tensorflow/core/lib/gtl/map_util.h"
-#include "tensorflow/core/lib/random/distribution_sampler.h"
+#include "tensorflow/core/lib/hash/hash.h"
 #include "tensorflow/core/lib/random/philox_random.h"
 #include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/lib/strings/numbers.h"
 #include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/platform/thread_annotations.h"
 #include "tensorflow/core/util/guarded_philox_random.h"
+#include "tensorflow/core/util/work_sharder.h"
 
 namespace tensorflow {
 
-// Number of examples to precalculate.
-const int kPrecalc = 3000;
+// Number of batches of examples to generate ahead of their use.
+const int kNumBatches = 16;
 // Number of words to read into a sentence before processing.
 const int kSentenceSize = 1000;
+// Id of the word that stands for all the words outside the vocabulary.
+const int32 kUnkId = 0;
 
 namespace {
 
@@ -44,6 +65,105 @@ bool ScanWord(StringPiece* input, string* word) {
   }
 }
 
+// Size of the chunks in which a corpus is read when streaming it.
+const size_t kStreamChunkSize = 16 << 20;
+
+// The header of an ids file, which identifies the vocabulary that its ids
+// refer to and the version of the corpus they were read from.  The ids
+// follow as raw int32s.
+struct IdsHeader {
+  uint32 magic;
+  int32 vocab_size;
+  uint64 vocab_fingerprint;
+  int64 corpus_length;
+  int64 corpus_mtime_nsec;
+};
+const uint32 kIdsMagic = 0x32445657;  // "WVD2"
+
+bool IsSpace(char c) { return isspace(static_cast<unsigned char>(c)); }
+
+// Calls fn(word) for each whitespace-separated word of the file, reading it
+// a chunk at a time rather than all at once.
+template <typename Fn>
+Status ForEachWord(Env* env, const string& filename, Fn fn) {
+  std::unique_ptr<RandomAccessFile> file;
+  TF_RETURN_IF_ERROR(env->NewRandomAccessFile(filename, &file));
+  std::vector<char> scratch(kStreamChunkSize);
+  string word;
+  // The start of a word that the previous chunk ended in the middle of.
+  string partial;
+  uint64 offset = 0;
+  for (bool eof = false; !eof;) {
+    StringPiece chunk;
+    const Status s =
+        file->Read(offset, kStreamChunkSize, &chunk, scratch.data());
+    if (!s.ok() && !errors::IsOutOfRange(s)) return s;
+    offset += chunk.size();
+    eof = chunk.size() < kStreamChunkSize;
+
+    if (!partial.empty()) {
+      size_t n = 0;
+      while (n < chunk.size() && !IsSpace(chunk[n])) ++n;
+      partial.append(chunk.data(), n);
+      chunk.remove_prefix(n);
+      if (chunk.empty() && !eof) continue;
+      fn(partial);
+      partial.clear();
+    }
+
+    if (!eof) {
+      size_t n = chunk.size();
+      while (n > 0 && !IsSpace(chunk[n - 1])) --n;
+      partial.assign(chunk.data() + n, chunk.size() - n);
+      chunk.remove_suffix(chunk.size() - n);
+    }
+
+    while (ScanWord(&chunk, &word)) fn(word);
+  }
+
+  return Status::OK();
+}
+
+// Reads a vocabulary file with a word and its count on each line, as saved
+// by word2vec_optimized.py.  The file is mapped rather than read, since it
+// may be large.  words may be null if only the counts are needed.
+Status ReadVocabFile(Env* env, const string& filename,
+                     std::vector<string>* words, std::vector<int64>* counts) {
+  std::unique_ptr<ReadOnlyMemoryRegion> region;
+  TF_RETURN_IF_ERROR(env->NewReadOnlyMemoryRegionFromFile(filename, &region));
+  StringPiece data(static_cast<const char*>(region->data()), region->length());
+
+  while (!data.empty()) {
+    StringPiece line = data;
+    const size_t eol = data.find('\n');
+    if (eol == StringPiece::npos) {
+      data.clear();
+    } else {
+      line = data.substr(0, eol);
+      data.remove_prefix(eol + 1);
+    }
+
+    str_util::RemoveTrailingWhitespace(&line);
+    if (line.empty()) continue;
+    const size_t space = line.rfind(' ');
+    int64 count;
+    if (space == StringPiece::npos ||
+        !strings::safe_strto64(line.substr(space + 1), &count) || count < 0) {
+      return errors::InvalidArgument("Malformed line in vocabulary file ",
+                                     filename, ": ", line);
+    }
+
+    if (words != nullptr) words->emplace_back(line.data(), space);
+    counts->push_back(count);
+  }
+
+  if (counts->empty()) {
+    return errors::InvalidArgument("Empty vocabulary file ", filename);
+  }
+
+  return Status::OK();
+}
+
 }  // end namespace
 
 class SkipgramWord2vecOp : public OpKernel {
@@ -56,57 +176,93 @@ class SkipgramWord2vecOp : public OpKernel {
     OP_REQUIRES_OK(ctx, ctx->GetAttr("window_size", &window_size_));
     OP_REQUIRES_OK(ctx, ctx->GetAttr("min_count", &min_count_));
     OP_REQUIRES_OK(ctx, ctx->GetAttr("subsample", &subsample_));
-    OP_REQUIRES_OK(ctx, Init(ctx->env(), filename));
+    bool streaming;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("streaming", &streaming));
+    string vocab_file;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("vocab_file", &vocab_file));
+    string ids_file;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("ids_file", &ids_file));
+    OP_REQUIRES(ctx, streaming || (vocab_file.empty() && ids_file.empty()),
+                errors::InvalidArgument(
+                    "vocab_file and ids_file are only used when streaming"));
+    if (streaming) {
+      if (ids_file.empty()) ids_file = filename + ".ids";
+      OP_REQUIRES_OK(
+          ctx, InitStreaming(ctx->env(), filename, vocab_file, ids_file));
+    } else {
+      OP_REQUIRES_OK(ctx, Init(ctx->env(), filename));
+    }
 
-    mutex_lock l(mu_);
     example_pos_ = corpus_size_;
     label_pos_ = corpus_size_;
     label_limit_ = corpus_size_;
     sentence_index_ = kSentenceSize;
-    for (int i = 0; i < kPrecalc; ++i) {
-      NextExample(&precalc_examples_[i].input, &precalc_examples_[i].label);
+    for (int i = 0; i < kNumBatches; ++i) slots_[i].sequence = i;
+    generator_.reset(ctx->env()->StartThread(
+        ThreadOptions(), "skipgram_word2vec", [this]() { GenerateLoop(); }));
+  }
+
+  ~SkipgramWord2vecOp() override {
+    {
+      mutex_lock l(wait_mu_);
+      stopped_ = true;
+      space_ready_.notify_all();
     }
+
+    // Deleting the thread waits for it to finish.
+    generator_.reset();
   }
 
   void Compute(OpKernelContext* ctx) override {
+    // Take the next batch.  Concurrent calls only contend on the position of
+    // the next batch in the ring, and only take wait_mu_ to sleep while it is
+    // empty, or to wake the generator if it is waiting for space.
+    Batch batch;
+    if (!Pop(&batch)) {
+      mutex_lock l(wait_mu_);
+      ++num_waiting_;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      while (!Pop(&batch)) batch_ready_.wait(l);
+      --num_waiting_;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (generator_waiting_) {
+      mutex_lock l(wait_mu_);
+      space_ready_.notify_one();
+    }
+
     Tensor words_per_epoch(DT_INT64, TensorShape({}));
     Tensor current_epoch(DT_INT32, TensorShape({}));
     Tensor total_words_processed(DT_INT64, TensorShape({}));
-    Tensor examples(DT_INT32, TensorShape({batch_size_}));
-    auto Texamples = examples.flat<int32>();
-    Tensor labels(DT_INT32, TensorShape({batch_size_}));
-    auto Tlabels = labels.flat<int32>();
-    {
-      mutex_lock l(mu_);
-      for (int i = 0; i < batch_size_; ++i) {
-        Texamples(i) = precalc_examples_[precalc_index_].input;
-        Tlabels(i) = precalc_examples_[precalc_index_].label;
-        precalc_index_++;
-        if (precalc_index_ >= kPrecalc) {
-          precalc_index_ = 0;
-          for (int j = 0; j < kPrecalc; ++j) {
-            NextExample(&precalc_examples_[j].input,
-                        &precalc_examples_[j].label);
-          }
-        }
-      }
-      words_per_epoch.scalar<int64>()() = corpus_size_;
-      current_epoch.scalar<int32>()() = current_epoch_;
-      total_words_processed.scalar<int64>()() = total_words_processed_;
-    }
+    words_per_epoch.scalar<int64>()() = corpus_size_;
+    current_epoch.scalar<int32>()() = batch.current_epoch;
+    total_words_processed.scalar<int64>()() = batch.total_words_processed;
     ctx->set_output(0, word_);
     ctx->set_output(1, freq_);
     ctx->set_output(2, words_per_epoch);
     ctx->set_output(3, current_epoch);
     ctx->set_output(4, total_words_processed);
-    ctx->set_output(5, examples);
-    ctx->set_output(6, labels);
+    ctx->set_output(5, batch.examples);
+    ctx->set_output(6, batch.labels);
   }
 
  private:
-  struct Example {
-    int32 input;
-    int32 label;
+  // A batch of examples, with the progress through the corpus once they had
+  // been generated.
+  struct Batch {
+    Tensor examples;
+    Tensor labels;
+    int32 current_epoch = 0;
+    int64 total_words_processed = 0;
+  };
+
+  // A slot of the ring of batches.  The slot holds the batch with position
+  // pos in the ring if its sequence number is pos + 1, and is free for it if
+  // the sequence number is pos.  See Vyukov's bounded MPMC queue:
+  // http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+  struct Slot {
+    std::atomic<int64> sequence;
+    Batch batch;
   };
 
   int32 batch_size_ = 0;
@@ -117,26 +273,115 @@ class SkipgramWord2vecOp : public OpKernel {
   Tensor word_;
   Tensor freq_;
   int64 corpus_size_ = 0;
+  // The word ids of the corpus, which are held in corpus_ or, when streaming,
+  // mapped from the ids file by corpus_region_.
   std::vector<int32> corpus_;
-  std::vector<Example> precalc_examples_;
-  int precalc_index_ = 0;
+  std::unique_ptr<ReadOnlyMemoryRegion> corpus_region_;
+  const int32* corpus_data_ = nullptr;
+
+  // The state of the example generator, which only the generator thread uses
+  // once it has started, so it needs no lock.
   std::vector<int32> sentence_;
   int sentence_index_ = 0;
+  random::PhiloxRandom philox_;
+  random::SimplePhilox rng_;
+  int32 current_epoch_ = -1;
+  int64 total_words_processed_ = 0;
+  int64 example_pos_;
+  int32 label_pos_;
+  int32 label_limit_;
+
+  // The ring of batches generated ahead of their use.  Only the generator
+  // thread adds batches, at push_pos_; Compute() calls take them at pop_pos_.
+  Slot slots_[kNumBatches];
+  int64 push_pos_ = 0;
+  std::atomic<int64> pop_pos_{0};
+
+  // Used only to sleep while the ring is empty or full.  A side that is about
+  // to sleep announces it in num_waiting_ or generator_waiting_ and checks
+  // the ring again under wait_mu_, and the other side checks the
+  // announcement after changing the ring, and signals under wait_mu_ if it
+  // was made.  The fences between these steps ensure that either the sleeper
+  // sees the change or the other side sees the announcement, so no wakeup is
+  // lost.
+  mutex wait_mu_;
+  condition_variable batch_ready_;
+  condition_variable space_ready_;
+  std::atomic<int> num_waiting_{0};
+  std::atomic<bool> generator_waiting_{false};
+
+  std::atomic<bool> stopped_{false};
+  std::unique_ptr<Thread> generator_;
+
+  // Fills the ring with batches until the op is destroyed.
+  void GenerateLoop() {
+    while (!stopped_) {
+      Batch batch;
+      batch.examples = Tensor(DT_INT32, TensorShape({batch_size_}));
+      batch.labels = Tensor(DT_INT32, TensorShape({batch_size_}));
+      auto Texamples = batch.examples.flat<int32>();
+      auto Tlabels = batch.labels.flat<int32>();
+      for (int i = 0; i < batch_size_; ++i) {
+        NextExample(&Texamples(i), &Tlabels(i));
+      }
+      batch.current_epoch = current_epoch_;
+      batch.total_words_processed = total_words_processed_;
 
-  mutex mu_;
-  random::PhiloxRandom philox_ GUARDED_BY(mu_);
-  random::SimplePhilox rng_ GUARDED_BY(mu_);
-  int32 current_epoch_ GUARDED_BY(mu_) = -1;
-  int64 total_words_processed_ GUARDED_BY(mu_) = 0;
-  int32 example_pos_ GUARDED_BY(mu_);
-  int32 label_pos_ GUARDED_BY(mu_);
-  int32 label_limit_ GUARDED_BY(mu_);
+      if (!Push(&batch)) {
+        mutex_lock l(wait_mu_);
+        generator_waiting_ = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!Push(&batch)) {
+          if (stopped_) return;
+          space_ready_.wait(l);
+        }
+        generator_waiting_ = false;
+      }
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (num_waiting_ > 0) {
+        mutex_lock l(wait_mu_);
+        batch_ready_.notify_one();
+      }
+    }
+  }
+
+  // Adds the batch to the ring, unless it is full.
+  bool Push(Batch* batch) {
+    Slot& slot = slots_[push_pos_ % kNumBatches];
+    if (slot.sequence.load(std::memory_order_acquire) != push_pos_) {
+      return false;
+    }
+    slot.batch = std::move(*batch);
+    slot.sequence.store(push_pos_ + 1, std::memory_order_release);
+    ++push_pos_;
+    return true;
+  }
+
+  // Takes the oldest batch from the ring, unless it is empty.
+  bool Pop(Batch* batch) {
+    int64 pos = pop_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[pos % kNumBatches];
+      const int64 diff =
+          slot.sequence.load(std::memory_order_acquire) - (pos + 1);
+      if (diff < 0) return false;
+      if (diff > 0) {
+        // Another call took the batch first.
+        pos = pop_pos_.load(std::memory_order_relaxed);
+      } else if (pop_pos_.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+        *batch = std::move(slot.batch);
+        slot.sequence.store(pos + kNumBatches, std::memory_order_release);
+        return true;
+      }
+    }
+  }
 
   // {example_pos_, label_pos_} is the cursor for the next example.
-  // example_pos_ wraps around at the end of corpus_. For each
+  // example_pos_ wraps around at the end of the corpus. For each
   // example, we randomly generate [label_pos_, label_limit) for
   // labels.
-  void NextExample(int32* example, int32* label) EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+  void NextExample(int32* example, int32* label) {
     while (true) {
       if (label_pos_ >= label_limit_) {
         ++total_words_processed_;
@@ -149,7 +394,7 @@ class SkipgramWord2vecOp : public OpKernel {
               example_pos_ = 0;
             }
             if (subsample_ > 0) {
-              int32 word_freq = freq_.flat<int32>()(corpus_[example_pos_]);
+              int32 word_freq = freq_.flat<int32>()(corpus_data_[example_pos_]);
               // See Eq. 5 in http://arxiv.org/abs/1310.4546
               float keep_prob =
                   (std::sqrt(word_freq / (subsample_ * corpus_size_)) + 1) *
@@ -159,7 +404,7 @@ class SkipgramWord2vecOp : public OpKernel {
                 continue;
               }
             }
-            sentence_[i] = corpus_[example_pos_];
+            sentence_[i] = corpus_data_[example_pos_];
           }
         }
         const int32 skip = 1 + rng_.Uniform(window_size_);
@@ -192,16 +437,100 @@ class SkipgramWord2vecOp : public OpKernel {
                                      " contains too little data: ",
                                      corpus_size_, " words");
     }
+    const size_t num_words = word_freq.size();
+    std::unordered_map<string, int32> word_id;
+    SetVocabulary(&word_freq, &word_id);
+    LOG(INFO) << "Data file: " << filename << " contains " << data.size()
+              << " bytes, " << corpus_size_ << " words, " << num_words
+              << " unique words, " << vocab_size_ - 1
+              << " unique frequent words.";
+    corpus_.reserve(corpus_size_);
+    input = data;
+    while (ScanWord(&input, &w)) {
+      corpus_.push_back(gtl::FindWithDefault(word_id, w, kUnkId));
+    }
+    corpus_data_ = corpus_.data();
+    sentence_.resize(kSentenceSize);
+    return Status::OK();
+  }
+
+  // Like Init(), but never holds the corpus in memory.  The vocabulary is
+  // counted in a pass over the corpus, unless it is read from vocab_file.
+  // The corpus is then written to ids_file as word ids, unless vocab_file is
+  // given and the file already holds the ids of the unchanged corpus for that
+  // vocabulary, and the ids file is mapped.
+  Status InitStreaming(Env* env, const string& filename,
+                       const string& vocab_file, const string& ids_file) {
+    std::unordered_map<string, int32> word_id;
+    if (vocab_file.empty()) {
+      int64 num_words = 0;
+      std::unordered_map<string, int32> word_freq;
+      TF_RETURN_IF_ERROR(ForEachWord(
+          env, filename, [&word_freq, &num_words](const string& w) {
+            ++(word_freq[w]);
+            ++num_words;
+          }));
+      corpus_size_ = num_words;
+      const size_t num_unique = word_freq.size();
+      SetVocabulary(&word_freq, &word_id);
+      LOG(INFO) << "Data file: " << filename << " contains " << corpus_size_
+                << " words, " << num_unique << " unique words, "
+                << vocab_size_ - 1 << " unique frequent words.";
+    } else {
+      TF_RETURN_IF_ERROR(LoadVocabulary(env, vocab_file));
+    }
+
+    FileStatistics corpus_stat;
+    TF_RETURN_IF_ERROR(env->Stat(filename, &corpus_stat));
+    IdsHeader header;
+    header.magic = kIdsMagic;
+    header.vocab_size = vocab_size_;
+    header.vocab_fingerprint = VocabFingerprint();
+    header.corpus_length = corpus_stat.length;
+    header.corpus_mtime_nsec = corpus_stat.mtime_nsec;
+    if (vocab_file.empty() || !HasIdsHeader(env, ids_file, header)) {
+      if (!vocab_file.empty()) {
+        LOG(INFO) << "Writing " << ids_file << " for vocabulary "
+                  << vocab_file << " and the current " << filename;
+        for (int32 id = 0; id < vocab_size_; ++id) {
+          if (id != kUnkId) word_id[word_.flat<string>()(id)] = id;
+        }
+      }
+      TF_RETURN_IF_ERROR(WriteIds(env, filename, word_id, header, ids_file));
+    }
+
+    TF_RETURN_IF_ERROR(
+        env->NewReadOnlyMemoryRegionFromFile(ids_file, &corpus_region_));
+    const uint64 length = corpus_region_->length();
+    if (length < sizeof(header) || (length - sizeof(header)) % sizeof(int32)) {
+      return errors::DataLoss("The ids file ", ids_file, " is truncated");
+    }
+    corpus_size_ = (length - sizeof(header)) / sizeof(int32);
+    corpus_data_ = reinterpret_cast<const int32*>(
+        static_cast<const char*>(corpus_region_->data()) + sizeof(header));
+    if (corpus_size_ < window_size_ * 10) {
+      return errors::InvalidArgument("The ids file ", ids_file,
+                                     " contains too little data: ",
+                                     corpus_size_, " words");
+    }
+    LOG(INFO) << "Streaming " << corpus_size_ << " words of " << filename
+              << " from " << ids_file;
+    sentence_.resize(kSentenceSize);
+    return Status::OK();
+  }
+
+  // Sets the vocabulary to UNK followed by the words that occur at least
+  // min_count_ times, most frequent first, and fills word_id with their ids.
+  // word_freq, which holds the number of times each word occurs in the
+  // corpus, is cleared along the way.
+  void SetVocabulary(std::unordered_map<string, int32>* word_freq,
+                     std::unordered_map<string, int32>* word_id) {
     typedef std::pair<string, int32> WordFreq;
     std::vector<WordFreq> ordered;
-    for (const auto& p : word_freq) {
+    for (const auto& p : *word_freq) {
       if (p.second >= min_count_) ordered.push_back(p);
     }
-    LOG(INFO) << "Data file: " << filename << " contains " << data.size()
-              << " bytes, " << corpus_size_ << " words, " << word_freq.size()
-              << " unique words, " << ordered.size()
-              << " unique frequent words.";
-    word_freq.clear();
+    word_freq->clear();
     std::sort(ordered.begin(), ordered.end(),
               [](const WordFreq& x, const WordFreq& y) {
                 return x.second > y.second;
@@ -210,8 +539,6 @@ class SkipgramWord2vecOp : public OpKernel {
     Tensor word(DT_STRING, TensorShape({vocab_size_}));
     Tensor freq(DT_INT32, TensorShape({vocab_size_}));
     word.flat<string>()(0) = "UNK";
-    static const int32 kUnkId = 0;
-    std::unordered_map<string, int32> word_id;
     int64 total_counted = 0;
     for (std::size_t i = 0; i < ordered.size(); ++i) {
       const auto& w = ordered[i].first;
@@ -220,44 +547,392 @@ class SkipgramWord2vecOp : public OpKernel {
       auto word_count = ordered[i].second;
       freq.flat<int32>()(id) = word_count;
       total_counted += word_count;
-      word_id[w] = id;
+      (*word_id)[w] = id;
     }
     freq.flat<int32>()(kUnkId) = corpus_size_ - total_counted;
     word_ = word;
     freq_ = freq;
-    corpus_.reserve(corpus_size_);
-    input = data;
-    while (ScanWord(&input, &w)) {
-      corpus_.push_back(gtl::FindWithDefault(word_id, w, kUnkId));
+  }
+
+  // Sets the vocabulary from a file with a word and its count on each line,
+  // UNK first, as saved by word2vec_optimized.py.
+  Status LoadVocabulary(Env* env, const string& vocab_file) {
+    std::vector<string> words;
+    std::vector<int64> counts;
+    TF_RETURN_IF_ERROR(ReadVocabFile(env, vocab_file, &words, &counts));
+    vocab_size_ = static_cast<int32>(words.size());
+    Tensor word(DT_STRING, TensorShape({vocab_size_}));
+    Tensor freq(DT_INT32, TensorShape({vocab_size_}));
+    for (int32 id = 0; id < vocab_size_; ++id) {
+      word.flat<string>()(id) = words[id];
+      freq.flat<int32>()(id) = counts[id];
     }
-    precalc_examples_.resize(kPrecalc);
-    sentence_.resize(kSentenceSize);
+    word_ = word;
+    freq_ = freq;
+    LOG(INFO) << "Vocabulary file: " << vocab_file << " contains "
+              << vocab_size_ - 1 << " words and UNK.";
     return Status::OK();
   }
+
+  // Returns a fingerprint of the words of the vocabulary and their counts.
+  uint64 VocabFingerprint() const {
+    uint64 fingerprint = vocab_size_;
+    for (int32 id = 0; id < vocab_size_; ++id) {
+      const string& word = word_.flat<string>()(id);
+      fingerprint = Hash64Combine(fingerprint, Hash64(word));
+      fingerprint = Hash64Combine(fingerprint, freq_.flat<int32>()(id));
+    }
+    return fingerprint;
+  }
+
+  // Returns whether ids_file exists and starts with the given header, i.e.
+  // holds the ids of the current corpus in the current vocabulary.  The ids
+  // were checked against the vocabulary when the file was written.
+  static bool HasIdsHeader(Env* env, const string& ids_file,
+                           const IdsHeader& header) {
+    std::unique_ptr<RandomAccessFile> file;
+    if (!env->NewRandomAccessFile(ids_file, &file).ok()) return false;
+    char scratch[sizeof(IdsHeader)];
+    StringPiece read;
+    if (!file->Read(0, sizeof(scratch), &read, scratch).ok() ||
+        read.size() != sizeof(scratch)) {
+      return false;
+    }
+    IdsHeader existing;
+    memcpy(&existing, read.data(), sizeof(existing));
+    return existing.magic == header.magic &&
+           existing.vocab_size == header.vocab_size &&
+           existing.vocab_fingerprint == header.vocab_fingerprint &&
+           existing.corpus_length == header.corpus_length &&
+           existing.corpus_mtime_nsec == header.corpus_mtime_nsec;
+  }
+
+  // Writes the header and then the ids of the words of the corpus to
+  // ids_file as raw int32s, checking that each is in the vocabulary, so that
+  // the training never has to.  The file is written under a temporary name
+  // and then renamed, so that a partly written file is never mistaken for a
+  // complete one.
+  Status WriteIds(Env* env, const string& filename,
+                  const std::unordered_map<string, int32>& word_id,
+                  const IdsHeader& header, const string& ids_file) {
+    const string tmp_file = strings::StrCat(ids_file, ".tmp");
+    std::unique_ptr<WritableFile> out;
+    TF_RETURN_IF_ERROR(env->NewWritableFile(tmp_file, &out));
+    TF_RETURN_IF_ERROR(out->Append(StringPiece(
+        reinterpret_cast<const char*>(&header), sizeof(header))));
+    std::vector<int32> ids;
+    ids.reserve(kStreamChunkSize / sizeof(int32));
+    Status status;
+    auto flush = [&out, &ids, &status]() {
+      status.Update(out->Append(StringPiece(
+          reinterpret_cast<const char*>(ids.data()),
+          ids.size() * sizeof(int32))));
+      ids.clear();
+    };
+    const int32 vocab_size = vocab_size_;
+    TF_RETURN_IF_ERROR(ForEachWord(
+        env, filename,
+        [&word_id, &ids, &flush, &status, vocab_size](const string& w) {
+          const int32 id = gtl::FindWithDefault(word_id, w, kUnkId);
+          if (id < 0 || id >= vocab_size) {
+            status.Update(errors::Internal("The id ", id, " of ", w,
+                                           " is outside the vocabulary of ",
+                                           vocab_size, " words"));
+          }
+          ids.push_back(id);
+          if (ids.size() == ids.capacity()) flush();
+        }));
+    flush();
+    TF_RETURN_IF_ERROR(status);
+    TF_RETURN_IF_ERROR(out->Close());
+    return env->RenameFile(tmp_file, ids_file);
+  }
 };
 
 REGISTER_KERNEL_BUILDER(Name("SkipgramWord2vec").Device(DEVICE_CPU), SkipgramWord2vecOp);
 
+namespace {
+
+// Sizes of the table of sigmoid values used by the training kernel, as in the
+// original word2vec: the table covers [-kMaxExp, kMaxExp], beyond which the
+// sigmoid is taken to be 0 or 1.
+const int kSigmoidTableSize = 1000;
+const float kMaxExp = 6.f;
+
+// Returns the table of sigmoid values, which is computed on first use.  It
+// has kSigmoidTableSize + 1 entries: a dot just below kMaxExp rounds to the
+// index kSigmoidTableSize once scaled in float.
+const float* SigmoidTable() {
+  static const std::vector<float>* table = [] {
+    auto* t = new std::vector<float>(kSigmoidTableSize + 1);
+    for (int i = 0; i <= kSigmoidTableSize; ++i) {
+      const float x = (2.f * i / kSigmoidTableSize - 1.f) * kMaxExp;
+      (*t)[i] = 1.f / (1.f + std::exp(-x));
+    }
+    return t;
+  }();
+  return table->data();
+}
+
+// Returns the gradient scale for a target with the given label and a logit of
+// dot: (label - sigmoid(dot)) * lr.
+inline float Gradient(const float* sigmoid, float dot, float label, float lr) {
+  if (dot >= kMaxExp) return (label - 1.f) * lr;
+  if (dot <= -kMaxExp) return label * lr;
+  const int i = static_cast<int>((dot + kMaxExp) *
+                                 (kSigmoidTableSize / kMaxExp / 2));
+  return (label - sigmoid[i]) * lr;
+}
+
+// Vector kernels for the training op: the widest the compiler targets, with a
+// scalar fallback.  Build with -march=native to get AVX2 or AVX-512.
+#if defined(__AVX512F__)
+
+inline float Dot(const float* x, const float* y, int64 n) {
+  __m512 acc0 = _mm512_setzero_ps();
+  __m512 acc1 = _mm512_setzero_ps();
+  int64 i = 0;
+  for (; i + 32 <= n; i += 32) {
+    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i),
+                           acc0);
+    acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16),
+                           _mm512_loadu_ps(y + i + 16), acc1);
+  }
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i),
+                           acc0);
+  }
+  if (i < n) {
+    const __mmask16 m = (1u << (n - i)) - 1;
+    acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + i),
+                           _mm512_maskz_loadu_ps(m, y + i), acc1);
+  }
+  return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+// y += a * x.
+inline void Axpy(float a, const float* x, float* y, int64 n) {
+  const __m512 va = _mm512_set1_ps(a);
+  int64 i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i),
+                                            _mm512_loadu_ps(y + i)));
+  }
+  if (i < n) {
+    const __mmask16 m = (1u << (n - i)) - 1;
+    _mm512_mask_storeu_ps(
+        y + i, m,
+        _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, x + i),
+                        _mm512_maskz_loadu_ps(m, y + i)));
+  }
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+inline float Dot(const float* x, const float* y, int64 n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  int64 i = 0;
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i),
+                           acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8),
+                           _mm256_loadu_ps(y + i + 8), acc1);
+  }
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i),
+                           acc0);
+  }
+  const __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+                          _mm256_extractf128_ps(acc, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+  float result = _mm_cvtss_f32(sum);
+  for (; i < n; ++i) result += x[i] * y[i];
+  return result;
+}
+
+// y += a * x.
+inline void Axpy(float a, const float* x, float* y, int64 n) {
+  const __m256 va = _mm256_set1_ps(a);
+  int64 i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i),
+                                            _mm256_loadu_ps(y + i)));
+  }
+  for (; i < n; ++i) y[i] += a * x[i];
+}
+
+#elif defined(__SSE2__)
+
+inline float Dot(const float* x, const float* y, int64 n) {
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  int64 i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i),
+                                       _mm_loadu_ps(y + i)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4),
+                                       _mm_loadu_ps(y + i + 4)));
+  }
+  __m128 sum = _mm_add_ps(acc0, acc1);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  float result = _mm_cvtss_f32(sum);
+  for (; i < n; ++i) result += x[i] * y[i];
+  return result;
+}
+
+// y += a * x.
+inline void Axpy(float a, const float* x, float* y, int64 n) {
+  const __m128 va = _mm_set1_ps(a);
+  int64 i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i),
+                                    _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+  }
+  for (; i < n; ++i) y[i] += a * x[i];
+}
+
+#else
+
+inline float Dot(const float* x, const float* y, int64 n) {
+  float result = 0;
+  for (int64 i = 0; i < n; ++i) result += x[i] * y[i];
+  return result;
+}
+
+// y += a * x.
+inline void Axpy(float a, const float* x, float* y, int64 n) {
+  for (int64 i = 0; i < n; ++i) y[i] += a * x[i];
+}
+
+#endif
+
+}  // end namespace
+
+// Samples word ids in proportion to their counts raised to the 3/4 power,
+// as word2vec's negative sampling does, in constant time per sample with
+// Walker's alias method.  A sampler built from a vocabulary file is shared
+// through the resource manager by all the kernels that name the file.
+class UnigramSampler : public ResourceBase {
+ public:
+  explicit UnigramSampler(const std::vector<int64>& counts)
+      : threshold_(counts.size()), alias_(counts.size()) {
+    const int64 n = counts.size();
+    std::vector<double> p(n);
+    double total = 0;
+    for (int64 i = 0; i < n; ++i) {
+      p[i] = std::pow(static_cast<double>(counts[i]), 0.75);
+      total += p[i];
+    }
+
+    // Scale the probabilities so that they average to 1, and fill the
+    // columns that are short of 1 from those that are over.
+    std::vector<int32> small, large;
+    for (int64 i = 0; i < n; ++i) {
+      p[i] = total > 0 ? p[i] * n / total : 1.0;
+      (p[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+      const int32 s = small.back();
+      small.pop_back();
+      const int32 l = large.back();
+      threshold_[s] = static_cast<uint32>(p[s] * 4294967296.0);
+      alias_[s] = l;
+      p[l] -= 1.0 - p[s];
+      if (p[l] < 1.0) {
+        large.pop_back();
+        small.push_back(l);
+      }
+    }
+
+    // The remaining columns are full, up to rounding.
+    for (const int32 i : small) SetFull(i);
+    for (const int32 i : large) SetFull(i);
+  }
+
+  // Creates a sampler from a vocabulary file with a word and its count on
+  // each line, as saved by word2vec_optimized.py.
+  static Status Create(Env* env, const string& filename,
+                       UnigramSampler** sampler) {
+    std::vector<int64> counts;
+    TF_RETURN_IF_ERROR(ReadVocabFile(env, filename, nullptr, &counts));
+    *sampler = new UnigramSampler(counts);
+    return Status::OK();
+  }
+
+  int64 num() const { return alias_.size(); }
+
+  // Fills samples[0, n) with word ids, using two 32-bit values of rnd for
+  // each: one picks a column of the table and the other picks between the
+  // column's word and its alias.
+  void Sample(random::PhiloxRandom* rnd, int32* samples, int n) const {
+    const uint64 size = alias_.size();
+    for (int i = 0; i < n; i += 2) {
+      const random::PhiloxRandom::ResultType r = (*rnd)();
+      samples[i] = Pick((r[0] * size) >> 32, r[1]);
+      if (i + 1 < n) samples[i + 1] = Pick((r[2] * size) >> 32, r[3]);
+    }
+  }
+
+  string DebugString() override {
+    return strings::StrCat("UnigramSampler of ", alias_.size(), " words");
+  }
+
+ private:
+  int32 Pick(uint64 column, uint32 u) const {
+    return u < threshold_[column] ? column : alias_[column];
+  }
+
+  void SetFull(int32 i) {
+    threshold_[i] = ~0u;
+    alias_[i] = i;
+  }
+
+  // A column i of the table holds word i with probability
+  // threshold_[i] / 2^32, and word alias_[i] otherwise.
+  std::vector<uint32> threshold_;
+  std::vector<int32> alias_;
+};
+
 class NegTrainWord2vecOp : public OpKernel {
  public:
   explicit NegTrainWord2vecOp(OpKernelConstruction* ctx) : OpKernel(ctx) {
     base_.Init(0, 0);
 
     OP_REQUIRES_OK(ctx, ctx->GetAttr("num_negative_samples", &num_samples_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("hogwild", &hogwild_));
 
+    string vocab_file;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("vocab_file", &vocab_file));
     std::vector<int32> vocab_count;
     OP_REQUIRES_OK(ctx, ctx->GetAttr("vocab_count", &vocab_count));
+    OP_REQUIRES(ctx, vocab_file.empty() != vocab_count.empty(),
+                errors::InvalidArgument(
+                    "Exactly one of vocab_file and vocab_count must be set"));
 
-    std::vector<float> vocab_weights;
-    vocab_weights.reserve(vocab_count.size());
-    for (const auto& f : vocab_count) {
-      float r = std::pow(static_cast<float>(f), 0.75f);
-      vocab_weights.push_back(r);
+    if (vocab_file.empty()) {
+      sampler_ = new UnigramSampler(
+          std::vector<int64>(vocab_count.begin(), vocab_count.end()));
+    } else {
+      ResourceMgr* rm = ctx->resource_manager();
+      OP_REQUIRES_OK(ctx, rm->LookupOrCreate<UnigramSampler>(
+                              rm->default_container(),
+                              strings::StrCat("unigram_sampler:", vocab_file),
+                              &sampler_,
+                              [ctx, &vocab_file](UnigramSampler** sampler) {
+                                return UnigramSampler::Create(
+                                    ctx->env(), vocab_file, sampler);
+                              }));
     }
-    sampler_ = new random::DistributionSampler(vocab_weights);
   }
 
-  ~NegTrainWord2vecOp() { delete sampler_; }
+  ~NegTrainWord2vecOp() {
+    if (sampler_ != nullptr) sampler_->Unref();
+  }
 
   void Compute(OpKernelContext* ctx) override {
     Tensor w_in = ctx->mutable_input(0, false);
@@ -276,8 +951,6 @@ class NegTrainWord2vecOp : public OpKernel {
     OP_REQUIRES(ctx, TensorShapeUtils::IsScalar(learning_rate.shape()),
                 errors::InvalidArgument("Must be a scalar"));
 
-    auto Tw_in = w_in.matrix<float>();
-    auto Tw_out = w_out.matrix<float>();
     auto Texamples = examples.flat<int32>();
     auto Tlabels = labels.flat<int32>();
     auto lr = learning_rate.scalar<float>()();
@@ -288,65 +961,78 @@ class NegTrainWord2vecOp : public OpKernel {
                 errors::InvalidArgument("vocab_size mismatches: ", vocab_size,
                                         " vs. ", sampler_->num()));
 
-    // Gradient accumulator for v_in.
-    Tensor buf(DT_FLOAT, TensorShape({dims}));
-    auto Tbuf = buf.flat<float>();
+    float* const in = w_in.flat<float>().data();
+    float* const out = w_out.flat<float>().data();
+    auto train = [this, in, out, Texamples, Tlabels, lr, vocab_size, dims](
+        int64 start, int64 limit) {
+      Train(in, out, Texamples, Tlabels, lr, vocab_size, dims, start, limit);
+    };
+
+    if (hogwild_) {
+      // Like word2vec's own threads, the shards update w_in and w_out without
+      // locks, since any two examples rarely touch the same rows.
+      const int64 cost_per_example = 6 * (num_samples_ + 1) * dims;
+      auto worker_threads = *(ctx->device()->tensorflow_cpu_worker_threads());
+      Shard(worker_threads.num_threads, worker_threads.workers, batch_size,
+            cost_per_example, train);
+    } else {
+      train(0, batch_size);
+    }
+  }
+
+ private:
+  // Trains on examples [start, limit) of the batch.
+  void Train(float* in, float* out, TTypes<int32>::ConstFlat Texamples,
+             TTypes<int32>::ConstFlat Tlabels, float lr, int64 vocab_size,
+             int64 dims, int64 start, int64 limit) {
+    // Sample() uses 2 random 32-bit values per negative sample, drawn 4 at a
+    // time.
+    auto rnd = base_.ReserveSamples32((limit - start) * (num_samples_ + 1) * 2);
+    gtl::InlinedVector<int32, 64> samples(num_samples_);
 
-    // Scalar buffer to hold sigmoid(+/- dot).
-    Tensor g_buf(DT_FLOAT, TensorShape({}));
-    auto g = g_buf.scalar<float>();
+    const float* const sigmoid = SigmoidTable();
 
-    // The following loop needs 2 random 32-bit values per negative
-    // sample.  We reserve 8 values per sample just in case the
-    // underlying implementation changes.
-    auto rnd = base_.ReserveSamples32(batch_size * num_samples_ * 8);
-    random::SimplePhilox srnd(&rnd);
+    // Gradient accumulator for v_in; on the stack for the usual dimensions.
+    gtl::InlinedVector<float, 512> buf(dims);
 
-    for (int64 i = 0; i < batch_size; ++i) {
+    for (int64 i = start; i < limit; ++i) {
       const int32 example = Texamples(i);
       DCHECK(0 <= example && example < vocab_size) << example;
       const int32 label = Tlabels(i);
       DCHECK(0 <= label && label < vocab_size) << label;
-      auto v_in = Tw_in.chip<0>(example);
+      float* const v_in = in + example * dims;
+      std::fill(buf.begin(), buf.end(), 0.f);
+      sampler_->Sample(&rnd, samples.data(), num_samples_);
 
-      // Positive: example predicts label.
+      // Target 0 is the label, which the example predicts, and the rest are
+      // the negative samples, which it should not.  For a target with label
+      // t (1 or 0):
       //   forward: x = v_in' * v_out
-      //            l = log(sigmoid(x))
-      //   backward: dl/dx = g = sigmoid(-x)
+      //            l = t * log(sigmoid(x)) + (1 - t) * log(sigmoid(-x))
+      //   backward: dl/dx = g = t - sigmoid(x)
       //             dl/d(v_in) = g * v_out'
       //             dl/d(v_out) = v_in' * g
-      {
-        auto v_out = Tw_out.chip<0>(label);
-        auto dot = (v_in * v_out).sum();
-        g = (dot.exp() + 1.f).inverse();
-        Tbuf = v_out * (g() * lr);
-        v_out += v_in * (g() * lr);
-      }
-
-      // Negative samples:
-      //   forward: x = v_in' * v_sample
-      //            l = log(sigmoid(-x))
-      //   backward: dl/dx = g = -sigmoid(x)
-      //             dl/d(v_in) = g * v_out'
-      //             dl/d(v_out) = v_in' * g
-      for (int j = 0; j < num_samples_; ++j) {
-        const int sample = sampler_->Sample(&srnd);
-        if (sample == label) continue;  // Skip.
-        auto v_sample = Tw_out.chip<0>(sample);
-        auto dot = (v_in * v_sample).sum();
-        g = -((-dot).exp() + 1.f).inverse();
-        Tbuf += v_sample * (g() * lr);
-        v_sample += v_in * (g() * lr);
+      for (int j = 0; j <= num_samples_; ++j) {
+        int32 target = label;
+        if (j > 0) {
+          target = samples[j - 1];
+          if (target == label) continue;  // Skip.
+        }
+        float* const v_out = out + target * dims;
+        const float g =
+            Gradient(sigmoid, Dot(v_in, v_out, dims), j == 0 ? 1.f : 0.f, lr);
+        Axpy(g, v_out, buf.data(), dims);
+        Axpy(g, v_in, v_out, dims);
       }
 
       // Applies the gradient on v_in.
-      v_in += Tbuf;
+      Axpy(1.f, buf.data(), v_in, dims);
     }
   }
 
- private:
   int32 num_samples_ = 0;
-  random::DistributionSampler* sampler_ = nullptr;
+  bool hogwild_ = false;
+  UnigramSampler* sampler_ = nullptr;
   GuardedPhiloxRandom base_;
 };
 
@@ -0,0 +1,100 @@
+# Copyright 2015 The TensorFlow Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+"""Benchmarks the NegTrainWord2vec kernel in examples/sec.
+
+Runs the serial training kernel on random batches over a large vocabulary at
+several embedding sizes.  To compare against another build of the kernel,
+e.g. the Eigen one of a revision before the vectorized kernel, build its
+word2vec_ops.so elsewhere and run this script with --ops_library pointing to
+it:
+
+  python word2vec_kernels_benchmark.py
+  python word2vec_kernels_benchmark.py --ops_library=/tmp/eigen/word2vec_ops.so
+"""
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import os
+import time
+
+from six.moves import xrange  # pylint: disable=redefined-builtin
+
+import numpy as np
+import tensorflow as tf
+
+flags = tf.app.flags
+
+flags.DEFINE_string("ops_library",
+                    os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                                 "word2vec_ops.so"),
+                    "The word2vec ops library to benchmark.")
+flags.DEFINE_string("dims", "100,128,200,300",
+                    "Comma-separated embedding sizes.")
+flags.DEFINE_integer("vocab_size", 100000, "Number of words.")
+flags.DEFINE_integer("batch_size", 1000, "Training examples of each step.")
+flags.DEFINE_integer("num_steps", 200, "Timed steps at each size.")
+flags.DEFINE_integer("num_neg_samples", 5,
+                     "Negative samples per training example.")
+
+FLAGS = flags.FLAGS
+
+
+def benchmark(word2vec, dims):
+  """Returns the examples/sec of the kernel with the embedding size."""
+  rng = np.random.RandomState(0)
+  # Zipfian counts, as in text.
+  vocab_count = (1e7 / np.arange(1, FLAGS.vocab_size + 1)).astype(np.int64)
+  with tf.Graph().as_default(), tf.Session() as session:
+    w_in = tf.Variable(
+        tf.random_uniform([FLAGS.vocab_size, dims], -0.5 / dims, 0.5 / dims,
+                          seed=1))
+    w_out = tf.Variable(
+        tf.random_uniform([FLAGS.vocab_size, dims], -0.5 / dims, 0.5 / dims,
+                          seed=2))
+    examples = tf.constant(
+        rng.randint(FLAGS.vocab_size, size=FLAGS.batch_size), dtype=tf.int32)
+    labels = tf.constant(
+        rng.randint(FLAGS.vocab_size, size=FLAGS.batch_size), dtype=tf.int32)
+    train = word2vec.neg_train_word2vec(
+        w_in,
+        w_out,
+        examples,
+        labels,
+        0.025,
+        vocab_count=vocab_count.tolist(),
+        num_negative_samples=FLAGS.num_neg_samples)
+    tf.global_variables_initializer().run()
+
+    # Warm up, e.g. to build the sigmoid table.
+    for _ in xrange(10):
+      session.run(train)
+    start = time.time()
+    for _ in xrange(FLAGS.num_steps):
+      session.run(train)
+    return FLAGS.num_steps * FLAGS.batch_size / (time.time() - start)
+
+
+def main(_):
+  word2vec = tf.load_op_library(FLAGS.ops_library)
+  print("Benchmarking %s" % FLAGS.ops_library)
+  print("%6s %14s" % ("dims", "examples/sec"))
+  for dims in [int(d) for d in FLAGS.dims.split(",")]:
+    print("%6d %14.0f" % (dims, benchmark(word2vec, dims)))
+
+
+if __name__ == "__main__":
+  tf.app.run()
@@ -0,0 +1,152 @@
+# Copyright 2015 The TensorFlow Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+
+"""Tests for the word2vec training kernel."""
+
+from __future__ import absolute_import
+from __future__ import division
+from __future__ import print_function
+
+import os
+
+import numpy as np
+import tensorflow as tf
+
+word2vec = tf.load_op_library(os.path.join(os.path.dirname(os.path.realpath(__file__)), 'word2vec_ops.so'))
+
+
+def sigmoid_table_gradient(dot, label, lr):
+  """Returns (label - sigmoid(dot)) * lr, with the kernel's sigmoid table."""
+  if dot >= 6:
+    return (label - 1) * lr
+  if dot <= -6:
+    return label * lr
+  i = int((dot + 6) * (1000 / 6 / 2))
+  x = (2 * i / 1000 - 1) * 6
+  return (label - 1 / (1 + np.exp(-x))) * lr
+
+
+def reference_train(w_in, w_out, examples, labels, lr, negatives):
+  """Trains like NegTrainWord2vec, with the given negatives per example."""
+  w_in = w_in.astype(np.float64)
+  w_out = w_out.astype(np.float64)
+  for example, label, samples in zip(examples, labels, negatives):
+    v_in = w_in[example]
+    buf = np.zeros_like(v_in)
+    for j, target in enumerate([label] + list(samples)):
+      if j > 0 and target == label:
+        continue
+      g = sigmoid_table_gradient(np.dot(v_in, w_out[target]),
+                                 1 if j == 0 else 0, lr)
+      buf += g * w_out[target]
+      w_out[target] += g * v_in
+    w_in[example] += buf
+  return w_in, w_out
+
+
+class NegTrainWord2vecTest(tf.test.TestCase):
+
+  def _train(self, w_in, w_out, examples, labels, lr, vocab_count,
+             num_negative_samples, hogwild=False):
+    config = tf.ConfigProto(intra_op_parallelism_threads=4)
+    with tf.Graph().as_default(), tf.Session(config=config) as session:
+      v_in = tf.Variable(w_in)
+      v_out = tf.Variable(w_out)
+      train = word2vec.neg_train_word2vec(
+          v_in,
+          v_out,
+          examples,
+          labels,
+          lr,
+          vocab_count=vocab_count,
+          num_negative_samples=num_negative_samples,
+          hogwild=hogwild)
+      tf.global_variables_initializer().run()
+      session.run(train)
+      return session.run([v_in, v_out])
+
+  def testMatchesReference(self):
+    # Only word 3 has a count, so every negative sample is word 3.  The
+    # dimensions cover the vector kernels' remainders and masked tails.
+    vocab_size = 10
+    vocab_count = [0, 0, 0, 5, 0, 0, 0, 0, 0, 0]
+    examples = np.array([0, 1, 2, 1, 4, 5], dtype=np.int32)
+    labels = np.array([6, 7, 3, 8, 9, 6], dtype=np.int32)
+    num_negative_samples = 3
+    lr = 0.1
+    for dims in [1, 3, 7, 8, 15, 16, 17, 31, 33, 100, 301]:
+      rng = np.random.RandomState(dims)
+      w_in = rng.uniform(-0.5, 0.5, (vocab_size, dims)).astype(np.float32)
+      w_out = rng.uniform(-0.5, 0.5, (vocab_size, dims)).astype(np.float32)
+      got_in, got_out = self._train(w_in, w_out, examples, labels, lr,
+                                    vocab_count, num_negative_samples)
+      want_in, want_out = reference_train(
+          w_in, w_out, examples, labels, lr,
+          [[3] * num_negative_samples] * len(examples))
+      self.assertAllClose(want_in, got_in, atol=1e-3)
+      self.assertAllClose(want_out, got_out, atol=1e-3)
+
+  def testHogwildMatchesReference(self):
+    # The examples and labels are all distinct and there are no negative
+    # samples, so the shards touch disjoint rows and the result is
+    # deterministic.
+    batch_size = 64
+    vocab_size = 2 * batch_size
+    examples = np.arange(batch_size, dtype=np.int32)
+    labels = np.arange(batch_size, vocab_size, dtype=np.int32)
+    lr = 0.1
+    for dims in [17, 100]:
+      rng = np.random.RandomState(dims)
+      w_in = rng.uniform(-0.5, 0.5, (vocab_size, dims)).astype(np.float32)
+      w_out = rng.uniform(-0.5, 0.5, (vocab_size, dims)).astype(np.float32)
+      got_in, got_out = self._train(w_in, w_out, examples, labels, lr,
+                                    [1] * vocab_size, 0, hogwild=True)
+      want_in, want_out = reference_train(w_in, w_out, examples, labels, lr,
+                                          [[]] * batch_size)
+      self.assertAllClose(want_in, got_in, atol=1e-3)
+      self.assertAllClose(want_out, got_out, atol=1e-3)
+
+  def testSamplesNegativesByCountToThe3Over4(self):
+    # With w_in all zeros, every logit is 0, so each negative sample t of an
+    # example adds exactly -lr / 2 * w_out[t] to the example's row of w_in.
+    # The sampled words' rows of w_out are one-hot, so the rows of w_in count
+    # the samples of each word.  The examples' own words have no count, so
+    # they are never sampled, and are their own labels, whose rows of w_out
+    # are zero.
+    counts = [0, 1, 3, 10, 100, 7]
+    num_words = len(counts)
+    batch_size = 2000
+    # Odd, so that the last of each example's samples uses half a draw.
+    num_negative_samples = 101
+    vocab_size = num_words + batch_size
+    w_in = np.zeros((vocab_size, num_words), dtype=np.float32)
+    w_out = np.zeros((vocab_size, num_words), dtype=np.float32)
+    w_out[:num_words] = np.eye(num_words)
+    examples = np.arange(num_words, vocab_size, dtype=np.int32)
+    got_in, got_out = self._train(w_in, w_out, examples, examples, 1.0,
+                                  counts + [0] * batch_size,
+                                  num_negative_samples)
+    self.assertAllEqual(w_out, got_out)
+
+    samples = -2 * got_in[num_words:].sum(axis=0)
+    self.assertEqual(batch_size * num_negative_samples, samples.sum())
+    self.assertEqual(0, samples[0])
+    want = np.power(counts, 0.75)
+    want *= batch_size * num_negative_samples / want.sum()
+    self.assertAllClose(want, samples, rtol=0.05)
+
+
+if __name__ == "__main__":
+  tf.test.main()
@@ -31,6 +31,9 @@ REGISTER_OP("SkipgramWord2vec")
     .Attr("window_size: int = 5")
     .Attr("min_count: int = 5")
     .Attr("subsample: float = 1e-3")
+    .Attr("streaming: bool = false")
+    .Attr("vocab_file: string = ''")
+    .Attr("ids_file: string = ''")
     .Doc(R"doc(
 Parses a text file and creates a batch of examples.
 
@@ -48,6 +51,17 @@ min_count: The minimum number of word occurrences for it to be included in the
     vocabulary.
 subsample: Threshold for word occurrence. Words that appear with higher
     frequency will be randomly down-sampled. Set to 0 to disable.
+streaming: If true, the corpus is never held in memory.  It is read a chunk at
+    a time, and its word ids are written to ids_file, which is then
+    memory-mapped for training.
+vocab_file: When streaming, a vocabulary file with a word and its count on
+    each line, UNK first, as saved by word2vec_optimized.py.  It is used
+    instead of counting the words of the corpus.
+ids_file: When streaming, the file of the corpus's word ids; filename with
+    ".ids" appended by default.  If vocab_file is set and ids_file exists and
+    was written with the same vocabulary from filename as it is now (same
+    size and modification time), it is used as is; otherwise it is written
+    again.
 )doc");
 
 REGISTER_OP("NegTrainWord2vec")
@@ -57,8 +71,10 @@ REGISTER_OP("NegTrainWord2vec")
     .Input("labels: int32")
     .Input("lr: float")
     .SetIsStateful()
-    .Attr("vocab_count: list(int)")
+    .Attr("vocab_count: list(int) = []")
+    .Attr("vocab_file: string = ''")
     .Attr("num_negative_samples: int")
+    .Attr("hogwild: bool = false")
     .Doc(R"doc(
 Training via negative sampling.
 
@@ -67,7 +83,12 @@ w_out: output word embedding.
 examples: A vector of word ids.
 labels: A vector of word ids.
 vocab_count: Count of words in the vocabulary.
+vocab_file: A vocabulary file with a word and its count on each line, used
+    instead of vocab_count.  The sampling table built from the file is shared
+    by all the ops that use it.
 num_negative_samples: Number of negative samples per example.
+hogwild: If true, the batch is sharded across the intra-op thread pool, and
+    the shards update w_in and w_out concurrently without locking.
 )doc");
 
 }  // end namespace tensorflow
@@ -65,6 +65,18 @@ flags.DEFINE_integer("batch_size", 500,
                      "(no minibatching).")
 flags.DEFINE_integer("concurrent_steps", 12,
                      "The number of concurrent training steps.")
+flags.DEFINE_boolean("hogwild", False,
+                     "If true, each training step shards its batch across the "
+                     "intra-op threads, which update the embeddings without "
+                     "locking.")
+flags.DEFINE_boolean("streaming", False,
+                     "If true, the training data is never held in memory: its "
+                     "word ids are written to a file, which is memory-mapped "
+                     "for training.")
+flags.DEFINE_string("train_vocab", None,
+                    "With --streaming, a vocab.txt saved by an earlier run, "
+                    "used instead of counting the words of the training "
+                    "data.")
 flags.DEFINE_integer("window_size", 5,
                      "The number of words to predict to the left and right "
                      "of the target word.")
@@ -114,6 +126,9 @@ class Options(object):
     # Number of examples for one training step.
     self.batch_size = FLAGS.batch_size
 
+    # Whether a training step shards its examples across threads.
+    self.hogwild = FLAGS.hogwild
+
     # The number of words to predict to the left and right of the target word.
     self.window_size = FLAGS.window_size
 
@@ -124,6 +139,11 @@ class Options(object):
     # Subsampling threshold for word occurrence.
     self.subsample = FLAGS.subsample
 
+    # Whether the training data is streamed rather than held in memory, and
+    # the vocabulary to stream it with, if any.
+    self.streaming = FLAGS.streaming
+    self.train_vocab = FLAGS.train_vocab
+
     # Where to write out summaries.
     self.save_path = FLAGS.save_path
     if not os.path.exists(self.save_path):
@@ -145,7 +165,6 @@ class Word2Vec(object):
     self._id2word = []
     self.build_graph()
     self.build_eval_graph()
-    self.save_vocab()
 
   def read_analogies(self):
     """Reads through the analogy question file.
@@ -182,7 +201,10 @@ class Word2Vec(object):
                                                     batch_size=opts.batch_size,
                                                     window_size=opts.window_size,
                                                     min_count=opts.min_count,
-                                                    subsample=opts.subsample)
+                                                    subsample=opts.subsample,
+                                                    streaming=opts.streaming,
+                                                    vocab_file=(
+                                                        opts.train_vocab or ""))
     (opts.vocab_words, opts.vocab_counts,
      opts.words_per_epoch) = self._session.run([words, counts, words_per_epoch])
     opts.vocab_size = len(opts.vocab_words)
@@ -191,6 +213,9 @@ class Word2Vec(object):
     print("Words per epoch: ", opts.words_per_epoch)
 
     self._id2word = opts.vocab_words
+    # The training op reads the word counts from the saved vocabulary, which
+    # keeps them out of the graph.
+    self.save_vocab()
     for i, w in enumerate(self._id2word):
       self._word2id[w] = i
 
@@ -222,8 +247,10 @@ class Word2Vec(object):
                                           examples,
                                           labels,
                                           lr,
-                                          vocab_count=opts.vocab_counts.tolist(),
-                                          num_negative_samples=opts.num_samples)
+                                          vocab_file=os.path.join(
+                                              opts.save_path, "vocab.txt"),
+                                          num_negative_samples=opts.num_samples,
+                                          hogwild=opts.hogwild)
 
     self._w_in = w_in
     self._examples = examples
@@ -237,11 +264,13 @@ class Word2Vec(object):
   def save_vocab(self):
     """Save the vocabulary to a file so the model can be reloaded."""
     opts = self._options
-    with open(os.path.join(opts.save_path, "vocab.txt"), "w") as f:
+    # The words are written as text, not as their repr under Python 3, since
+    # --train_vocab reads them back.
+    with open(os.path.join(opts.save_path, "vocab.txt"), "wb") as f:
       for i in xrange(opts.vocab_size):
-        vocab_word = tf.compat.as_text(opts.vocab_words[i]).encode("utf-8")
-        f.write("%s %d\n" % (vocab_word,
-                             opts.vocab_counts[i]))
+        vocab_word = tf.compat.as_text(opts.vocab_words[i])
+        f.write(tf.compat.as_bytes("%s %d\n" % (vocab_word,
+                                                opts.vocab_counts[i])))
 
   def build_eval_graph(self):
     """Build the evaluation graph."""
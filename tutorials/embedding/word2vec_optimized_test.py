@@ -36,6 +36,9 @@ class Word2VecTest(tf.test.TestCase):
     FLAGS.train_data = os.path.join(self.get_temp_dir() + "test-text.txt")
     FLAGS.eval_data = os.path.join(self.get_temp_dir() + "eval-text.txt")
     FLAGS.save_path = self.get_temp_dir()
+    FLAGS.hogwild = False
+    FLAGS.streaming = False
+    FLAGS.train_vocab = None
     with open(FLAGS.train_data, "w") as f:
       f.write(
           """alice was beginning to get very tired of sitting by her sister on
@@ -57,6 +60,41 @@ class Word2VecTest(tf.test.TestCase):
     FLAGS.min_count = 0
     word2vec_optimized.main([])
 
+  def testWord2VecOptimizedHogwild(self):
+    FLAGS.batch_size = 5
+    FLAGS.num_neg_samples = 10
+    FLAGS.epochs_to_train = 1
+    FLAGS.min_count = 0
+    FLAGS.hogwild = True
+    word2vec_optimized.main([])
+
+  def testWord2VecOptimizedStreaming(self):
+    FLAGS.batch_size = 5
+    FLAGS.num_neg_samples = 10
+    FLAGS.epochs_to_train = 1
+    FLAGS.min_count = 0
+    FLAGS.streaming = True
+    word2vec_optimized.main([])
+
+  def testWord2VecOptimizedStreamingWithVocab(self):
+    FLAGS.batch_size = 5
+    FLAGS.num_neg_samples = 10
+    FLAGS.epochs_to_train = 1
+    FLAGS.min_count = 0
+    FLAGS.streaming = True
+    word2vec_optimized.main([])
+
+    # The saved vocabulary is read back instead of counting the words again.
+    train_vocab = os.path.join(self.get_temp_dir(), "train-vocab.txt")
+    with open(os.path.join(FLAGS.save_path, "vocab.txt"), "rb") as f:
+      vocab = f.read()
+    self.assertTrue(vocab.startswith(b"UNK "))
+    self.assertIn(b"\nalice ", vocab)
+    with open(train_vocab, "wb") as f:
+      f.write(vocab)
+    FLAGS.train_vocab = train_vocab
+    word2vec_optimized.main([])
+
 
 if __name__ == "__main__":
   tf.test.main()